@@ -0,0 +1,231 @@
+#include "commands.h"
+#include "chess.h"
+#include "engine.h"
+#include "nnue.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdlib>
+
+// agent4k analyse --in EPD (--depth N | --nodes N | --movetime MS)
+//                 [--jobs N] [--hash MB] [--out PATH] [--evalfile PATH]
+//
+// Searches every position of an EPD file and writes one JSON object per
+// line, in input order:
+//
+//   {"index":0,"id":"...","fen":"...","bestmove":"e2e4","score":35,
+//    "depth":8,"nodes":51234,"time":41,"pv":["e2e4","e7e5"]}
+//
+// "id" is present when the EPD line has an id operation. Scores are
+// centipawns for the side to move; a mate n plies ahead scores
+// +-(20000 - n) and adds "mate", the moves to it, negative when the side
+// to move is mated. bestmove is null when the side to move has no legal
+// moves. Each of the --jobs workers owns an engine and takes the next
+// unanalysed position. Engines start every position from an empty table,
+// so results do not depend on the number of jobs or on which worker took
+// a position.
+
+struct AnalyseOptions {
+    string input;
+    string output; // Standard output if empty
+    string evalfile;
+    SearchLimits limits = {0, 0, 0};
+    int jobs = max(1u, thread::hardware_concurrency());
+    size_t hash = 16; // Megabytes per job
+};
+
+struct AnalysePosition {
+    Board board;
+    string id;
+};
+
+// Shared between the workers and the writer
+struct AnalyseState {
+    mutex lock; // Guards everything below
+    condition_variable ready;
+    size_t next = 0;             // Next position to hand out
+    vector<string> lines;        // Finished JSON lines awaiting output
+    vector<bool> done;
+};
+
+static string json_string(string_view text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (uint8_t(c) < 0x20) {
+            const char* hex = "0123456789abcdef";
+            quoted += "\\u00";
+            quoted += hex[c >> 4];
+            quoted += hex[c & 15];
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// The operand of the EPD id operation, without quotes; empty if absent
+static string epd_id(string_view operations) {
+    size_t pos = operations.find("id ");
+    while (pos != string_view::npos && pos > 0 && operations[pos - 1] != ' ' && operations[pos - 1] != ';') {
+        pos = operations.find("id ", pos + 1);
+    }
+    if (pos == string_view::npos) return "";
+
+    string_view operand = operations.substr(pos + 3);
+    operand.remove_prefix(min(operand.size(), operand.find_first_not_of(' ')));
+    if (!operand.empty() && operand[0] == '"') {
+        operand.remove_prefix(1);
+        return string(operand.substr(0, operand.find('"')));
+    }
+    return string(operand.substr(0, operand.find_first_of(" ;")));
+}
+
+static string analyse_position(Engine& engine, const AnalysePosition& position, size_t index,
+                               const SearchLimits& limits) {
+    engine.new_game();
+    auto start = chrono::steady_clock::now();
+    SearchResult result = engine.search(position.board, limits, vector<uint64_t>(1, position.board.hash));
+    long long elapsed_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+
+    bool has_move = result.best_move.from != result.best_move.to;
+    string line = "{\"index\":" + to_string(index);
+    if (!position.id.empty()) line += ",\"id\":" + json_string(position.id);
+    line += ",\"fen\":" + json_string(board_to_fen(position.board));
+    line += ",\"bestmove\":" + (has_move ? json_string(move_to_uci(result.best_move)) : string("null"));
+    line += ",\"score\":" + to_string(result.score);
+    if (mate_in_moves(result.score)) line += ",\"mate\":" + to_string(mate_in_moves(result.score));
+    line += ",\"depth\":" + to_string(result.depth) +
+            ",\"nodes\":" + to_string(result.nodes) + ",\"time\":" + to_string(elapsed_ms) + ",\"pv\":[";
+    for (size_t i = 0; has_move && i < result.pv.size(); i++) {
+        if (i > 0) line += ",";
+        line += json_string(move_to_uci(result.pv[i]));
+    }
+    return line + "]}";
+}
+
+static void analyse_thread(const AnalyseOptions& options, const NnueNetwork* network,
+                           const vector<AnalysePosition>& positions, AnalyseState& state) {
+    EngineOptions engine_options;
+    engine_options.hash = options.hash;
+    engine_options.network = network;
+    Engine engine(engine_options);
+
+    while (true) {
+        size_t index;
+        {
+            lock_guard<mutex> guard(state.lock);
+            if (state.next == positions.size()) return;
+            index = state.next++;
+        }
+
+        string line = analyse_position(engine, positions[index], index, options.limits);
+
+        lock_guard<mutex> guard(state.lock);
+        state.lines[index] = move(line);
+        state.done[index] = true;
+        state.ready.notify_one();
+    }
+}
+
+int analyse_command(int argc, char* argv[]) {
+    AnalyseOptions options;
+    for (int i = 0; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--in" && has_value) {
+            options.input = argv[++i];
+        } else if (arg == "--out" && has_value) {
+            options.output = argv[++i];
+        } else if (arg == "--depth" && has_value) {
+            options.limits.depth = max(1, atoi(argv[++i]));
+        } else if (arg == "--nodes" && has_value) {
+            options.limits.nodes = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--movetime" && has_value) {
+            options.limits.movetime = max(1, atoi(argv[++i]));
+        } else if (arg == "--jobs" && has_value) {
+            options.jobs = max(1, atoi(argv[++i]));
+        } else if (arg == "--hash" && has_value) {
+            options.hash = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--evalfile" && has_value) {
+            options.evalfile = argv[++i];
+        } else {
+            options.input.clear();
+            break;
+        }
+    }
+    const SearchLimits& limits = options.limits;
+    if (options.input.empty() || (limits.depth == 0 && limits.nodes == 0 && limits.movetime == 0)) {
+        cerr << "Usage: agent4k analyse --in EPD (--depth N | --nodes N | --movetime MS)" << endl
+             << "                       [--jobs N] [--hash MB] [--out PATH] [--evalfile PATH]" << endl;
+        return 1;
+    }
+
+    EpdReader reader(options.input);
+    if (!reader.is_open()) {
+        cerr << "Cannot open " << options.input << endl;
+        return 1;
+    }
+    vector<AnalysePosition> positions;
+    string_view line;
+    while (reader.next_line(line)) {
+        string_view operations;
+        AnalysePosition position;
+        if (!parse_epd(line, position.board, &operations)) {
+            cerr << "Skipping invalid EPD line: " << line << endl;
+            continue;
+        }
+        position.id = epd_id(operations);
+        positions.push_back(move(position));
+    }
+
+    NnueNetwork network;
+    if (!options.evalfile.empty() && !network.load(options.evalfile)) {
+        cerr << "Cannot load " << options.evalfile << endl;
+        return 1;
+    }
+    ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output);
+        if (!file) {
+            cerr << "Cannot write " << options.output << endl;
+            return 1;
+        }
+    }
+    ostream& out = options.output.empty() ? cout : file;
+
+    AnalyseState state;
+    state.lines.resize(positions.size());
+    state.done.resize(positions.size());
+
+    vector<thread> threads;
+    const NnueNetwork* evaluator = options.evalfile.empty() ? nullptr : &network;
+    int workers = int(min<size_t>(options.jobs, positions.size()));
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back(analyse_thread, cref(options), evaluator, cref(positions), ref(state));
+    }
+
+    // Stream results in input order as soon as each one and all before it are done
+    auto start = chrono::steady_clock::now();
+    for (size_t written = 0; written < positions.size(); written++) {
+        string result;
+        {
+            unique_lock<mutex> guard(state.lock);
+            state.ready.wait(guard, [&]() { return bool(state.done[written]); });
+            result.swap(state.lines[written]);
+        }
+        out << result << '\n';
+        out.flush();
+    }
+    for (thread& t : threads) t.join();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << positions.size() << " positions in " << fixed << seconds << " s with " << workers << " jobs" << endl;
+    return out ? 0 : 1;
+}
@@ -0,0 +1,492 @@
+#include "chess.h"
+#include "nnue.h"
+#include "packed.h"
+#include "engine.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include <random>
+
+// Microbenchmarks for the hot primitives in chess.cpp.
+//
+// Usage: bench [--reps N] [--iters N] [--filter SUBSTRING] [--evalfile PATH] [--hash MB]
+//
+// Every benchmark runs N repetitions. A repetition loops --iters times over
+// the whole position corpus and reports nanoseconds per call; the summary
+// line shows mean, standard deviation, min, median and the coefficient of
+// variation across repetitions, so an optimisation can be judged against the
+// run-to-run noise of the machine.
+//
+// The search rows report ns per node for a fixed-depth search with the
+// classical and the NNUE evaluation, and the NNUE's nps cost relative to the
+// classical one. Without --evalfile the network has random weights, which
+// cost the same to run. The hash rows run the engine with a --hash MB
+// transposition table on normal and on huge pages, from an emptied table
+// each repetition, and report the speedup huge pages give; the tt_probe
+// rows time table probes at that size with and without a prefetch.
+
+// Real middlegame and endgame positions
+const char* middlegame_fens[] = {
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+    "r1bq1rk1/pp2ppbp/2np1np1/8/3NP3/2N1BP2/PPPQ2PP/R3KB1R w KQ - 3 9",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+    "2rq1rk1/pp1bppbp/2np1np1/8/3NP3/1BN1BP2/PPPQ2PP/2KR3R b - - 0 11",
+    "r1b2rk1/2q1bppp/p2p1n2/np2p3/3PP3/5N1P/PPBN1PP1/R1BQR1K1 w - - 1 14",
+};
+
+const char* endgame_fens[] = {
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "8/8/8/4k3/8/8/4P3/4K3 w - - 0 1",
+    "8/5pk1/6p1/8/3R4/6P1/5PK1/8 w - - 0 40",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+    "8/8/4k3/8/2K5/8/3Q4/8 w - - 0 1",
+    "8/6k1/8/3B4/8/8/2N2K2/8 w - - 0 1",
+    "8/3k4/8/2pP4/2P5/8/8/3K4 w - - 0 50",
+    "2r3k1/5pp1/7p/8/8/1P4P1/P4P1P/3R2K1 b - - 0 30",
+};
+
+// Real game openings, used to benchmark parse_uci_position
+const char* game_commands[] = {
+    "position startpos moves e2e4 e7e5 g1f3 b8c6 f1b5 a7a6 b5a4 g8f6 e1g1 f8e7 f1e1 b7b5 a4b3 d7d6 "
+    "c2c3 e8g8 h2h3 c6a5 b3c2 c7c5 d2d4 d8c7 b1d2 c5d4 c3d4 a5c6 d2b3 a6a5 c1e3 a5a4 b3d2 c8d7",
+    "position startpos moves d2d4 g8f6 c2c4 e7e6 b1c3 f8b4 e2e3 e8g8 f1d3 d7d5 g1f3 c7c5 e1g1 d5c4 "
+    "d3c4 b8d7 a2a3 c5d4 a3b4 d4c3 b2c3 d8c7",
+    "position startpos moves e2e4 c7c5 g1f3 d7d6 d2d4 c5d4 f3d4 g8f6 b1c3 g7g6 c1e3 f8g7 f2f3 e8g8 "
+    "d1d2 b8c6 e1c1 d6d5 e4d5 f6d5 d4c6 b7c6",
+};
+
+// Sink for benchmark results so the compiler cannot drop the calls
+volatile long long bench_sink = 0;
+
+struct BenchStats {
+    double mean;
+    double stddev;
+    double min;
+    double median;
+};
+
+BenchStats compute_stats(vector<double> samples) {
+    BenchStats stats = {0, 0, 0, 0};
+    if (samples.empty()) return stats;
+
+    double sum = 0;
+    for (double s : samples) sum += s;
+    stats.mean = sum / samples.size();
+
+    double variance = 0;
+    for (double s : samples) variance += (s - stats.mean) * (s - stats.mean);
+    if (samples.size() > 1) variance /= (samples.size() - 1);
+    stats.stddev = sqrt(variance);
+
+    sort(samples.begin(), samples.end());
+    stats.min = samples.front();
+    size_t mid = samples.size() / 2;
+    stats.median = (samples.size() % 2) ? samples[mid] : (samples[mid - 1] + samples[mid]) / 2;
+    return stats;
+}
+
+// Run body() once per repetition; body returns the number of calls it made.
+// setup, if given, runs untimed before each repetition.
+BenchStats run_benchmark(const string& name, int reps, const function<long long()>& body,
+                         const function<void()>& setup = nullptr) {
+    vector<double> samples;
+
+    if (setup) setup();
+    body(); // Warm up caches and branch predictors
+
+    for (int rep = 0; rep < reps; rep++) {
+        if (setup) setup();
+        auto start = chrono::steady_clock::now();
+        long long calls = body();
+        auto end = chrono::steady_clock::now();
+
+        double ns = chrono::duration<double, nano>(end - start).count();
+        samples.push_back(calls > 0 ? ns / calls : 0);
+    }
+
+    BenchStats stats = compute_stats(samples);
+    double cv = stats.mean > 0 ? 100.0 * stats.stddev / stats.mean : 0;
+
+    cout << left << setw(26) << name << right << fixed << setprecision(1)
+         << setw(11) << stats.mean
+         << setw(11) << stats.stddev
+         << setw(11) << stats.min
+         << setw(11) << stats.median
+         << setw(8) << cv << "%" << endl;
+    return stats;
+}
+
+int main(int argc, char* argv[]) {
+    int reps = 10;
+    int iters = 200;
+    string filter;
+    string evalfile;
+    size_t hash = 256;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--reps" && i + 1 < argc) {
+            reps = max(1, atoi(argv[++i]));
+        } else if (arg == "--iters" && i + 1 < argc) {
+            iters = max(1, atoi(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--evalfile" && i + 1 < argc) {
+            evalfile = argv[++i];
+        } else if (arg == "--hash" && i + 1 < argc) {
+            hash = max(1, atoi(argv[++i]));
+        } else {
+            cerr << "Usage: bench [--reps N] [--iters N] [--filter SUBSTRING] [--evalfile PATH] [--hash MB]" << endl;
+            return 1;
+        }
+    }
+
+    // Build the corpus
+    vector<Board> boards;
+    for (const char* fen : middlegame_fens) boards.push_back(parse_fen(fen));
+    for (const char* fen : endgame_fens) boards.push_back(parse_fen(fen));
+
+    vector<string> commands(begin(game_commands), end(game_commands));
+
+    // Squares holding each piece type for the side to move, per board
+    vector<vector<int>> piece_squares[7];
+    for (int type = 1; type <= 6; type++) {
+        for (const Board& board : boards) {
+            vector<int> squares;
+            for (int square = 0; square < 64; square++) {
+                int piece = board.squares[square];
+                if (abs(piece) == type && (piece > 0) == board.white_to_move) {
+                    squares.push_back(square);
+                }
+            }
+            piece_squares[type].push_back(squares);
+        }
+    }
+
+    // Pseudo-legal and legal moves per board, for is_legal_move and make_move_simple
+    vector<vector<Move>> pseudo_moves, legal_moves;
+    for (const Board& board : boards) {
+        pseudo_moves.push_back(generate_all_moves(board));
+        legal_moves.push_back(generate_all_legal_moves(board));
+    }
+
+    cout << "Corpus: " << boards.size() << " positions ("
+         << size(middlegame_fens) << " middlegame, " << size(endgame_fens) << " endgame), "
+         << commands.size() << " game commands" << endl;
+    cout << "Repetitions: " << reps << ", iterations per repetition: " << iters << endl << endl;
+    cout << left << setw(26) << "function (ns/call)" << right
+         << setw(11) << "mean" << setw(11) << "stddev" << setw(11) << "min"
+         << setw(11) << "median" << setw(9) << "cv" << endl;
+
+    auto wanted = [&](const string& name) {
+        return filter.empty() || name.find(filter) != string::npos;
+    };
+
+    typedef vector<Move> (*PieceGenerator)(const Board&, int);
+    const PieceGenerator generators[7] = {
+        nullptr, generate_pawn_moves, generate_knight_moves, generate_bishop_moves,
+        generate_rook_moves, generate_queen_moves, generate_king_moves
+    };
+    const char* generator_names[7] = {
+        "", "generate_pawn_moves", "generate_knight_moves", "generate_bishop_moves",
+        "generate_rook_moves", "generate_queen_moves", "generate_king_moves"
+    };
+
+    for (int type = 1; type <= 6; type++) {
+        if (!wanted(generator_names[type])) continue;
+        run_benchmark(generator_names[type], reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (size_t b = 0; b < boards.size(); b++) {
+                    for (int square : piece_squares[type][b]) {
+                        total += generators[type](boards[b], square).size();
+                        calls++;
+                    }
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    if (wanted("generate_all_moves")) {
+        run_benchmark("generate_all_moves", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (const Board& board : boards) {
+                    total += generate_all_moves(board).size();
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    if (wanted("generate_all_legal_moves")) {
+        run_benchmark("generate_all_legal_moves", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (const Board& board : boards) {
+                    total += generate_all_legal_moves(board).size();
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    if (wanted("is_in_check")) {
+        run_benchmark("is_in_check", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (const Board& board : boards) {
+                    total += is_in_check(board, board.white_to_move);
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    if (wanted("is_legal_move")) {
+        run_benchmark("is_legal_move", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (size_t b = 0; b < boards.size(); b++) {
+                    for (const Move& move : pseudo_moves[b]) {
+                        total += is_legal_move(boards[b], move);
+                        calls++;
+                    }
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    // Includes the board copy, as in every caller of make_move_simple
+    if (wanted("make_move_simple")) {
+        run_benchmark("make_move_simple", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (size_t b = 0; b < boards.size(); b++) {
+                    for (const Move& move : legal_moves[b]) {
+                        Board temp_board = boards[b];
+                        make_move_simple(temp_board, move);
+                        total += temp_board.en_passant_square;
+                        calls++;
+                    }
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    if (wanted("evaluate_position")) {
+        run_benchmark("evaluate_position", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (const Board& board : boards) {
+                    total += evaluate_position(board);
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    // Evaluation with the pawn hash table a search thread would use
+    if (wanted("evaluate_position")) {
+        SearchContext context;
+        run_benchmark("evaluate_position (ctx)", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (const Board& board : boards) {
+                    total += evaluate_position(board, context);
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    // The whole corpus in one call; compare per board with evaluate_position
+    if (wanted("evaluate_batch")) {
+        vector<int> scores(boards.size());
+        run_benchmark("evaluate_batch", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                evaluate_batch(boards.data(), boards.size(), scores.data());
+                total += scores[it % scores.size()];
+                calls += boards.size();
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    // Fixed-depth search, ns per node, with the eval cache off so every leaf is evaluated
+    if (wanted("search")) {
+        NnueNetwork network;
+        if (evalfile.empty()) {
+            network.randomize(1);
+        } else if (!network.load(evalfile)) {
+            cerr << "Could not load " << evalfile << endl;
+            return 1;
+        }
+
+        BenchStats stats[2];
+        for (int use_nnue = 0; use_nnue < 2; use_nnue++) {
+            SearchContext context;
+            context.eval_cache.resize(0);
+            context.network = use_nnue ? &network : nullptr;
+
+            string name = use_nnue ? string("search (nnue, ") + nnue_simd_name() + ")" : "search (classical)";
+            stats[use_nnue] = run_benchmark(name, reps, [&]() {
+                long long nodes = 0;
+                for (const Board& board : boards) {
+                    search_best_move(board, 2, vector<uint64_t>(1, board.hash), context);
+                    nodes += context.nodes;
+                }
+                return nodes;
+            });
+        }
+        cout << "NNUE nps relative to classical: " << setprecision(2)
+             << stats[0].median / stats[1].median << "x" << endl;
+    }
+
+    // Engine search on a large table, ns per node; the pages differ only in
+    // how many TLB entries the table's scattered probes need
+    if (wanted("hash")) {
+        BenchStats stats[2];
+        for (int huge = 0; huge < 2; huge++) {
+            EngineOptions options;
+            options.hash = hash;
+            options.large_pages = huge;
+            Engine engine(options);
+
+            string name = "hash " + to_string(hash) + " MB, " + (engine.hash_pages() == pages_normal ? "4K" : "huge");
+            stats[huge] = run_benchmark(name, reps, [&]() {
+                long long nodes = 0;
+                for (const Board& board : boards) {
+                    nodes += engine.search(board, SearchLimits{5, 0, 0}, vector<uint64_t>(1, board.hash)).nodes;
+                }
+                return nodes;
+            }, [&]() { engine.new_game(); });
+            if (huge) cout << "Huge pages: " << page_kind_name(engine.hash_pages()) << endl;
+        }
+        cout << "Huge-page nps relative to normal pages: " << setprecision(2)
+             << stats[0].median / stats[1].median << "x" << endl;
+    }
+
+    // Probes of random positions in a --hash MB table, each after a
+    // make_move_simple as in the search, without and with the bucket
+    // prefetched before the move
+    if (wanted("tt_probe")) {
+        TranspositionTable table(hash);
+        table.clear(); // Commit every page, as a table in use would be
+        mt19937_64 rng(1);
+        vector<uint64_t> keys(1 << 16);
+        for (uint64_t& key : keys) {
+            key = rng();
+            table.store(key, Move(12, 28), 0, 1, bound_exact);
+        }
+
+        BenchStats stats[2];
+        for (int prefetch = 0; prefetch < 2; prefetch++) {
+            stats[prefetch] = run_benchmark(prefetch ? "tt_probe (prefetched)" : "tt_probe", reps, [&]() {
+                long long calls = 0, total = 0;
+                for (size_t i = 0; i < keys.size(); i++) {
+                    size_t b = i % boards.size();
+                    if (prefetch) table.prefetch(keys[i]);
+                    Board child = boards[b];
+                    make_move_simple(child, legal_moves[b][i % legal_moves[b].size()]);
+                    TTHit hit;
+                    total += table.probe(keys[i], hit) + (child.hash & 1);
+                    calls++;
+                }
+                bench_sink += total;
+                return calls;
+            });
+        }
+        cout << "Prefetched probes relative to plain probes: " << setprecision(2)
+             << stats[0].median / stats[1].median << "x" << endl;
+    }
+
+    if (wanted("parse_fen")) {
+        vector<string> fens;
+        for (const char* fen : middlegame_fens) fens.push_back(fen);
+        for (const char* fen : endgame_fens) fens.push_back(fen);
+
+        run_benchmark("parse_fen", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (const string& fen : fens) {
+                    total += parse_fen(fen).hash & 1;
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    // Packed positions, the binary alternative to parse_fen for datasets
+    if (wanted("packed")) {
+        vector<PackedPosition> packed(boards.size());
+        run_benchmark("pack_position", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (size_t i = 0; i < boards.size(); i++) {
+                    total += pack_position(boards[i], packed[i]);
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+
+        Board board;
+        run_benchmark("unpack_position", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (const PackedPosition& position : packed) {
+                    unpack_position(position, board);
+                    total += board.hash & 1;
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    if (wanted("parse_uci_position")) {
+        run_benchmark("parse_uci_position", reps, [&]() {
+            long long calls = 0, total = 0;
+            for (int it = 0; it < iters; it++) {
+                for (const string& command : commands) {
+                    total += parse_uci_position(command).white_to_move;
+                    calls++;
+                }
+            }
+            bench_sink += total;
+            return calls;
+        });
+    }
+
+    return 0;
+}
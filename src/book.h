@@ -0,0 +1,55 @@
+#pragma once
+#include "chess.h"
+#include <random>
+
+// Polyglot opening books (.bin). A book is an array of 16-byte big-endian
+// entries sorted by key, several entries per position:
+//
+//   key     uint64  polyglot_key of the position
+//   move    uint16  to file in bits 0-2, to rank 3-5, from file 6-8,
+//                   from rank 9-11, promotion 12-14 (1 knight .. 4 queen)
+//   weight  uint16  relative frequency of the move; 0 is never played
+//   learn   uint32  unused
+//
+// Castling is stored as the king taking its own rook (e1h1 for e1g1).
+
+// The Polyglot Zobrist key, not board.hash: it uses Polyglot's published
+// random numbers, and counts the en passant file only when a pawn of the
+// side to move stands next to the double-pushed pawn
+uint64_t polyglot_key(const Board& board);
+
+uint16_t polyglot_move(const Move& move); // Encode a legal move, castling by its flag
+Move decode_polyglot_move(uint16_t encoded, const Board& board); // Castling back to king moves
+
+struct BookMove {
+    Move move;
+    int weight;
+};
+
+// Reads a book through a read-only memory mapping; only the pages the
+// binary search touches are read from disk
+class PolyglotBook {
+public:
+    PolyglotBook();
+    ~PolyglotBook();
+    PolyglotBook(const PolyglotBook&) = delete;
+    PolyglotBook& operator=(const PolyglotBook&) = delete;
+
+    // Replaces the open book; false, leaving no book open, if the file is
+    // missing or its size is not a whole number of entries
+    bool open(const string& path);
+    void close();
+    bool is_open() const;
+    size_t size() const; // Number of entries
+
+    // The legal moves the book has for the position, in file order
+    vector<BookMove> moves(const Board& board) const;
+
+    // The highest-weight move if best is set, otherwise a move drawn in
+    // proportion to the weights; the null move if the book has none
+    Move choose(const Board& board, bool best, mt19937_64& rng) const;
+
+private:
+    const uint8_t* data;
+    size_t count;
+};
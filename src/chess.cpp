@@ -1,16 +1,158 @@
 #include "chess.h"
-#include <sstream>
+#include "nnue.h"
+#include "syzygy.h"
+#include "eval_params.h"
 #include <cctype>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <charconv>
+#include <immintrin.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 Board::Board() : white_to_move(true), en_passant_square(-1), 
                  white_can_castle_kingside(false), white_can_castle_queenside(false),
-                 black_can_castle_kingside(false), black_can_castle_queenside(false) {
+                 black_can_castle_kingside(false), black_can_castle_queenside(false),
+                 halfmove_clock(0), fullmove_number(1), hash(0), pawn_hash(0),
+                 mg_score(0), eg_score(0), phase(0) {
     for (int i = 0; i < 64; i++) {
         squares[i] = 0;
     }
 }
 
-Move::Move(int f, int t, int p) : from(f), to(t), promotion(p) {}
+Move::Move() : from(0), to(0), flag(0) {}
+
+Move::Move(int f, int t, int p) : from(f), to(t), flag(p ? move_promotion + p - 2 : 0) {}
+
+Move Move::with_flag(int f, int t, int flag) {
+    Move move(f, t);
+    move.flag = flag;
+    return move;
+}
+
+int Move::promotion() const {
+    return flag & move_promotion ? flag - move_promotion + 2 : 0;
+}
+
+bool Move::is_castling() const {
+    return flag == move_castling;
+}
+
+bool Move::is_en_passant() const {
+    return flag == move_en_passant;
+}
+
+uint16_t Move::bits() const {
+    return uint16_t(from | to << 6 | flag << 12);
+}
+
+Move Move::from_bits(uint16_t bits) {
+    return with_flag(bits & 63, (bits >> 6) & 63, bits >> 12);
+}
+
+// Zobrist keys, generated at compile time with splitmix64
+struct ZobristKeys {
+    uint64_t pieces[13][64]; // Indexed by piece + 6; the empty square keys stay 0
+    uint64_t black_to_move;
+    uint64_t castling[4];    // K, Q, k, q
+    uint64_t en_passant[8];  // By file of the target square
+    
+    constexpr ZobristKeys() : pieces(), black_to_move(0), castling(), en_passant() {
+        uint64_t state = 0x4b34a7d2e1f00d5ULL;
+        auto next = [&state]() {
+            state += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        };
+        for (int piece = 0; piece < 13; piece++) {
+            for (int square = 0; square < 64; square++) {
+                pieces[piece][square] = (piece == 6) ? 0 : next();
+            }
+        }
+        black_to_move = next();
+        for (int i = 0; i < 4; i++) castling[i] = next();
+        for (int i = 0; i < 8; i++) en_passant[i] = next();
+    }
+};
+
+constexpr ZobristKeys zobrist;
+
+static uint64_t castling_hash(const Board& board) {
+    uint64_t key = 0;
+    if (board.white_can_castle_kingside) key ^= zobrist.castling[0];
+    if (board.white_can_castle_queenside) key ^= zobrist.castling[1];
+    if (board.black_can_castle_kingside) key ^= zobrist.castling[2];
+    if (board.black_can_castle_queenside) key ^= zobrist.castling[3];
+    return key;
+}
+
+static uint64_t en_passant_hash(const Board& board) {
+    return (board.en_passant_square != -1) ? zobrist.en_passant[board.en_passant_square % 8] : 0;
+}
+
+// Tapered piece-square evaluation. The tuned tables and terms live in
+// eval_params.h; tables are laid out as seen from white, a8 first, and
+// white pieces look up square ^ 56.
+const int phase_increments[7] = {0, 0, 1, 1, 2, 4, 0};
+
+// Signed material + piece-square contribution of every piece on every square,
+// indexed by piece + 6 like the Zobrist keys
+struct PieceSquareScores {
+    int mg[13][64];
+    int eg[13][64];
+    
+    constexpr PieceSquareScores() : mg(), eg() {
+        for (int type = 1; type <= 6; type++) {
+            for (int square = 0; square < 64; square++) {
+                // White reads the table mirrored, black reads it as laid out
+                mg[6 + type][square] = mg_piece_values[type] + mg_pst[type][square ^ 56];
+                eg[6 + type][square] = eg_piece_values[type] + eg_pst[type][square ^ 56];
+                mg[6 - type][square] = -(mg_piece_values[type] + mg_pst[type][square]);
+                eg[6 - type][square] = -(eg_piece_values[type] + eg_pst[type][square]);
+            }
+        }
+    }
+};
+
+constexpr PieceSquareScores piece_square_scores;
+
+uint64_t compute_hash(const Board& board) {
+    uint64_t key = 0;
+    for (int square = 0; square < 64; square++) {
+        key ^= zobrist.pieces[board.squares[square] + 6][square];
+    }
+    if (!board.white_to_move) key ^= zobrist.black_to_move;
+    return key ^ castling_hash(board) ^ en_passant_hash(board);
+}
+
+// One pass over the occupied squares; this is what decoding a FEN or a
+// packed position costs on top of placing the pieces
+void refresh_board(Board& board) {
+    uint64_t key = 0, pawn_key = 0;
+    int mg = 0, eg = 0, phase = 0;
+    for (int square = 0; square < 64; square++) {
+        int piece = board.squares[square];
+        if (piece == 0) continue;
+        
+        uint64_t piece_key = zobrist.pieces[piece + 6][square];
+        key ^= piece_key;
+        if (abs(piece) == 1) pawn_key ^= piece_key;
+        mg += piece_square_scores.mg[piece + 6][square];
+        eg += piece_square_scores.eg[piece + 6][square];
+        phase += phase_increments[abs(piece)];
+    }
+    if (!board.white_to_move) key ^= zobrist.black_to_move;
+    board.hash = key ^ castling_hash(board) ^ en_passant_hash(board);
+    board.pawn_hash = pawn_key;
+    board.mg_score = mg;
+    board.eg_score = eg;
+    board.phase = phase;
+}
 
 bool is_valid_square(int square) {
     return square >= 0 && square < 64;
@@ -23,7 +165,7 @@ string square_to_string(int square) {
     return string(1, file) + string(1, rank);
 }
 
-int string_to_square(const string& str) {
+int string_to_square(string_view str) {
     if (str.length() != 2) return -1;
     int file = str[0] - 'a';
     int rank = str[1] - '1';
@@ -72,6 +214,9 @@ Board create_starting_position() {
     board.white_can_castle_queenside = true;
     board.black_can_castle_kingside = true;
     board.black_can_castle_queenside = true;
+    board.halfmove_clock = 0;
+    board.fullmove_number = 1;
+    refresh_board(board);
     return board;
 }
 
@@ -82,6 +227,13 @@ int get_piece(const Board& board, int square) {
 
 void set_piece(Board& board, int square, int piece) {
     if (is_valid_square(square)) {
+        int old_piece = board.squares[square];
+        board.hash ^= zobrist.pieces[old_piece + 6][square] ^ zobrist.pieces[piece + 6][square];
+        if (abs(old_piece) == 1) board.pawn_hash ^= zobrist.pieces[old_piece + 6][square];
+        if (abs(piece) == 1) board.pawn_hash ^= zobrist.pieces[piece + 6][square];
+        board.mg_score += piece_square_scores.mg[piece + 6][square] - piece_square_scores.mg[old_piece + 6][square];
+        board.eg_score += piece_square_scores.eg[piece + 6][square] - piece_square_scores.eg[old_piece + 6][square];
+        board.phase += phase_increments[abs(piece)] - phase_increments[abs(old_piece)];
         board.squares[square] = piece;
     }
 }
@@ -164,7 +316,7 @@ vector<Move> generate_pawn_moves(const Board& board, int square) {
             int rank_diff = abs((board.en_passant_square / 8) - (square / 8));
             
             if (file_diff == 1 && rank_diff == 1) {
-                moves.push_back(Move(square, board.en_passant_square));
+                moves.push_back(Move::with_flag(square, board.en_passant_square, move_en_passant));
             }
         }
     }
@@ -367,28 +519,28 @@ vector<Move> generate_king_moves(const Board& board, int square) {
         // White kingside castling
         if (board.white_can_castle_kingside && square == 4) { // King on e1
             if (get_piece(board, 5) == 0 && get_piece(board, 6) == 0 && get_piece(board, 7) == 4) {
-                moves.push_back(Move(square, 6)); // King moves to g1
+                moves.push_back(Move::with_flag(square, 6, move_castling)); // King moves to g1
             }
         }
         
         // White queenside castling
         if (board.white_can_castle_queenside && square == 4) { // King on e1
             if (get_piece(board, 1) == 0 && get_piece(board, 2) == 0 && get_piece(board, 3) == 0 && get_piece(board, 0) == 4) {
-                moves.push_back(Move(square, 2)); // King moves to c1
+                moves.push_back(Move::with_flag(square, 2, move_castling)); // King moves to c1
             }
         }
     } else {
         // Black kingside castling
         if (board.black_can_castle_kingside && square == 60) { // King on e8
             if (get_piece(board, 61) == 0 && get_piece(board, 62) == 0 && get_piece(board, 63) == -4) {
-                moves.push_back(Move(square, 62)); // King moves to g8
+                moves.push_back(Move::with_flag(square, 62, move_castling)); // King moves to g8
             }
         }
         
         // Black queenside castling
         if (board.black_can_castle_queenside && square == 60) { // King on e8
             if (get_piece(board, 57) == 0 && get_piece(board, 58) == 0 && get_piece(board, 59) == 0 && get_piece(board, 56) == -4) {
-                moves.push_back(Move(square, 58)); // King moves to c8
+                moves.push_back(Move::with_flag(square, 58, move_castling)); // King moves to c8
             }
         }
     }
@@ -460,12 +612,15 @@ void make_move_simple(Board& board, const Move& move) {
     int piece = get_piece(board, move.from);
     int captured_piece = get_piece(board, move.to);
     
+    // Castling rights and en passant are hashed back in once they are updated
+    board.hash ^= castling_hash(board) ^ en_passant_hash(board);
+    
     // Basic move: remove piece from source, place on destination
     set_piece(board, move.from, 0);
     
     // Handle promotion
-    if (move.promotion != 0) {
-        int promoted_piece = (piece > 0) ? move.promotion : -move.promotion;
+    if (move.promotion() != 0) {
+        int promoted_piece = (piece > 0) ? move.promotion() : -move.promotion();
         set_piece(board, move.to, promoted_piece);
     } else {
         set_piece(board, move.to, piece);
@@ -476,26 +631,24 @@ void make_move_simple(Board& board, const Move& move) {
     bool is_white = piece > 0;
     
     // Handle castling
-    if (piece_type == 6) { // King
-        if (abs(move.to - move.from) == 2) { // Castling move
-            if (move.to > move.from) { // Kingside
-                int rook_from = is_white ? 7 : 63;
-                int rook_to = is_white ? 5 : 61;
-                int rook = get_piece(board, rook_from);
-                set_piece(board, rook_from, 0);
-                set_piece(board, rook_to, rook);
-            } else { // Queenside
-                int rook_from = is_white ? 0 : 56;
-                int rook_to = is_white ? 3 : 59;
-                int rook = get_piece(board, rook_from);
-                set_piece(board, rook_from, 0);
-                set_piece(board, rook_to, rook);
-            }
+    if (move.is_castling()) {
+        if (move.to > move.from) { // Kingside
+            int rook_from = is_white ? 7 : 63;
+            int rook_to = is_white ? 5 : 61;
+            int rook = get_piece(board, rook_from);
+            set_piece(board, rook_from, 0);
+            set_piece(board, rook_to, rook);
+        } else { // Queenside
+            int rook_from = is_white ? 0 : 56;
+            int rook_to = is_white ? 3 : 59;
+            int rook = get_piece(board, rook_from);
+            set_piece(board, rook_from, 0);
+            set_piece(board, rook_to, rook);
         }
     }
     
     // Handle en passant capture
-    if (piece_type == 1 && move.to == board.en_passant_square) {
+    if (move.is_en_passant()) {
         // Remove the captured pawn
         int captured_pawn_square = is_white ? move.to - 8 : move.to + 8;
         set_piece(board, captured_pawn_square, 0);
@@ -528,17 +681,27 @@ void make_move_simple(Board& board, const Move& move) {
         }
     }
     
+    // Update move clocks
+    if (piece_type == 1 || captured_piece != 0) {
+        board.halfmove_clock = 0;
+    } else {
+        board.halfmove_clock++;
+    }
+    if (!is_white) {
+        board.fullmove_number++;
+    }
+    
     // Update turn
     board.white_to_move = !board.white_to_move;
+    board.hash ^= castling_hash(board) ^ en_passant_hash(board) ^ zobrist.black_to_move;
 }
 
 bool is_legal_move(const Board& board, const Move& move) {
     int piece = get_piece(board, move.from);
-    int piece_type = abs(piece);
     bool is_white = piece > 0;
     
     // Special handling for castling
-    if (piece_type == 6 && abs(move.to - move.from) == 2) {
+    if (move.is_castling()) {
         // This is a castling move - check if king is in check, passes through check, or ends in check
         
         // 1. King cannot be in check before castling
@@ -570,13 +733,285 @@ bool is_legal_move(const Board& board, const Move& move) {
     return !our_king_in_check;
 }
 
+// Text parsing
+Tokenizer::Tokenizer(string_view text) : rest(text) {}
+
+string_view Tokenizer::next() {
+    size_t start = rest.find_first_not_of(" \t\r\n");
+    if (start == string_view::npos) {
+        rest = string_view();
+        return string_view();
+    }
+    size_t end = rest.find_first_of(" \t\r\n", start);
+    if (end == string_view::npos) end = rest.size();
+    
+    string_view token = rest.substr(start, end - start);
+    rest.remove_prefix(end);
+    return token;
+}
+
+// Parse a whole token as a non-negative integer
+static bool parse_int(string_view str, int& value) {
+    if (str.empty()) return false;
+    const char* end = str.data() + str.size();
+    auto result = from_chars(str.data(), end, value);
+    return result.ec == errc() && result.ptr == end && value >= 0;
+}
+
+// FEN/EPD functions
+const char piece_chars[] = " pnbrqk";
+
+// Parse the four position fields shared by FEN and EPD into an empty
+// board. False if any is malformed: the placement must give eight ranks of
+// eight files with one king per side, the side to move must be w or b,
+// castling - or some of KQkq, and the en passant target - or a square on
+// the rank the last move's pawn passed over.
+static bool parse_position_fields(Board& board, string_view pieces, string_view turn,
+                                  string_view castling, string_view en_passant) {
+    // Parse piece placement, rank 8 first
+    int rank = 7, file = 0, white_kings = 0, black_kings = 0;
+    for (char c : pieces) {
+        if (c == '/') {
+            if (file != 8 || rank == 0) return false;
+            rank--; // Move to next rank down
+            file = 0;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0'; // Skip empty squares
+            if (file > 8) return false;
+        } else {
+            // Place piece
+            int piece = 0;
+            switch (tolower(c)) {
+                case 'p': piece = 1; break;
+                case 'n': piece = 2; break;
+                case 'b': piece = 3; break;
+                case 'r': piece = 4; break;
+                case 'q': piece = 5; break;
+                case 'k': piece = 6; break;
+                default: return false;
+            }
+            if (file == 8) return false;
+            if (islower(c)) piece = -piece; // Black piece
+            white_kings += piece == 6;
+            black_kings += piece == -6;
+            set_piece(board, rank * 8 + file, piece);
+            file++;
+        }
+    }
+    if (rank != 0 || file != 8 || white_kings != 1 || black_kings != 1) return false;
+    
+    // Parse turn
+    if (turn != "w" && turn != "b") return false;
+    board.white_to_move = turn == "w";
+    
+    // Parse castling rights, each letter at most once
+    if (castling.empty()) return false;
+    if (castling != "-") {
+        bool seen[4] = {false, false, false, false};
+        for (char c : castling) {
+            size_t right = string_view("KQkq").find(c);
+            if (right == string_view::npos || seen[right]) return false;
+            seen[right] = true;
+        }
+        board.white_can_castle_kingside = seen[0];
+        board.white_can_castle_queenside = seen[1];
+        board.black_can_castle_kingside = seen[2];
+        board.black_can_castle_queenside = seen[3];
+    }
+    
+    // Parse en passant: behind a black pawn on rank 6, a white one on rank 3
+    if (en_passant != "-") {
+        int square = string_to_square(en_passant);
+        if (square < 0 || square / 8 != (board.white_to_move ? 5 : 2)) return false;
+        board.en_passant_square = square;
+    }
+    
+    board.hash = compute_hash(board);
+    return true;
+}
+
+// Serialize the four position fields shared by FEN and EPD
+static string position_fields(const Board& board) {
+    string result;
+    
+    // Piece placement, rank 8 down to rank 1
+    for (int rank = 7; rank >= 0; rank--) {
+        int empty = 0;
+        for (int file = 0; file < 8; file++) {
+            int piece = board.squares[rank * 8 + file];
+            if (piece == 0) {
+                empty++;
+                continue;
+            }
+            if (empty > 0) {
+                result += char('0' + empty);
+                empty = 0;
+            }
+            char c = piece_chars[abs(piece)];
+            result += (piece > 0) ? char(toupper(c)) : c;
+        }
+        if (empty > 0) result += char('0' + empty);
+        if (rank > 0) result += '/';
+    }
+    
+    result += board.white_to_move ? " w " : " b ";
+    
+    // Castling rights
+    string castling;
+    if (board.white_can_castle_kingside) castling += 'K';
+    if (board.white_can_castle_queenside) castling += 'Q';
+    if (board.black_can_castle_kingside) castling += 'k';
+    if (board.black_can_castle_queenside) castling += 'q';
+    result += castling.empty() ? "-" : castling;
+    
+    // En passant target
+    result += ' ';
+    result += (board.en_passant_square != -1) ? square_to_string(board.en_passant_square) : "-";
+    
+    return result;
+}
+
+// Parse a FEN string. The halfmove and fullmove clocks are optional and
+// default to 0 and 1, so the position part of an EPD record is accepted too.
+bool parse_fen(string_view fen, Board& board) {
+    Board parsed;
+    Tokenizer tokens(fen);
+    string_view pieces = tokens.next();
+    string_view turn = tokens.next();
+    string_view castling = tokens.next();
+    string_view en_passant = tokens.next();
+    if (!parse_position_fields(parsed, pieces, turn, castling, en_passant)) return false;
+    
+    // Clocks, when present, must be numbers, and nothing may follow them
+    string_view halfmove = tokens.next(), fullmove = tokens.next();
+    int value;
+    if (!halfmove.empty()) {
+        if (!parse_int(halfmove, value)) return false;
+        parsed.halfmove_clock = value;
+    }
+    if (!fullmove.empty()) {
+        if (!parse_int(fullmove, value)) return false;
+        parsed.fullmove_number = max(1, value);
+    }
+    if (!tokens.next().empty()) return false;
+    
+    board = parsed;
+    return true;
+}
+
+Board parse_fen(string_view fen) {
+    Board board;
+    parse_fen(fen, board);
+    return board;
+}
+
+string board_to_fen(const Board& board) {
+    return position_fields(board) + " " + to_string(board.halfmove_clock) + " " +
+           to_string(board.fullmove_number);
+}
+
+// Parse an EPD record: four position fields followed by operations. The
+// "hmvc" and "fmvn" opcodes set the move clocks. Records that carry FEN-style
+// numeric clocks after the position (as in perftsuite.epd) are accepted too.
+// Everything after the position is returned in operations if requested; it
+// points into the input, so nothing is copied.
+bool parse_epd(string_view epd, Board& parsed, string_view* operations) {
+    Board board;
+    Tokenizer tokens(epd);
+    string_view pieces = tokens.next();
+    string_view turn = tokens.next();
+    string_view castling = tokens.next();
+    string_view en_passant = tokens.next();
+    if (!parse_position_fields(board, pieces, turn, castling, en_passant)) return false;
+    
+    // Optional FEN-style clocks
+    string_view ops = tokens.rest;
+    Tokenizer clocks = tokens;
+    int halfmove, fullmove;
+    if (parse_int(clocks.next(), halfmove) && parse_int(clocks.next(), fullmove)) {
+        board.halfmove_clock = halfmove;
+        board.fullmove_number = max(1, fullmove);
+        ops = clocks.rest;
+    }
+    
+    size_t first = ops.find_first_not_of(" \t\r\n");
+    ops = (first == string_view::npos) ? string_view() : ops.substr(first);
+    size_t last = ops.find_last_not_of(" \t\r\n");
+    ops = ops.substr(0, last == string_view::npos ? 0 : last + 1);
+    
+    // Clock opcodes
+    Tokenizer op_tokens(ops);
+    for (string_view opcode = op_tokens.next(); !opcode.empty(); opcode = op_tokens.next()) {
+        if (opcode != "hmvc" && opcode != "fmvn") continue;
+        
+        string_view operand = op_tokens.next();
+        if (!operand.empty() && operand.back() == ';') operand.remove_suffix(1);
+        int value;
+        if (!parse_int(operand, value)) continue;
+        
+        if (opcode == "hmvc") {
+            board.halfmove_clock = value;
+        } else {
+            board.fullmove_number = max(1, value);
+        }
+    }
+    
+    if (operations) *operations = ops;
+    parsed = board;
+    return true;
+}
+
+string board_to_epd(const Board& board) {
+    return position_fields(board) + " hmvc " + to_string(board.halfmove_clock) + "; fmvn " +
+           to_string(board.fullmove_number) + ";";
+}
+
+// Memory-mapped EPD reader
+EpdReader::EpdReader(const string& path) : data(nullptr), size(0), pos(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapped);
+            size = st.st_size;
+        }
+    }
+    close(fd);
+}
+
+EpdReader::~EpdReader() {
+    if (data) munmap(const_cast<char*>(data), size);
+}
+
+bool EpdReader::is_open() const {
+    return data != nullptr;
+}
+
+bool EpdReader::next_line(string_view& line) {
+    while (pos < size) {
+        const char* start = data + pos;
+        const char* newline = static_cast<const char*>(memchr(start, '\n', size - pos));
+        size_t length = newline ? size_t(newline - start) : size - pos;
+        pos += length + 1;
+        
+        line = string_view(start, length);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.find_first_not_of(" \t") != string_view::npos) return true;
+    }
+    return false;
+}
+
 // UCI interface functions
 string move_to_uci(const Move& move) {
     string result = square_to_string(move.from) + square_to_string(move.to);
     
     // Add promotion piece if applicable
-    if (move.promotion != 0) {
-        switch (move.promotion) {
+    if (move.promotion() != 0) {
+        switch (move.promotion()) {
             case 2: result += "n"; break; // knight
             case 3: result += "b"; break; // bishop  
             case 4: result += "r"; break; // rook
@@ -587,11 +1022,14 @@ string move_to_uci(const Move& move) {
     return result;
 }
 
-Move uci_to_move(const string& uci_str) {
-    if (uci_str.length() < 4) return Move(-1, -1); // Invalid
+// The squares and promotion piece of a UCI move, without the flags only
+// the board can supply
+static Move parse_uci_move(string_view uci_str) {
+    if (uci_str.length() < 4) return Move(); // Invalid
     
     int from = string_to_square(uci_str.substr(0, 2));
     int to = string_to_square(uci_str.substr(2, 2));
+    if (from < 0 || to < 0) return Move();
     int promotion = 0;
     
     // Check for promotion
@@ -608,157 +1046,1881 @@ Move uci_to_move(const string& uci_str) {
     return Move(from, to, promotion);
 }
 
+Move uci_to_move(const Board& board, string_view uci_str) {
+    Move move = parse_uci_move(uci_str);
+    int piece_type = abs(board.squares[move.from]);
+    if (piece_type == 6 && abs(move.to - move.from) == 2) {
+        move = Move::with_flag(move.from, move.to, move_castling);
+    } else if (piece_type == 1 && move.to == board.en_passant_square && move.from != move.to) {
+        move = Move::with_flag(move.from, move.to, move_en_passant);
+    }
+    return move;
+}
 
-Board parse_uci_position(const string& position_command) {
-    istringstream iss(position_command);
-    string token;
-    iss >> token; // Skip "position"
-    
-    Board board;
-    
-    if (iss >> token) {
-        if (token == "startpos") {
-            board = create_starting_position();
+// Apply the moves in tokens to board, recording each new hash in history if given
+static void apply_uci_moves(Board& board, Tokenizer& tokens, vector<uint64_t>* history) {
+    for (string_view token = tokens.next(); !token.empty(); token = tokens.next()) {
+        Move move = uci_to_move(board, token);
+        if (move.from != move.to) {
+            make_move_simple(board, move);
+            if (history) history->push_back(board.hash);
         }
-        // For 4k engine, only support startpos (no FEN parsing needed)
     }
-    
-    // Check for moves
-    if (iss >> token && token == "moves") {
-        // Apply moves
-        while (iss >> token) {
-            Move move = uci_to_move(token);
-            if (move.from != -1 && move.to != -1) {
-                make_move_simple(board, move);
-            }
+}
+
+// Set up the base position of a position command ("startpos" or "fen ...").
+// Leaves tokens positioned after the "moves" keyword, if any. False if the
+// command names neither or its FEN is malformed.
+static bool parse_uci_base(Tokenizer& tokens, Board& board) {
+    tokens.next(); // Skip "position"
+    
+    string_view token = tokens.next();
+    
+    if (token == "startpos") {
+        board = create_starting_position();
+        token = tokens.next();
+    } else if (token == "fen") {
+        // FEN fields run up to the "moves" keyword
+        const char* fen_start = nullptr;
+        const char* fen_end = nullptr;
+        for (token = tokens.next(); !token.empty() && token != "moves"; token = tokens.next()) {
+            if (!fen_start) fen_start = token.data();
+            fen_end = token.data() + token.size();
         }
+        if (!fen_start || !parse_fen(string_view(fen_start, fen_end - fen_start), board)) return false;
+    } else {
+        return false;
     }
     
+    if (token != "moves") tokens = Tokenizer(string_view());
+    return true;
+}
+
+Board parse_uci_position(string_view position_command) {
+    Tokenizer tokens(position_command);
+    Board board;
+    if (!parse_uci_base(tokens, board)) return Board();
+    apply_uci_moves(board, tokens, nullptr);
     return board;
 }
 
-vector<Move> generate_all_legal_moves(const Board& board) {
-    vector<Move> all_moves;
+bool update_uci_position(UciPosition& position, string_view position_command) {
+    string_view previous = position.command;
+    
+    // The new command extends the previous one if it starts with it and
+    // continues at a token boundary with further moves
+    bool extends = !previous.empty() &&
+                   position_command.size() >= previous.size() &&
+                   position_command.substr(0, previous.size()) == previous &&
+                   (position_command.size() == previous.size() || isspace(position_command[previous.size()]));
+    
+    Tokenizer tokens(extends ? position_command.substr(previous.size()) : position_command);
+    if (extends && previous.find(" moves") == string_view::npos) {
+        // Previous command had no move list: the extension must start one
+        string_view token = tokens.next();
+        extends = token.empty() || token == "moves";
+    }
+    
+    if (!extends) {
+        // Rebuild from the base position and apply every move
+        tokens = Tokenizer(position_command);
+        Board base;
+        if (!parse_uci_base(tokens, base)) return false;
+        position.board = base;
+        position.history.assign(1, position.board.hash);
+    }
     
+    apply_uci_moves(position.board, tokens, &position.history);
+    position.command.assign(position_command);
+    return true;
+}
+
+// Steps as file and rank deltas: the rook directions, then the bishop
+// directions
+static const int line_steps[8][2] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+static const int knight_steps[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+
+// The square df files and dr ranks away, or -1 off the board
+static int step_square(int square, int df, int dr) {
+    int file = square % 8 + df, rank = square / 8 + dr;
+    return file >= 0 && file < 8 && rank >= 0 && rank < 8 ? rank * 8 + file : -1;
+}
+
+// Index into line_steps of the direction from a to b; -1 if they share no
+// rank, file or diagonal
+static int line_direction(int a, int b) {
+    int df = b % 8 - a % 8, dr = b / 8 - a / 8;
+    if (a == b || (df != 0 && dr != 0 && abs(df) != abs(dr))) return -1;
+    df = (df > 0) - (df < 0);
+    dr = (dr > 0) - (dr < 0);
+    for (int i = 0; i < 8; i++) {
+        if (line_steps[i][0] == df && line_steps[i][1] == dr) return i;
+    }
+    return -1;
+}
+
+static uint64_t squares_between(int a, int b) {
+    uint64_t squares = 0;
+    int direction = line_direction(a, b);
+    if (direction < 0) return 0;
+    for (int s = step_square(a, line_steps[direction][0], line_steps[direction][1]); s != b;
+         s = step_square(s, line_steps[direction][0], line_steps[direction][1])) {
+        squares |= 1ULL << s;
+    }
+    return squares;
+}
+
+static int find_king(const Board& board, bool white) {
     for (int square = 0; square < 64; square++) {
-        int piece = get_piece(board, square);
-        if (piece == 0) continue; // Empty square
-        
-        bool is_white = piece > 0;
-        if (is_white != board.white_to_move) continue; // Wrong color
-        
-        vector<Move> piece_moves;
-        int piece_type = abs(piece);
+        if (board.squares[square] == (white ? 6 : -6)) return square;
+    }
+    return -1;
+}
+
+// Mask of the squares of by_white's pieces that attack square
+static uint64_t attackers_of(const Board& board, int square, bool by_white) {
+    uint64_t attackers = 0;
+    int sign = by_white ? 1 : -1;
+    for (int i = 0; i < 8; i++) {
+        int s = step_square(square, knight_steps[i][0], knight_steps[i][1]);
+        if (s >= 0 && board.squares[s] == 2 * sign) attackers |= 1ULL << s;
+        s = step_square(square, line_steps[i][0], line_steps[i][1]);
+        if (s >= 0 && board.squares[s] == 6 * sign) attackers |= 1ULL << s;
         
-        switch (piece_type) {
-            case 1: // Pawn
-                piece_moves = generate_pawn_moves(board, square);
-                break;
-            case 2: // Knight
-                piece_moves = generate_knight_moves(board, square);
-                break;
-            case 3: // Bishop
-                piece_moves = generate_bishop_moves(board, square);
-                break;
-            case 4: // Rook
-                piece_moves = generate_rook_moves(board, square);
-                break;
-            case 5: // Queen
-                piece_moves = generate_queen_moves(board, square);
-                break;
-            case 6: // King
-                piece_moves = generate_king_moves(board, square);
-                break;
+        // The nearest piece along the line, if it is a slider moving that way
+        int slider = i < 4 ? 4 : 3;
+        for (; s >= 0; s = step_square(s, line_steps[i][0], line_steps[i][1])) {
+            int piece = board.squares[s];
+            if (piece == 0) continue;
+            if (piece == slider * sign || piece == 5 * sign) attackers |= 1ULL << s;
+            break;
         }
-        
-        // Filter out illegal moves
-        for (const Move& move : piece_moves) {
-            if (is_legal_move(board, move)) {
-                all_moves.push_back(move);
+    }
+    // Pawns capture forwards, so attackers stand diagonally behind
+    for (int df = -1; df <= 1; df += 2) {
+        int s = step_square(square, df, -sign);
+        if (s >= 0 && board.squares[s] == sign) attackers |= 1ULL << s;
+    }
+    return attackers;
+}
+
+// Pieces of either colour that stand alone between square and a slider of
+// the given colour aiming at it. Around a king these are the pieces
+// pinned to it, or those whose moves can discover check on it.
+static uint64_t line_blockers(const Board& board, int square, bool slider_white) {
+    uint64_t blockers = 0;
+    int sign = slider_white ? 1 : -1;
+    for (int i = 0; i < 8; i++) {
+        int slider = i < 4 ? 4 : 3;
+        int blocker = -1;
+        for (int s = step_square(square, line_steps[i][0], line_steps[i][1]); s >= 0;
+             s = step_square(s, line_steps[i][0], line_steps[i][1])) {
+            int piece = board.squares[s];
+            if (piece == 0) continue;
+            if (blocker < 0) {
+                blocker = s;
+                continue;
             }
+            if (piece == slider * sign || piece == 5 * sign) blockers |= 1ULL << blocker;
+            break;
         }
     }
-    
-    return all_moves;
+    return blockers;
 }
 
-// Simple material evaluation - returns score in centipawns (positive = good for side to move)
-int evaluate_position(const Board& board) {
-    int score = 0;
+static vector<Move> generate_piece_moves(const Board& board, int square) {
+    switch (abs(get_piece(board, square))) {
+        case 1: return generate_pawn_moves(board, square);
+        case 2: return generate_knight_moves(board, square);
+        case 3: return generate_bishop_moves(board, square);
+        case 4: return generate_rook_moves(board, square);
+        case 5: return generate_queen_moves(board, square);
+        case 6: return generate_king_moves(board, square);
+    }
+    return vector<Move>();
+}
+
+
+// gives_check with the enemy king's square and the discovered-check
+// candidates, line_blockers around that king with the mover's sliders
+static bool checks_king(const Board& board, const Move& move, int king, uint64_t candidates) {
+    int piece = board.squares[move.from];
+    bool white = piece > 0;
+    
+    // Castling, en passant and promotions move or remove a second piece or
+    // change the first, so their checks are found by playing them
+    if (move.flag != 0) {
+        Board child = board;
+        make_move_simple(child, move);
+        return attackers_of(child, king, white) != 0;
+    }
     
-    // Piece values in centipawns
-    const int piece_values[] = {0, 100, 320, 330, 500, 900, 20000}; // empty, pawn, knight, bishop, rook, queen, king
+    // Direct check from the destination; the origin is empty by then
+    int piece_type = abs(piece);
+    int direction = line_direction(move.to, king);
+    bool direct = false;
+    if (piece_type == 1) {
+        direct = king == step_square(move.to, -1, white ? 1 : -1) || king == step_square(move.to, 1, white ? 1 : -1);
+    } else if (piece_type == 2) {
+        int df = abs(king % 8 - move.to % 8), dr = abs(king / 8 - move.to / 8);
+        direct = (df == 1 && dr == 2) || (df == 2 && dr == 1);
+    } else if (piece_type != 6 && direction >= 0 && (piece_type == 5 || (direction < 4) == (piece_type == 4))) {
+        direct = true;
+        for (uint64_t between = squares_between(move.to, king) & ~(1ULL << move.from); between; between &= between - 1) {
+            if (board.squares[__builtin_ctzll(between)] != 0) direct = false;
+        }
+    }
+    if (direct) return true;
+    
+    // Discovered check, unless the piece stays on the line it was blocking
+    return ((candidates >> move.from) & 1) && line_direction(king, move.to) != line_direction(king, move.from);
+}
+
+bool gives_check(const Board& board, const Move& move) {
+    bool white = board.squares[move.from] > 0;
+    int king = find_king(board, !white);
+    if (king < 0) return false;
+    return checks_king(board, move, king, line_blockers(board, king, white));
+}
+
+vector<Move> generate_evasions(const Board& board) {
+    vector<Move> moves;
+    bool white = board.white_to_move;
+    int king = find_king(board, white);
+    if (king < 0) return moves;
+    uint64_t checkers = attackers_of(board, king, !white);
+    
+    // King steps to squares that are safe once the king has left its own,
+    // which a slider checking along the line would otherwise shield
+    Board without_king = board;
+    without_king.squares[king] = 0;
+    for (const Move& move : generate_king_moves(board, king)) {
+        if (move.is_castling()) continue; // No castling out of check
+        if (attackers_of(without_king, move.to, !white) == 0) moves.push_back(move);
+    }
+    if (checkers == 0 || (checkers & (checkers - 1)) != 0) {
+        return moves; // Double check: only the king can move
+    }
     
-    // Count material
+    // Capture the checker or block its line. A pinned piece can do
+    // neither, since it cannot leave the line of its pin. En passant
+    // removes a second pawn from the board, so it is tested in full.
+    int checker = __builtin_ctzll(checkers);
+    uint64_t targets = (1ULL << checker) | squares_between(king, checker);
+    uint64_t pinned = line_blockers(board, king, !white);
     for (int square = 0; square < 64; square++) {
         int piece = board.squares[square];
-        if (piece != 0) {
-            int piece_type = abs(piece);
-            int piece_value = piece_values[piece_type];
-            score += (piece > 0) ? piece_value : -piece_value;
+        if (piece == 0 || (piece > 0) != white || abs(piece) == 6 || ((pinned >> square) & 1)) continue;
+        for (const Move& move : generate_piece_moves(board, square)) {
+            if (move.is_en_passant()) {
+                if (is_legal_move(board, move)) moves.push_back(move);
+            } else if ((targets >> move.to) & 1) {
+                moves.push_back(move);
+            }
         }
     }
-    
-    // Return from perspective of side to move
-    return board.white_to_move ? score : -score;
+    return moves;
 }
 
-// Negamax search (without alpha-beta for now)
-int negamax(const Board& board, int depth) {
-    if (depth == 0) {
-        return evaluate_position(board);
+vector<Move> generate_quiet_checks(const Board& board) {
+    vector<Move> moves;
+    bool white = board.white_to_move;
+    int king = find_king(board, !white), own_king = find_king(board, white);
+    if (king < 0 || own_king < 0) return moves;
+    uint64_t candidates = line_blockers(board, king, white);
+    auto is_quiet = [&board](const Move& move) {
+        return board.squares[move.to] == 0 && move.promotion() == 0 && !move.is_en_passant();
+    };
+    
+    if (attackers_of(board, own_king, !white) != 0) {
+        for (const Move& move : generate_evasions(board)) {
+            if (is_quiet(move) && checks_king(board, move, king, candidates)) moves.push_back(move);
+        }
+        return moves;
     }
     
-    vector<Move> moves = generate_all_legal_moves(board);
-    
-    // Check for checkmate/stalemate
-    if (moves.empty()) {
-        if (is_in_check(board, board.white_to_move)) {
-            return -20000; // Checkmate (bad for side to move)
-        } else {
-            return 0; // Stalemate
+    // Out of check only king moves and pinned pieces can be illegal; a
+    // pinned piece may still move along its pin
+    uint64_t pinned = line_blockers(board, own_king, !white);
+    for (int square = 0; square < 64; square++) {
+        int piece = board.squares[square];
+        if (piece == 0 || (piece > 0) != white) continue;
+        for (const Move& move : generate_piece_moves(board, square)) {
+            if (!is_quiet(move) || !checks_king(board, move, king, candidates)) continue;
+            if (abs(piece) == 6) {
+                if (!is_legal_move(board, move)) continue;
+            } else if ((pinned >> square) & 1) {
+                if (line_direction(own_king, move.to) != line_direction(own_king, square)) continue;
+            }
+            moves.push_back(move);
         }
     }
+    return moves;
+}
+
+vector<Move> generate_all_moves(const Board& board) {
+    vector<Move> all_moves;
     
-    int best_score = -30000; // Negative infinity
-    
-    for (const Move& move : moves) {
-        Board temp_board = board;
-        make_move_simple(temp_board, move);
+    for (int square = 0; square < 64; square++) {
+        int piece = get_piece(board, square);
+        if (piece == 0) continue; // Empty square
         
-        int score = -negamax(temp_board, depth - 1);
+        bool is_white = piece > 0;
+        if (is_white != board.white_to_move) continue; // Wrong color
         
-        if (score > best_score) {
-            best_score = score;
-        }
+        vector<Move> piece_moves = generate_piece_moves(board, square);
+        all_moves.insert(all_moves.end(), piece_moves.begin(), piece_moves.end());
     }
     
-    return best_score;
+    return all_moves;
 }
 
-// Find best move using negamax search
-Move search_best_move(const Board& board, int depth) {
-    vector<Move> moves = generate_all_legal_moves(board);
+vector<Move> generate_all_legal_moves(const Board& board) {
+    // In check only the evasions need considering
+    int king = find_king(board, board.white_to_move);
+    if (king >= 0 && attackers_of(board, king, !board.white_to_move) != 0) {
+        return generate_evasions(board);
+    }
     
-    if (moves.empty()) {
-        // No legal moves - return dummy move
-        return Move(0, 0);
+    vector<Move> all_moves;
+    
+    // Filter out illegal moves
+    for (const Move& move : generate_all_moves(board)) {
+        if (is_legal_move(board, move)) {
+            all_moves.push_back(move);
+        }
     }
     
-    Move best_move = moves[0];
-    int best_score = -30000;
+    return all_moves;
+}
+
+// Standard algebraic notation without the check suffix. legal_moves is the
+// position's legal move list, used to disambiguate.
+static string san_body(const Board& board, const Move& move, const vector<Move>& legal_moves) {
+    int piece = abs(board.squares[move.from]);
+    if (move.is_castling()) {
+        return move.to > move.from ? "O-O" : "O-O-O";
+    }
     
-    for (const Move& move : moves) {
-        Board temp_board = board;
-        make_move_simple(temp_board, move);
-        
-        int score = -negamax(temp_board, depth - 1);
+    bool capture = board.squares[move.to] != 0 || move.is_en_passant();
+    string san;
+    if (piece == 1) {
+        if (capture) san += char('a' + move.from % 8);
+    } else {
+        san += " PNBRQK"[piece];
         
-        if (score > best_score) {
-            best_score = score;
-            best_move = move;
+        // Other pieces of the same type that can reach the same square
+        bool ambiguous = false, same_file = false, same_rank = false;
+        for (const Move& other : legal_moves) {
+            if (other.to != move.to || other.from == move.from) continue;
+            if (abs(board.squares[other.from]) != piece) continue;
+            ambiguous = true;
+            if (other.from % 8 == move.from % 8) same_file = true;
+            if (other.from / 8 == move.from / 8) same_rank = true;
         }
+        if (ambiguous && (!same_file || same_rank)) san += char('a' + move.from % 8);
+        if (ambiguous && same_file) san += char('1' + move.from / 8);
     }
-    
-    return best_move;
-}
\ No newline at end of file
+    if (capture) san += 'x';
+    san += square_to_string(move.to);
+    if (move.promotion() != 0) {
+        san += '=';
+        san += " PNBRQK"[move.promotion()];
+    }
+    return san;
+}
+
+string move_to_san(const Board& board, const Move& move) {
+    vector<Move> legal_moves = generate_all_legal_moves(board);
+    string san = san_body(board, move, legal_moves);
+    
+    Board child = board;
+    make_move_simple(child, move);
+    if (is_in_check(child, child.white_to_move)) {
+        san += generate_all_legal_moves(child).empty() ? '#' : '+';
+    }
+    return san;
+}
+
+Move san_to_move(const Board& board, string_view san) {
+    while (!san.empty() && strchr("+#!?", san.back())) san.remove_suffix(1);
+    string wanted(san);
+    if (wanted == "0-0") wanted = "O-O";
+    if (wanted == "0-0-0") wanted = "O-O-O";
+    
+    vector<Move> legal_moves = generate_all_legal_moves(board);
+    for (const Move& move : legal_moves) {
+        if (san_body(board, move, legal_moves) == wanted) return move;
+    }
+    return Move();
+}
+
+const uint64_t file_a_mask = 0x0101010101010101ULL;
+const uint64_t file_h_mask = file_a_mask << 7;
+
+// Pawn and king bitboards, the only pieces the pawn and shield terms look at
+struct EvalBitboards {
+    uint64_t pawns[2]; // White, black
+    uint64_t kings[2];
+};
+
+static EvalBitboards eval_bitboards(const Board& board) {
+    EvalBitboards bitboards = {{0, 0}, {0, 0}};
+    for (int square = 0; square < 64; square++) {
+        switch (board.squares[square]) {
+            case 1: bitboards.pawns[0] |= 1ULL << square; break;
+            case -1: bitboards.pawns[1] |= 1ULL << square; break;
+            case 6: bitboards.kings[0] |= 1ULL << square; break;
+            case -6: bitboards.kings[1] |= 1ULL << square; break;
+        }
+    }
+    return bitboards;
+}
+
+static uint64_t north_fill(uint64_t b) {
+    b |= b << 8;
+    b |= b << 16;
+    return b | (b << 32);
+}
+
+static uint64_t south_fill(uint64_t b) {
+    b |= b >> 8;
+    b |= b >> 16;
+    return b | (b >> 32);
+}
+
+static uint64_t east_one(uint64_t b) {
+    return (b << 1) & ~file_a_mask;
+}
+
+static uint64_t west_one(uint64_t b) {
+    return (b >> 1) & ~file_h_mask;
+}
+
+// Pawn terms of one side, on bitboards oriented so that side moves north.
+// Black's terms are computed on byte-swapped (vertically mirrored) boards.
+struct PawnSideMasks {
+    uint64_t doubled;
+    uint64_t isolated;
+    uint64_t backward;
+    uint64_t passed;
+};
+
+static PawnSideMasks pawn_side_masks(uint64_t own, uint64_t enemy) {
+    PawnSideMasks masks;
+    
+    // Rear pawns of a file: another own pawn is ahead of them
+    masks.doubled = own & south_fill(own >> 8);
+    
+    uint64_t files = north_fill(south_fill(own));
+    masks.isolated = own & ~(east_one(files) | west_one(files));
+    
+    // Passed: no enemy pawn ahead on the same or an adjacent file
+    uint64_t enemy_files = enemy | east_one(enemy) | west_one(enemy);
+    masks.passed = own & ~south_fill(enemy_files >> 8);
+    
+    // Backward: every own pawn on the adjacent files is ahead of it, and an
+    // enemy pawn guards its stop square
+    uint64_t supportable = north_fill(east_one(own) | west_one(own));
+    uint64_t enemy_attacks = ((enemy >> 7) & ~file_a_mask) | ((enemy >> 9) & ~file_h_mask);
+    masks.backward = own & ~supportable & ~masks.isolated & ~masks.passed & (enemy_attacks >> 8);
+    
+    masks.passed &= ~masks.doubled; // Only the front pawn of a file counts as passed
+    return masks;
+}
+
+struct PawnSideTerms {
+    int mg_score;
+    int eg_score;
+    uint64_t passed;
+};
+
+static PawnSideTerms pawn_side_terms(uint64_t own, uint64_t enemy) {
+    PawnSideMasks masks = pawn_side_masks(own, enemy);
+    int doubled_count = __builtin_popcountll(masks.doubled);
+    int isolated_count = __builtin_popcountll(masks.isolated);
+    int backward_count = __builtin_popcountll(masks.backward);
+    
+    PawnSideTerms terms;
+    terms.mg_score = -doubled_count * doubled_pawn_penalty[0] - isolated_count * isolated_pawn_penalty[0] -
+                     backward_count * backward_pawn_penalty[0];
+    terms.eg_score = -doubled_count * doubled_pawn_penalty[1] - isolated_count * isolated_pawn_penalty[1] -
+                     backward_count * backward_pawn_penalty[1];
+    for (uint64_t remaining = masks.passed; remaining; remaining &= remaining - 1) {
+        int rank = __builtin_ctzll(remaining) / 8;
+        terms.mg_score += passed_pawn_bonus[0][rank];
+        terms.eg_score += passed_pawn_bonus[1][rank];
+    }
+    terms.passed = masks.passed;
+    return terms;
+}
+
+static PawnEntry pawn_structure_entry(const Board& board, const EvalBitboards& bitboards) {
+    uint64_t white = bitboards.pawns[0];
+    uint64_t black = bitboards.pawns[1];
+    PawnSideTerms white_terms = pawn_side_terms(white, black);
+    PawnSideTerms black_terms = pawn_side_terms(__builtin_bswap64(black), __builtin_bswap64(white));
+    
+    PawnEntry entry;
+    entry.key = board.pawn_hash;
+    entry.mg_score = white_terms.mg_score - black_terms.mg_score;
+    entry.eg_score = white_terms.eg_score - black_terms.eg_score;
+    entry.passed[0] = white_terms.passed;
+    entry.passed[1] = __builtin_bswap64(black_terms.passed);
+    return entry;
+}
+
+PawnEntry evaluate_pawn_structure(const Board& board) {
+    return pawn_structure_entry(board, eval_bitboards(board));
+}
+
+PawnHashTable::PawnHashTable(size_t size) : hits(0), probes(0) {
+    size_t count = 1;
+    while (count * 2 <= size) count *= 2;
+    entries.assign(count, PawnEntry{0, 0, 0, {0, 0}});
+    mask = count - 1;
+}
+
+const PawnEntry& PawnHashTable::probe(const Board& board) {
+    PawnEntry& entry = entries[board.pawn_hash & mask];
+    probes++;
+    // A pawnless board has key 0, which also matches the zeroed entries
+    if (entry.key == board.pawn_hash) {
+        hits++;
+    } else {
+        entry = evaluate_pawn_structure(board);
+    }
+    return entry;
+}
+
+void PawnHashTable::clear() {
+    fill(entries.begin(), entries.end(), PawnEntry{0, 0, 0, {0, 0}});
+    hits = 0;
+    probes = 0;
+}
+
+double PawnHashTable::hit_rate() const {
+    return probes ? double(hits) / probes : 0.0;
+}
+
+// Own pawns on the three files around the king, one or two ranks ahead
+// (oriented so the side moves north); only the nearer pawn of a file counts
+static void pawn_shield_masks(uint64_t own_pawns, uint64_t king, uint64_t& near_pawns, uint64_t& far_pawns) {
+    uint64_t front = king << 8;
+    uint64_t near_squares = front | east_one(front) | west_one(front);
+    near_pawns = own_pawns & near_squares;
+    far_pawns = own_pawns & (near_squares << 8) & ~(near_pawns << 8);
+}
+
+static int pawn_shield_side(uint64_t own_pawns, uint64_t king) {
+    uint64_t near_pawns, far_pawns;
+    pawn_shield_masks(own_pawns, king, near_pawns, far_pawns);
+    return __builtin_popcountll(near_pawns) * pawn_shield_bonus[0] +
+           __builtin_popcountll(far_pawns) * pawn_shield_bonus[1];
+}
+
+// Pawn shield of each king, in the middlegame, from white's point of view
+static int pawn_shield_score(const EvalBitboards& bitboards) {
+    return pawn_shield_side(bitboards.pawns[0], bitboards.kings[0]) -
+           pawn_shield_side(__builtin_bswap64(bitboards.pawns[1]), __builtin_bswap64(bitboards.kings[1]));
+}
+
+// King and pawn against king, solved by retrograde analysis when the
+// program starts. Positions are normalised so the pawn is white and on
+// files a-d, and one bit per position says whether white wins: 24 KB.
+class KpkBitbase {
+public:
+    KpkBitbase();
+    bool wins(bool white_to_move, int white_king, int black_king, int pawn) const;
+    
+private:
+    static const int positions = 2 * 24 * 64 * 64;
+    static int index(bool white_to_move, int white_king, int black_king, int pawn);
+    
+    uint32_t bits[positions / 32];
+};
+
+const uint8_t kpk_invalid = 0;
+const uint8_t kpk_unknown = 1;
+const uint8_t kpk_draw = 2;
+const uint8_t kpk_win = 4;
+
+static int square_distance(int a, int b) {
+    return max(abs(a % 8 - b % 8), abs(a / 8 - b / 8));
+}
+
+static bool white_pawn_attacks(int pawn, int square) {
+    return (pawn % 8 > 0 && pawn + 7 == square) || (pawn % 8 < 7 && pawn + 9 == square);
+}
+
+// The squares a king on square can step to
+static int king_steps(int square, int steps[8]) {
+    int count = 0;
+    for (int dr = -1; dr <= 1; dr++) {
+        for (int df = -1; df <= 1; df++) {
+            int rank = square / 8 + dr, file = square % 8 + df;
+            if ((dr || df) && rank >= 0 && rank < 8 && file >= 0 && file < 8) steps[count++] = rank * 8 + file;
+        }
+    }
+    return count;
+}
+
+int KpkBitbase::index(bool white_to_move, int white_king, int black_king, int pawn) {
+    return white_king | black_king << 6 | (white_to_move ? 0 : 1) << 12 | (pawn % 8) << 13 | (6 - pawn / 8) << 15;
+}
+
+// Results decided by the position alone: illegal placements, pawns that
+// promote safely, stalemates and pawns the black king takes
+static uint8_t kpk_initial_result(bool white_to_move, int white_king, int black_king, int pawn) {
+    if (square_distance(white_king, black_king) <= 1 || white_king == pawn || black_king == pawn ||
+        (white_to_move && white_pawn_attacks(pawn, black_king))) {
+        return kpk_invalid;
+    }
+    int queening = pawn + 8;
+    if (white_to_move && pawn / 8 == 6 && white_king != queening &&
+        (square_distance(black_king, queening) > 1 || square_distance(white_king, queening) == 1)) {
+        return kpk_win;
+    }
+    if (!white_to_move) {
+        int steps[8];
+        int count = king_steps(black_king, steps);
+        bool can_move = false;
+        for (int i = 0; i < count; i++) {
+            bool guarded = square_distance(steps[i], white_king) <= 1 || white_pawn_attacks(pawn, steps[i]);
+            if (guarded) continue;
+            if (steps[i] == pawn) return kpk_draw;
+            can_move = true;
+        }
+        if (!can_move) return kpk_draw;
+    }
+    return kpk_unknown;
+}
+
+KpkBitbase::KpkBitbase() : bits() {
+    vector<uint8_t> results(positions);
+    for (int i = 0; i < positions; i++) {
+        int pawn = (6 - (i >> 15)) * 8 + ((i >> 13) & 3);
+        results[i] = kpk_initial_result(!((i >> 12) & 1), i & 63, (i >> 6) & 63, pawn);
+    }
+    
+    // A position is won for white if some white move or every black move
+    // reaches a won position; repeat until nothing changes, and what is
+    // still unknown is drawn
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < positions; i++) {
+            if (results[i] != kpk_unknown) continue;
+            bool white_to_move = !((i >> 12) & 1);
+            int white_king = i & 63, black_king = (i >> 6) & 63;
+            int pawn = (6 - (i >> 15)) * 8 + ((i >> 13) & 3);
+            
+            uint8_t reached = kpk_invalid;
+            int steps[8];
+            int count = king_steps(white_to_move ? white_king : black_king, steps);
+            for (int j = 0; j < count; j++) {
+                reached |= white_to_move ? results[index(false, steps[j], black_king, pawn)]
+                                         : results[index(true, white_king, steps[j], pawn)];
+            }
+            if (white_to_move && pawn / 8 < 6) {
+                reached |= results[index(false, white_king, black_king, pawn + 8)];
+            }
+            if (white_to_move && pawn / 8 == 1 && pawn + 8 != white_king && pawn + 8 != black_king) {
+                reached |= results[index(false, white_king, black_king, pawn + 16)];
+            }
+            
+            uint8_t good = white_to_move ? kpk_win : kpk_draw;
+            uint8_t bad = white_to_move ? kpk_draw : kpk_win;
+            uint8_t result = (reached & good) ? good : (reached & kpk_unknown) ? kpk_unknown : bad;
+            if (result != kpk_unknown) {
+                results[i] = result;
+                changed = true;
+            }
+        }
+    }
+    
+    for (int i = 0; i < positions; i++) {
+        if (results[i] == kpk_win) bits[i / 32] |= 1u << (i % 32);
+    }
+}
+
+bool KpkBitbase::wins(bool white_to_move, int white_king, int black_king, int pawn) const {
+    int i = index(white_to_move, white_king, black_king, pawn);
+    return (bits[i / 32] >> (i % 32)) & 1;
+}
+
+static const KpkBitbase kpk_bitbase;
+
+bool probe_kpk(const Board& board, bool& win) {
+    int kings[2] = {-1, -1}, pawn = -1;
+    for (int square = 0; square < 64; square++) {
+        int piece = board.squares[square];
+        if (piece == 6 || piece == -6) {
+            kings[piece < 0] = square;
+        } else if ((piece == 1 || piece == -1) && pawn < 0) {
+            pawn = square;
+        } else if (piece != 0) {
+            return false;
+        }
+    }
+    if (pawn < 0 || kings[0] < 0 || kings[1] < 0 || pawn / 8 == 0 || pawn / 8 == 7) return false;
+    
+    // Make the side with the pawn white, then put the pawn on files a-d
+    bool white_pawn = board.squares[pawn] > 0;
+    int strong_king = white_pawn ? kings[0] : kings[1];
+    int weak_king = white_pawn ? kings[1] : kings[0];
+    if (!white_pawn) {
+        strong_king ^= 56;
+        weak_king ^= 56;
+        pawn ^= 56;
+    }
+    if (pawn % 8 > 3) {
+        strong_king ^= 7;
+        weak_king ^= 7;
+        pawn ^= 7;
+    }
+    win = kpk_bitbase.wins(board.white_to_move == white_pawn, strong_king, weak_king, pawn);
+    return true;
+}
+
+// Known results of king and pawn against king replace the evaluation: 0
+// for a draw, and for a win a score that grows as the pawn advances but
+// stays below a new queen's, so promoting still looks best
+static bool kpk_score(const Board& board, int& score) {
+    const int kpk_win_score = 500;
+    bool win;
+    if (board.phase != 0 || !probe_kpk(board, win)) return false;
+    
+    score = 0;
+    if (win) {
+        int pawn = int(find_if(board.squares, board.squares + 64, [](int piece) { return abs(piece) == 1; }) -
+                       board.squares);
+        bool white_pawn = board.squares[pawn] > 0;
+        int rank = white_pawn ? pawn / 8 : 7 - pawn / 8;
+        score = kpk_win_score + 20 * rank;
+        if (board.white_to_move != white_pawn) score = -score;
+    }
+    return true;
+}
+
+// Interpolate white-relative middlegame and endgame scores by game phase
+static int tapered_score(const Board& board, int mg, int eg) {
+    int phase = min(board.phase, max_phase); // Early promotions can exceed the maximum
+    int score = (mg * phase + eg * (max_phase - phase)) / max_phase;
+    
+    // Return from perspective of side to move
+    return board.white_to_move ? score : -score;
+}
+
+// Tapered evaluation - returns score in centipawns (positive = good for side to move).
+// The material and piece-square sums are maintained incrementally by
+// set_piece; pawn structure is computed here from scratch.
+int evaluate_position(const Board& board) {
+    int known;
+    if (kpk_score(board, known)) return known;
+    
+    EvalBitboards bitboards = eval_bitboards(board);
+    PawnEntry pawns = pawn_structure_entry(board, bitboards);
+    int mg = board.mg_score + pawns.mg_score + pawn_shield_score(bitboards);
+    int eg = board.eg_score + pawns.eg_score;
+    return tapered_score(board, mg, eg);
+}
+
+// Count every term evaluate_position scores. Black's pawn terms are counted
+// on mirrored boards, as in pawn_structure_entry and pawn_shield_score.
+void trace_evaluation(const Board& board, EvalTrace& trace) {
+    memset(&trace, 0, sizeof(trace));
+    trace.phase = min(board.phase, max_phase);
+    for (int square = 0; square < 64; square++) {
+        int piece = board.squares[square];
+        if (piece > 0) {
+            trace.pieces[piece]++;
+            trace.pst[piece][square ^ 56]++;
+        } else if (piece < 0) {
+            trace.pieces[-piece]--;
+            trace.pst[-piece][square]--;
+        }
+    }
+    
+    EvalBitboards bitboards = eval_bitboards(board);
+    for (int side = 0; side < 2; side++) {
+        uint64_t own = bitboards.pawns[side];
+        uint64_t enemy = bitboards.pawns[1 - side];
+        uint64_t king = bitboards.kings[side];
+        if (side == 1) {
+            own = __builtin_bswap64(own);
+            enemy = __builtin_bswap64(enemy);
+            king = __builtin_bswap64(king);
+        }
+        int sign = side == 0 ? 1 : -1;
+        
+        PawnSideMasks masks = pawn_side_masks(own, enemy);
+        trace.doubled_pawns += sign * __builtin_popcountll(masks.doubled);
+        trace.isolated_pawns += sign * __builtin_popcountll(masks.isolated);
+        trace.backward_pawns += sign * __builtin_popcountll(masks.backward);
+        for (uint64_t remaining = masks.passed; remaining; remaining &= remaining - 1) {
+            trace.passed_pawns[__builtin_ctzll(remaining) / 8] += sign;
+        }
+        
+        uint64_t near_pawns, far_pawns;
+        pawn_shield_masks(own, king, near_pawns, far_pawns);
+        trace.shield_pawns[0] += sign * __builtin_popcountll(near_pawns);
+        trace.shield_pawns[1] += sign * __builtin_popcountll(far_pawns);
+    }
+}
+
+const size_t huge_page_size = 2 * 1024 * 1024;
+
+const char* page_kind_name(int pages) {
+    switch (pages) {
+        case pages_transparent: return "transparent huge pages";
+        case pages_explicit: return "huge pages";
+    }
+    return "normal pages";
+}
+
+// Transparent huge pages are off unless the kernel's mode is "always" or
+// "madvise"
+static bool transparent_huge_pages_enabled() {
+    int fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY);
+    if (fd < 0) return false;
+    char mode[128] = {};
+    ssize_t length = read(fd, mode, sizeof(mode) - 1);
+    close(fd);
+    return length > 0 && strstr(mode, "[never]") == nullptr;
+}
+
+LargeBuffer::LargeBuffer() : mapping(nullptr), mapping_size(0), bytes(0), page_kind(pages_normal) {}
+
+LargeBuffer::~LargeBuffer() {
+    release();
+}
+
+bool LargeBuffer::allocate(size_t size, bool huge_pages) {
+    release();
+    if (size == 0) return true;
+    
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    size_t rounded = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+    if (huge_pages && size >= huge_page_size) {
+        void* mapped = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (mapped != MAP_FAILED) {
+            mapping = mapped;
+            mapping_size = rounded;
+            bytes = size;
+            page_kind = pages_explicit;
+            return true;
+        }
+        
+        // Transparent huge pages need 2 MB alignment: over-allocate and trim
+        mapped = mmap(nullptr, rounded + huge_page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (mapped == MAP_FAILED) return false;
+        uintptr_t start = uintptr_t(mapped);
+        uintptr_t aligned = (start + huge_page_size - 1) / huge_page_size * huge_page_size;
+        if (aligned > start) munmap(mapped, aligned - start);
+        size_t tail = start + rounded + huge_page_size - (aligned + rounded);
+        if (tail > 0) munmap(reinterpret_cast<void*>(aligned + rounded), tail);
+        mapping = reinterpret_cast<void*>(aligned);
+        mapping_size = rounded;
+        bytes = size;
+        bool advised = madvise(mapping, mapping_size, MADV_HUGEPAGE) == 0;
+        page_kind = advised && transparent_huge_pages_enabled() ? pages_transparent : pages_normal;
+        return true;
+    }
+    
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (mapped == MAP_FAILED) return false;
+    madvise(mapped, size, MADV_NOHUGEPAGE);
+    mapping = mapped;
+    mapping_size = size;
+    bytes = size;
+    page_kind = pages_normal;
+    return true;
+}
+
+void LargeBuffer::release() {
+    if (mapping) munmap(mapping, mapping_size);
+    mapping = nullptr;
+    mapping_size = 0;
+    bytes = 0;
+    page_kind = pages_normal;
+}
+
+// Written rather than dropped with MADV_DONTNEED, so the table keeps its
+// committed (and huge) pages
+void LargeBuffer::zero() {
+    if (mapping) memset(mapping, 0, bytes);
+}
+
+void* LargeBuffer::data() const {
+    return mapping;
+}
+
+size_t LargeBuffer::size() const {
+    return bytes;
+}
+
+int LargeBuffer::pages() const {
+    return page_kind;
+}
+
+EvalCache::EvalCache(size_t megabytes) : hits(0), evaluations(0), entries(nullptr), count(0) {
+    resize(megabytes);
+}
+
+void EvalCache::resize(size_t megabytes, bool huge_pages) {
+    count = 0;
+    if (megabytes > 0) {
+        count = 1;
+        while (count * 2 * sizeof(uint64_t) <= megabytes * 1024 * 1024) count *= 2;
+    }
+    if (!memory.allocate(count * sizeof(uint64_t), huge_pages)) count = 0;
+    entries = static_cast<uint64_t*>(memory.data());
+    hits = 0;
+    evaluations = 0;
+}
+
+const uint64_t eval_cache_key_mask = ~0xffffULL;
+
+bool EvalCache::probe(uint64_t key, int& score) {
+    if (count == 0) return false;
+    uint64_t entry = entries[key & (count - 1)];
+    if (entry != 0 && (entry & eval_cache_key_mask) == (key & eval_cache_key_mask)) {
+        score = int16_t(entry & 0xffff);
+        hits++;
+        return true;
+    }
+    return false;
+}
+
+void EvalCache::store(uint64_t key, int score) {
+    evaluations++;
+    if (count == 0) return;
+    entries[key & (count - 1)] = (key & eval_cache_key_mask) | uint16_t(int16_t(score));
+}
+
+void EvalCache::clear() {
+    memory.zero();
+    hits = 0;
+    evaluations = 0;
+}
+
+// Transposition table data word: move in bits 0-15 (Move::bits, 0 for
+// none), score in bits 16-31, depth in bits 32-39, bound in bits 40-41 and
+// generation in bits 42-47
+static uint64_t tt_pack(const Move& move, int score, int depth, int bound, uint8_t generation) {
+    uint64_t packed_move = move.from == move.to ? 0 : move.bits();
+    return packed_move | uint64_t(uint16_t(int16_t(score))) << 16 | uint64_t(uint8_t(depth)) << 32 |
+           uint64_t(bound) << 40 | uint64_t(generation & 63) << 42;
+}
+
+static Move tt_move(uint64_t data) {
+    return Move::from_bits(data & 0xffff);
+}
+
+TTHit::TTHit() : move(), score(0), depth(0), bound(0) {}
+
+TranspositionTable::TranspositionTable(size_t megabytes)
+    : buckets(nullptr), count(0), huge_pages(true), mapping(nullptr), mapping_size(0), shared(false),
+      generation(0) {
+    resize(megabytes);
+}
+
+TranspositionTable::~TranspositionTable() {
+    release();
+}
+
+void TranspositionTable::release() {
+    if (mapping) munmap(mapping, mapping_size);
+    mapping = nullptr;
+    mapping_size = 0;
+    shared = false;
+    owned.release();
+    buckets = nullptr;
+    count = 0;
+}
+
+// Largest power of two number of buckets that fits in the size
+static size_t tt_bucket_count(size_t megabytes, size_t bucket_size) {
+    if (megabytes == 0) return 0;
+    size_t count = 1;
+    while (count * 2 * bucket_size <= megabytes * 1024 * 1024) count *= 2;
+    return count;
+}
+
+void TranspositionTable::resize(size_t megabytes, bool huge) {
+    release();
+    huge_pages = huge;
+    count = tt_bucket_count(megabytes, sizeof(Bucket));
+    if (!owned.allocate(count * sizeof(Bucket), huge_pages)) count = 0;
+    buckets = static_cast<Bucket*>(owned.data());
+    generation = 0;
+}
+
+int TranspositionTable::pages() const {
+    return owned.pages();
+}
+
+size_t TranspositionTable::megabytes() const {
+    return count * sizeof(Bucket) / (1024 * 1024);
+}
+
+// Shared segment layout: a 64-byte header holding the magic and the bucket
+// count, then the buckets. The creator writes the magic last, so a process
+// attaching at the same time waits until the segment is ready.
+const char tt_shared_magic[8] = {'A', '4', 'K', 'T', 'T', 'S', 'H', '1'};
+const size_t tt_shared_header_size = 64;
+
+bool TranspositionTable::attach_shared(const string& name, size_t megabytes) {
+    release();
+    generation = 0;
+    string path = name.empty() || name[0] == '/' ? name : "/" + name;
+    size_t wanted = tt_bucket_count(max<size_t>(megabytes, 1), sizeof(Bucket));
+    
+    bool created = true;
+    int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(path.c_str(), O_RDWR, 0600);
+    }
+    if (fd < 0) return false;
+    
+    size_t size = tt_shared_header_size + wanted * sizeof(Bucket);
+    if (created && ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(path.c_str());
+        return false;
+    }
+    if (!created) {
+        // The creator may still be sizing the segment
+        struct stat st;
+        for (int attempt = 0; attempt < 1000; attempt++) {
+            if (fstat(fd, &st) == 0 && size_t(st.st_size) > tt_shared_header_size) break;
+            usleep(1000);
+        }
+        size = fstat(fd, &st) == 0 ? size_t(st.st_size) : 0;
+    }
+    void* mapped = size > tt_shared_header_size ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                                : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+    mapping = mapped;
+    mapping_size = size;
+    shared = true;
+    
+    char* header = static_cast<char*>(mapped);
+    uint64_t* header_count = reinterpret_cast<uint64_t*>(header + sizeof(tt_shared_magic));
+    if (created) {
+        *header_count = wanted;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(header, tt_shared_magic, sizeof(tt_shared_magic));
+    } else {
+        for (int attempt = 0; attempt < 1000; attempt++) {
+            if (memcmp(header, tt_shared_magic, sizeof(tt_shared_magic)) == 0) break;
+            usleep(1000);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t existing = *header_count;
+        // By division: a corrupt count can overflow the product
+        bool valid = memcmp(header, tt_shared_magic, sizeof(tt_shared_magic)) == 0 && existing > 0 &&
+                     (existing & (existing - 1)) == 0 &&
+                     existing <= (size - tt_shared_header_size) / sizeof(Bucket);
+        if (!valid) {
+            release();
+            return false;
+        }
+        wanted = existing;
+    }
+    
+    buckets = reinterpret_cast<Bucket*>(header + tt_shared_header_size);
+    count = wanted;
+    return true;
+}
+
+bool TranspositionTable::is_shared() const {
+    return shared;
+}
+
+// Table file layout: a 64-byte header holding the magic, the bucket count
+// and the generation, then the buckets as they are in memory
+const char tt_file_magic[8] = {'A', '4', 'K', 'T', 'T', 'F', 'L', '1'};
+const size_t tt_file_header_size = 64;
+
+// Written to a temporary file renamed over the path: truncating the file in
+// place would pull the pages from under any table that has it loaded,
+// including this one
+bool TranspositionTable::save(const string& path) const {
+    string temporary = path + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    
+    char header[tt_file_header_size] = {};
+    uint64_t header_count = count, header_generation = generation;
+    memcpy(header, tt_file_magic, sizeof(tt_file_magic));
+    memcpy(header + 8, &header_count, sizeof(header_count));
+    memcpy(header + 16, &header_generation, sizeof(header_generation));
+    
+    bool ok = write(fd, header, sizeof(header)) == ssize_t(sizeof(header));
+    const char* bytes = reinterpret_cast<const char*>(buckets);
+    size_t remaining = count * sizeof(Bucket);
+    while (ok && remaining > 0) {
+        ssize_t written = write(fd, bytes, remaining);
+        ok = written > 0;
+        bytes += max<ssize_t>(written, 0);
+        remaining -= max<ssize_t>(written, 0);
+    }
+    ok = close(fd) == 0 && ok && rename(temporary.c_str(), path.c_str()) == 0;
+    if (!ok) unlink(temporary.c_str());
+    return ok;
+}
+
+bool TranspositionTable::load(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    
+    struct stat st;
+    char header[tt_file_header_size];
+    uint64_t file_count = 0, file_generation = 0;
+    bool valid = fstat(fd, &st) == 0 && pread(fd, header, sizeof(header), 0) == ssize_t(sizeof(header)) &&
+                 memcmp(header, tt_file_magic, sizeof(tt_file_magic)) == 0;
+    if (valid) {
+        memcpy(&file_count, header + 8, sizeof(file_count));
+        memcpy(&file_generation, header + 16, sizeof(file_generation));
+        // By division: a forged count can overflow the product
+        size_t body = size_t(st.st_size) > tt_file_header_size ? size_t(st.st_size) - tt_file_header_size : 0;
+        valid = file_count > 0 && (file_count & (file_count - 1)) == 0 && body % sizeof(Bucket) == 0 &&
+                body / sizeof(Bucket) == file_count;
+    }
+    void* mapped = valid ? mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+    
+    release();
+    mapping = mapped;
+    mapping_size = st.st_size;
+    buckets = reinterpret_cast<Bucket*>(static_cast<char*>(mapped) + tt_file_header_size);
+    count = file_count;
+    generation = uint8_t(file_generation & 63);
+    return true;
+}
+
+void TranspositionTable::clear() {
+    if (shared) return;
+    if (mapping) {
+        // Drop the loaded file for zeroed memory of the same size
+        size_t buckets_count = count;
+        release();
+        count = owned.allocate(buckets_count * sizeof(Bucket), huge_pages) ? buckets_count : 0;
+        buckets = static_cast<Bucket*>(owned.data());
+    } else {
+        owned.zero();
+    }
+    generation = 0;
+}
+
+void TranspositionTable::new_search() {
+    generation = (generation + 1) & 63;
+}
+
+void TranspositionTable::prefetch(uint64_t key) const {
+    if (count > 0) __builtin_prefetch(&buckets[key & (count - 1)]);
+}
+
+bool TranspositionTable::probe(uint64_t key, TTHit& hit) const {
+    if (count == 0) return false;
+    const Bucket& bucket = buckets[key & (count - 1)];
+    for (const TTEntry& entry : bucket.entries) {
+        uint64_t data = entry.data;
+        if ((entry.key ^ data) != key || data == 0) continue;
+        
+        hit.move = tt_move(data);
+        hit.score = int16_t(data >> 16);
+        hit.depth = uint8_t(data >> 32);
+        hit.bound = (data >> 40) & 3;
+        return true;
+    }
+    return false;
+}
+
+// Replaces the entry of the same position, else the empty or shallowest
+// one, counting entries from earlier searches as shallower
+void TranspositionTable::store(uint64_t key, const Move& move, int score, int depth, int bound) {
+    if (count == 0) return;
+    Bucket& bucket = buckets[key & (count - 1)];
+    TTEntry* replace = &bucket.entries[0];
+    int replace_worth = 1 << 30;
+    for (TTEntry& entry : bucket.entries) {
+        uint64_t data = entry.data;
+        if (data != 0 && (entry.key ^ data) == key) {
+            replace = &entry;
+            break;
+        }
+        int age = (generation - int((data >> 42) & 63)) & 63;
+        int worth = data == 0 ? -1000 : int(uint8_t(data >> 32)) - 8 * age;
+        if (worth < replace_worth) {
+            replace_worth = worth;
+            replace = &entry;
+        }
+    }
+    
+    uint64_t data = tt_pack(move, score, depth, bound, generation);
+    uint64_t old = replace->data;
+    if (move.from == move.to && old != 0 && (replace->key ^ old) == key) {
+        data |= old & 0xffff; // Keep the old move when the new result has none
+    }
+    replace->data = data;
+    replace->key = key ^ data;
+}
+
+int TranspositionTable::hashfull() const {
+    size_t sample = min<size_t>(count, 250);
+    int used = 0;
+    for (size_t i = 0; i < sample; i++) {
+        for (const TTEntry& entry : buckets[i].entries) {
+            if (entry.data != 0 && ((entry.data >> 42) & 63) == generation) used++;
+        }
+    }
+    return sample ? used * 1000 / int(sample * 4) : 0;
+}
+
+// Batched evaluation. Boards are processed four at a time: their pawn and
+// king bitboards are transposed into the four 64-bit lanes of AVX2
+// registers, and the same bitboard terms as pawn_side_terms and
+// pawn_shield_side are computed for all four at once.
+
+__attribute__((target("avx2")))
+static inline __m256i popcount_lanes(__m256i v) {
+    // Nibble lookup, then sum the bytes of each 64-bit lane
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_and_si256(v, low_mask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline __m256i bswap_lanes(__m256i v) {
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    return _mm256_shuffle_epi8(v, reverse);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i north_fill_lanes(__m256i b) {
+    b = _mm256_or_si256(b, _mm256_slli_epi64(b, 8));
+    b = _mm256_or_si256(b, _mm256_slli_epi64(b, 16));
+    return _mm256_or_si256(b, _mm256_slli_epi64(b, 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i south_fill_lanes(__m256i b) {
+    b = _mm256_or_si256(b, _mm256_srli_epi64(b, 8));
+    b = _mm256_or_si256(b, _mm256_srli_epi64(b, 16));
+    return _mm256_or_si256(b, _mm256_srli_epi64(b, 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i east_one_lanes(__m256i b) {
+    return _mm256_andnot_si256(_mm256_set1_epi64x(file_a_mask), _mm256_slli_epi64(b, 1));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i west_one_lanes(__m256i b) {
+    return _mm256_andnot_si256(_mm256_set1_epi64x(file_h_mask), _mm256_srli_epi64(b, 1));
+}
+
+// Add count * weight to the middlegame and endgame lanes. Counts sit in the
+// low 16 bits of each lane, so one multiply-add per 32-bit half suffices.
+__attribute__((target("avx2")))
+static inline void add_weighted(__m256i& mg, __m256i& eg, __m256i count, int mg_weight, int eg_weight) {
+    mg = _mm256_add_epi32(mg, _mm256_madd_epi16(count, _mm256_set1_epi32(mg_weight & 0xffff)));
+    eg = _mm256_add_epi32(eg, _mm256_madd_epi16(count, _mm256_set1_epi32(eg_weight & 0xffff)));
+}
+
+// Every other rank's weight as 16-bit values, starting at the given rank,
+// repeated in each 64-bit lane
+__attribute__((target("avx2")))
+static inline __m256i rank_weights(const int* weights, int first) {
+    uint64_t packed = 0;
+    for (int i = 0; i < 4; i++) {
+        packed |= uint64_t(uint16_t(weights[first + 2 * i])) << (16 * i);
+    }
+    return _mm256_set1_epi64x(packed);
+}
+
+// Add the passed pawn bonus by rank: count the pawns of each rank byte, then
+// weight even and odd ranks with 16-bit multiply-adds and fold the halves
+__attribute__((target("avx2")))
+static inline void add_passed_bonus(__m256i& mg, __m256i& eg, __m256i passed) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i mg_even = rank_weights(passed_pawn_bonus[0], 0);
+    const __m256i mg_odd = rank_weights(passed_pawn_bonus[0], 1);
+    const __m256i eg_even = rank_weights(passed_pawn_bonus[1], 0);
+    const __m256i eg_odd = rank_weights(passed_pawn_bonus[1], 1);
+    
+    __m256i low = _mm256_and_si256(passed, low_mask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(passed, 4), low_mask);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+    __m256i even = _mm256_and_si256(counts, _mm256_set1_epi16(0x00ff));
+    __m256i odd = _mm256_srli_epi16(counts, 8);
+    
+    __m256i mg_sum = _mm256_add_epi32(_mm256_madd_epi16(even, mg_even), _mm256_madd_epi16(odd, mg_odd));
+    __m256i eg_sum = _mm256_add_epi32(_mm256_madd_epi16(even, eg_even), _mm256_madd_epi16(odd, eg_odd));
+    mg = _mm256_add_epi32(mg, _mm256_add_epi32(mg_sum, _mm256_srli_epi64(mg_sum, 32)));
+    eg = _mm256_add_epi32(eg, _mm256_add_epi32(eg_sum, _mm256_srli_epi64(eg_sum, 32)));
+}
+
+// Pawn and shield terms of one side for four boards; see pawn_side_terms
+__attribute__((target("avx2")))
+static void side_terms_lanes(__m256i own, __m256i enemy, __m256i king, __m256i& mg, __m256i& eg) {
+    __m256i doubled = _mm256_and_si256(own, south_fill_lanes(_mm256_srli_epi64(own, 8)));
+    
+    __m256i files = north_fill_lanes(south_fill_lanes(own));
+    __m256i isolated = _mm256_andnot_si256(_mm256_or_si256(east_one_lanes(files), west_one_lanes(files)), own);
+    
+    __m256i enemy_files = _mm256_or_si256(enemy, _mm256_or_si256(east_one_lanes(enemy), west_one_lanes(enemy)));
+    __m256i passed = _mm256_andnot_si256(south_fill_lanes(_mm256_srli_epi64(enemy_files, 8)), own);
+    
+    __m256i supportable = north_fill_lanes(_mm256_or_si256(east_one_lanes(own), west_one_lanes(own)));
+    __m256i enemy_attacks = _mm256_or_si256(
+        _mm256_andnot_si256(_mm256_set1_epi64x(file_a_mask), _mm256_srli_epi64(enemy, 7)),
+        _mm256_andnot_si256(_mm256_set1_epi64x(file_h_mask), _mm256_srli_epi64(enemy, 9)));
+    __m256i weak = _mm256_or_si256(supportable, _mm256_or_si256(isolated, passed));
+    __m256i backward = _mm256_andnot_si256(weak, _mm256_and_si256(own, _mm256_srli_epi64(enemy_attacks, 8)));
+    
+    passed = _mm256_andnot_si256(doubled, passed);
+    
+    add_weighted(mg, eg, popcount_lanes(doubled), -doubled_pawn_penalty[0], -doubled_pawn_penalty[1]);
+    add_weighted(mg, eg, popcount_lanes(isolated), -isolated_pawn_penalty[0], -isolated_pawn_penalty[1]);
+    add_weighted(mg, eg, popcount_lanes(backward), -backward_pawn_penalty[0], -backward_pawn_penalty[1]);
+    add_passed_bonus(mg, eg, passed);
+    
+    // Pawn shield (middlegame only)
+    __m256i front = _mm256_slli_epi64(king, 8);
+    __m256i near_squares = _mm256_or_si256(front, _mm256_or_si256(east_one_lanes(front), west_one_lanes(front)));
+    __m256i near_pawns = _mm256_and_si256(own, near_squares);
+    __m256i far_pawns = _mm256_andnot_si256(_mm256_slli_epi64(near_pawns, 8),
+                                            _mm256_and_si256(own, _mm256_slli_epi64(near_squares, 8)));
+    __m256i zero = _mm256_setzero_si256();
+    add_weighted(mg, zero, popcount_lanes(near_pawns), pawn_shield_bonus[0], 0);
+    add_weighted(mg, zero, popcount_lanes(far_pawns), pawn_shield_bonus[1], 0);
+}
+
+__attribute__((target("avx2")))
+static void evaluate_batch_avx2(const Board* boards, size_t count, int* out) {
+    const __m256i white_pawn = _mm256_set1_epi8(1);
+    const __m256i black_pawn = _mm256_set1_epi8(-1);
+    const __m256i white_king = _mm256_set1_epi8(6);
+    const __m256i black_king = _mm256_set1_epi8(-6);
+    const __m256i unpack_order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    
+    for (size_t base = 0; base + 4 <= count; base += 4) {
+        // Transpose: narrow each board's squares to bytes, then one compare
+        // per piece covers 32 squares
+        alignas(32) uint64_t pawns[2][4], kings[2][4];
+        for (int lane = 0; lane < 4; lane++) {
+            const __m256i* squares = reinterpret_cast<const __m256i*>(boards[base + lane].squares);
+            uint64_t bits[4] = {0, 0, 0, 0};
+            for (int half = 0; half < 2; half++) {
+                const __m256i* v = squares + 4 * half;
+                __m256i words = _mm256_packs_epi32(_mm256_loadu_si256(v), _mm256_loadu_si256(v + 1));
+                __m256i words2 = _mm256_packs_epi32(_mm256_loadu_si256(v + 2), _mm256_loadu_si256(v + 3));
+                // packs works within 128-bit halves; restore square order
+                __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packs_epi16(words, words2), unpack_order);
+                bits[0] |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, white_pawn)))) << (32 * half);
+                bits[1] |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, black_pawn)))) << (32 * half);
+                bits[2] |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, white_king)))) << (32 * half);
+                bits[3] |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, black_king)))) << (32 * half);
+            }
+            pawns[0][lane] = bits[0];
+            pawns[1][lane] = bits[1];
+            kings[0][lane] = bits[2];
+            kings[1][lane] = bits[3];
+        }
+        
+        __m256i white = _mm256_load_si256(reinterpret_cast<const __m256i*>(pawns[0]));
+        __m256i black = _mm256_load_si256(reinterpret_cast<const __m256i*>(pawns[1]));
+        __m256i white_kings = _mm256_load_si256(reinterpret_cast<const __m256i*>(kings[0]));
+        __m256i black_kings = _mm256_load_si256(reinterpret_cast<const __m256i*>(kings[1]));
+        
+        __m256i white_mg = _mm256_setzero_si256(), white_eg = _mm256_setzero_si256();
+        __m256i black_mg = _mm256_setzero_si256(), black_eg = _mm256_setzero_si256();
+        side_terms_lanes(white, black, white_kings, white_mg, white_eg);
+        side_terms_lanes(bswap_lanes(black), bswap_lanes(white), bswap_lanes(black_kings), black_mg, black_eg);
+        
+        alignas(32) int32_t mg_terms[8], eg_terms[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(mg_terms), _mm256_sub_epi32(white_mg, black_mg));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(eg_terms), _mm256_sub_epi32(white_eg, black_eg));
+        
+        // Taper all four at once; doubles divide exactly at these magnitudes
+        alignas(16) int32_t mg[4], eg[4], phase[4], sign[4];
+        for (int lane = 0; lane < 4; lane++) {
+            const Board& board = boards[base + lane];
+            mg[lane] = board.mg_score + mg_terms[2 * lane];
+            eg[lane] = board.eg_score + eg_terms[2 * lane];
+            phase[lane] = min(board.phase, max_phase);
+            sign[lane] = board.white_to_move ? 1 : -1;
+        }
+        __m128i mg_v = _mm_load_si128(reinterpret_cast<const __m128i*>(mg));
+        __m128i eg_v = _mm_load_si128(reinterpret_cast<const __m128i*>(eg));
+        __m128i phase_v = _mm_load_si128(reinterpret_cast<const __m128i*>(phase));
+        __m128i blend = _mm_add_epi32(_mm_mullo_epi32(mg_v, phase_v),
+                                      _mm_mullo_epi32(eg_v, _mm_sub_epi32(_mm_set1_epi32(max_phase), phase_v)));
+        __m128i score = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(blend), _mm256_set1_pd(max_phase)));
+        score = _mm_mullo_epi32(score, _mm_load_si128(reinterpret_cast<const __m128i*>(sign)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + base), score);
+    }
+}
+
+void evaluate_batch(const Board* boards, size_t count, int* out) {
+    static const bool use_avx2 = __builtin_cpu_supports("avx2");
+    
+    size_t done = 0;
+    if (use_avx2) {
+        done = count & ~size_t(3);
+        evaluate_batch_avx2(boards, done, out);
+        for (size_t i = 0; i < done; i++) kpk_score(boards[i], out[i]);
+    }
+    
+    // Scalar fallback, and the remainder of a batch that is not a multiple of four
+    for (size_t i = done; i < count; i++) {
+        out[i] = evaluate_position(boards[i]);
+    }
+}
+
+SearchContext::SearchContext()
+    : network(nullptr), tt(nullptr), tablebases(nullptr), stop_signal(nullptr), nodes(0), tb_hits(0), node_limit(0),
+      has_deadline(false), check_stop_signal(false), stopped(false) {
+    clear_heuristics();
+}
+
+void SearchContext::clear_heuristics() {
+    memset(history, 0, sizeof(history));
+    killers.assign(2 * (max_search_depth + 1), Move());
+}
+
+SearchContext::~SearchContext() {}
+
+// Same as evaluate_position, served from the context's eval cache when the
+// position was seen before, and with pawn structure from its pawn hash table
+int evaluate_position(const Board& board, SearchContext& context) {
+    int score;
+    if (context.eval_cache.probe(board.hash, score)) {
+        return score;
+    }
+    if (kpk_score(board, score)) {
+        context.eval_cache.store(board.hash, score);
+        return score;
+    }
+    
+    const PawnEntry& pawns = context.pawn_table.probe(board);
+    int mg = board.mg_score + pawns.mg_score + pawn_shield_score(eval_bitboards(board));
+    int eg = board.eg_score + pawns.eg_score;
+    score = tapered_score(board, mg, eg);
+    
+    context.eval_cache.store(board.hash, score);
+    return score;
+}
+
+// True if the position repeats an earlier one in path (the game history
+// followed by the current search line) or the fifty-move rule applies.
+// Only positions since the last irreversible move can repeat.
+static bool is_draw_by_rule(const Board& board, const vector<uint64_t>& path) {
+    if (board.halfmove_clock >= 100) return true;
+    
+    int reversible = min<int>(board.halfmove_clock, int(path.size()) - 1);
+    for (int back = 2; back <= reversible; back += 2) {
+        if (path[path.size() - 1 - back] == board.hash) return true;
+    }
+    return false;
+}
+
+// Game-ending draws, for code that plays whole games. history ends with
+// the current position, as in search.
+bool is_threefold_repetition(const Board& board, const vector<uint64_t>& history) {
+    int reversible = min<int>(board.halfmove_clock, int(history.size()) - 1);
+    int repeats = 0;
+    for (int back = 2; back <= reversible; back += 2) {
+        if (history[history.size() - 1 - back] == board.hash && ++repeats == 2) return true;
+    }
+    return false;
+}
+
+// No pawns, rooks or queens, and at most one minor piece on the board
+bool is_insufficient_material(const Board& board) {
+    int minors = 0;
+    for (int square = 0; square < 64; square++) {
+        int type = abs(board.squares[square]);
+        if (type == 1 || type == 4 || type == 5) return false;
+        if (type == 2 || type == 3) minors++;
+    }
+    return minors <= 1;
+}
+
+// Static evaluation at a search node: the neural network when the context
+// has one, using the accumulator on the search stack, classical otherwise
+static int evaluate_node(const Board& board, SearchContext& context, int ply) {
+    if (!context.network) {
+        return evaluate_position(board, context);
+    }
+    
+    int score;
+    if (context.eval_cache.probe(board.hash, score)) {
+        return score;
+    }
+    if (!kpk_score(board, score)) {
+        score = context.network->evaluate(context.accumulators[ply], board.white_to_move);
+    }
+    context.eval_cache.store(board.hash, score);
+    return score;
+}
+
+// Make a move on a copy of the board, deriving the child's NNUE accumulator.
+// A child searched to depth > 0 probes the transposition table first thing,
+// so its bucket is prefetched as soon as its key is known; the accumulator
+// update and the node's bookkeeping hide the memory latency.
+static Board make_child(const Board& board, const Move& move, SearchContext& context, int ply, int child_depth) {
+    Board child = board;
+    make_move_simple(child, move);
+    if (context.tt && child_depth > 0) {
+        context.tt->prefetch(child.hash);
+    }
+    if (context.network) {
+        context.network->update(board, move, context.accumulators[ply], child, context.accumulators[ply + 1]);
+    }
+    return child;
+}
+
+static bool same_move(const Move& a, const Move& b) {
+    return a.from == b.from && a.to == b.to && a.promotion() == b.promotion();
+}
+
+static bool is_capture(const Board& board, const Move& move) {
+    return board.squares[move.to] != 0 || move.is_en_passant();
+}
+
+// Search order: the transposition-table move, captures by most valuable
+// victim then least valuable attacker, promotions, the ply's killer moves,
+// then quiet moves by history
+static void order_moves(const Board& board, vector<Move>& moves, const Move& tt_move, int ply,
+                        const SearchContext& context) {
+    bool has_killers = ply <= max_search_depth;
+    int side = board.white_to_move ? 0 : 1;
+    vector<pair<int, int>> keys(moves.size()); // Score and index
+    for (size_t i = 0; i < moves.size(); i++) {
+        const Move& move = moves[i];
+        int score;
+        if (same_move(move, tt_move)) {
+            score = 1 << 30;
+        } else if (is_capture(board, move)) {
+            int victim = board.squares[move.to] != 0 ? abs(board.squares[move.to]) : 1;
+            score = (1 << 28) + victim * 16 - abs(board.squares[move.from]) + move.promotion();
+        } else if (move.promotion()) {
+            score = (1 << 28) + move.promotion();
+        } else if (has_killers && same_move(move, context.killers[2 * ply])) {
+            score = (1 << 27) + 1;
+        } else if (has_killers && same_move(move, context.killers[2 * ply + 1])) {
+            score = 1 << 27;
+        } else {
+            score = context.history[side][move.from][move.to];
+        }
+        keys[i] = {score, int(i)};
+    }
+    stable_sort(keys.begin(), keys.end(), [](const pair<int, int>& a, const pair<int, int>& b) {
+        return a.first > b.first;
+    });
+    vector<Move> ordered;
+    ordered.reserve(moves.size());
+    for (const auto& key : keys) ordered.push_back(moves[key.second]);
+    moves.swap(ordered);
+}
+
+// A quiet move refuted the position: remember it as a killer for the ply
+// and raise its history, which saturates towards history_limit
+static void update_heuristics(const Board& board, const Move& move, int depth, int ply, SearchContext& context) {
+    const int history_limit = 16384;
+    if (ply <= max_search_depth && !same_move(move, context.killers[2 * ply])) {
+        context.killers[2 * ply + 1] = context.killers[2 * ply];
+        context.killers[2 * ply] = move;
+    }
+    int& history = context.history[board.white_to_move ? 0 : 1][move.from][move.to];
+    int bonus = min(depth * depth, history_limit);
+    history += bonus - history * bonus / history_limit;
+}
+
+// True once a limit or the stop signal ends the search
+static bool should_stop(SearchContext& context) {
+    if (context.stopped) return true;
+    if (context.node_limit && context.nodes >= context.node_limit) {
+        context.stopped = true;
+    } else if ((context.nodes & 1023) == 0) {
+        bool signalled = context.check_stop_signal && context.stop_signal &&
+                         context.stop_signal->load(memory_order_relaxed);
+        bool late = context.has_deadline && chrono::steady_clock::now() >= context.deadline;
+        context.stopped = signalled || late;
+    }
+    return context.stopped;
+}
+
+// Mate scores count plies from the root. The transposition table holds them
+// counted from the stored position, so they stay right wherever the
+// position is reached again.
+static int score_to_tt(int score, int ply) {
+    if (score >= mate_score - max_search_depth) return score + ply;
+    if (score <= -(mate_score - max_search_depth)) return score - ply;
+    return score;
+}
+
+static int score_from_tt(int score, int ply) {
+    if (score >= mate_score - max_search_depth) return score - ply;
+    if (score <= -(mate_score - max_search_depth)) return score + ply;
+    return score;
+}
+
+// Fail-soft alpha-beta negamax. path holds the hashes of the game and
+// search line up to and including this position. Results go to the
+// context's transposition table when it has one. Once a limit is reached
+// every node returns 0 and context.stopped is set.
+int negamax(const Board& board, int depth, int alpha, int beta, int ply, vector<uint64_t>& path,
+            SearchContext& context) {
+    if (context.stopped) {
+        return 0;
+    }
+    context.nodes++;
+    if (should_stop(context)) {
+        return 0;
+    }
+    
+    if (is_draw_by_rule(board, path)) {
+        return 0;
+    }
+    
+    if (depth == 0) {
+        return evaluate_node(board, context, ply);
+    }
+    
+    TTHit hit;
+    if (context.tt && context.tt->probe(board.hash, hit) && hit.depth >= depth) {
+        int score = score_from_tt(hit.score, ply);
+        if (hit.bound == bound_exact ||
+            (hit.bound == bound_lower && score >= beta) ||
+            (hit.bound == bound_upper && score <= alpha)) {
+            return score;
+        }
+    }
+    
+    // Right after a capture or pawn move the endgame tables know the result,
+    // and the fifty-move rule is measured from here. Cursed wins and blessed
+    // losses are draws.
+    int wdl;
+    if (context.tablebases && board.halfmove_clock == 0 && context.tablebases->probe_wdl(board, wdl)) {
+        context.tb_hits++;
+        int score = wdl == wdl_win ? tablebase_win_score : wdl == wdl_loss ? -tablebase_win_score : 0;
+        int bound = wdl == wdl_win ? bound_lower : wdl == wdl_loss ? bound_upper : bound_exact;
+        if (bound == bound_exact || (bound == bound_lower ? score >= beta : score <= alpha)) {
+            if (context.tt) {
+                context.tt->store(board.hash, Move(), score, min(depth + 6, max_search_depth), bound);
+            }
+            return score;
+        }
+    }
+    
+    vector<Move> moves = generate_all_legal_moves(board);
+    
+    // Check for checkmate/stalemate
+    if (moves.empty()) {
+        if (is_in_check(board, board.white_to_move)) {
+            return -(mate_score - ply); // Checkmate: nearer mates score further from zero
+        } else {
+            return 0; // Stalemate
+        }
+    }
+    order_moves(board, moves, hit.move, ply, context);
+    
+    int original_alpha = alpha;
+    int best_score = -30000; // Negative infinity
+    Move best_move = moves[0];
+    
+    for (const Move& move : moves) {
+        Board temp_board = make_child(board, move, context, ply, depth - 1);
+        
+        path.push_back(temp_board.hash);
+        int score = -negamax(temp_board, depth - 1, -beta, -alpha, ply + 1, path, context);
+        path.pop_back();
+        if (context.stopped) {
+            return 0;
+        }
+        
+        if (score > best_score) {
+            best_score = score;
+            best_move = move;
+        }
+        if (score > alpha) {
+            alpha = score;
+        }
+        if (alpha >= beta) {
+            if (!is_capture(board, move) && !move.promotion()) {
+                update_heuristics(board, move, depth, ply, context);
+            }
+            break;
+        }
+    }
+    
+    if (context.tt) {
+        int bound = best_score >= beta ? bound_lower : best_score > original_alpha ? bound_exact : bound_upper;
+        context.tt->store(board.hash, best_move, score_to_tt(best_score, ply), depth, bound);
+    }
+    return best_score;
+}
+
+// The best move followed by the stored moves of the transposition table,
+// up to depth moves. The line ends early at a missing or illegal move (a
+// key collision) or at a draw, where the search stopped looking.
+static vector<Move> principal_variation(const Board& board, const Move& best_move, int depth,
+                                        const vector<uint64_t>& path, const SearchContext& context) {
+    vector<Move> pv(1, best_move);
+    if (!context.tt) return pv;
+    
+    Board position = board;
+    make_move_simple(position, best_move);
+    vector<uint64_t> line = path;
+    line.push_back(position.hash);
+    TTHit hit;
+    while (int(pv.size()) < depth && context.tt->probe(position.hash, hit) && hit.move.from != hit.move.to) {
+        vector<Move> moves = generate_all_legal_moves(position);
+        auto legal = find_if(moves.begin(), moves.end(), [&](const Move& move) { return same_move(move, hit.move); });
+        if (legal == moves.end() || is_draw_by_rule(position, line)) break;
+        pv.push_back(*legal);
+        make_move_simple(position, *legal);
+        line.push_back(position.hash);
+    }
+    return pv;
+}
+
+// A fixed share of the remaining time plus most of the increment, keeping
+// a margin for communication overhead
+int allocate_time(int time_left, int increment, int moves_to_go) {
+    const int overhead = 30;
+    int moves = moves_to_go > 0 ? min(moves_to_go, 30) : 30;
+    int budget = time_left / moves + increment * 3 / 4;
+    return max(1, min(budget, time_left / 2 - overhead));
+}
+
+int mate_in_moves(int score) {
+    if (abs(score) < mate_score - max_search_depth) return 0;
+    int plies = mate_score - abs(score);
+    return score > 0 ? (plies + 1) / 2 : -(plies / 2);
+}
+
+SearchResult::SearchResult() : best_move(), score(0), depth(0), nodes(0), tb_hits(0) {}
+
+// Find best move using negamax search
+Move search_best_move(const Board& board, int depth) {
+    SearchContext context;
+    return search_best_move(board, depth, vector<uint64_t>(1, board.hash), context);
+}
+
+// Find best move using negamax search. history holds the hashes of the
+// positions reached in the game so far, ending with the current one, so
+// that repetitions are scored as draws. context holds the caches of the
+// searching thread.
+Move search_best_move(const Board& board, int depth, const vector<uint64_t>& history,
+                      SearchContext& context) {
+    return search(board, SearchLimits{depth, 0, 0}, history, context).best_move;
+}
+
+// Iterative deepening over the root moves until a limit is reached. The
+// first iteration always completes so there is a move to play. Each
+// iteration searches the previous best move first.
+SearchResult search(const Board& board, const SearchLimits& limits, const vector<uint64_t>& history,
+                    SearchContext& context) {
+    SearchResult result;
+    auto start = chrono::steady_clock::now();
+    context.nodes = 0;
+    context.tb_hits = 0;
+    context.stopped = false;
+    context.node_limit = 0;
+    context.has_deadline = false;
+    context.check_stop_signal = false;
+    vector<Move> moves = generate_all_legal_moves(board);
+    
+    if (moves.empty()) {
+        // No legal moves - return dummy move
+        result.score = is_in_check(board, board.white_to_move) ? -mate_score : 0;
+        return result;
+    }
+    
+    // In the endgame tables only the moves that keep the best result are
+    // searched, and the tables' result is reported
+    int tablebase_score = 0;
+    bool in_tablebases = context.tablebases && context.tablebases->filter_root_moves(board, moves, tablebase_score);
+    if (in_tablebases) context.tb_hits++;
+    
+    vector<uint64_t> path = history;
+    if (path.empty() || path.back() != board.hash) {
+        path.push_back(board.hash);
+    }
+    
+    int max_depth = limits.depth > 0 ? min(limits.depth, max_search_depth) : max_search_depth;
+    if (context.network) {
+        if (context.accumulators.size() < size_t(max_depth + 1)) {
+            context.accumulators.resize(max_depth + 1);
+        }
+        context.network->refresh(board, context.accumulators[0]);
+    }
+    
+    TTHit hit;
+    if (context.tt) {
+        context.tt->probe(board.hash, hit);
+    }
+    order_moves(board, moves, hit.move, 0, context);
+    
+    for (int depth = 1; depth <= max_depth; depth++) {
+        Move best_move = moves[0];
+        int best_score = -30000;
+        
+        for (const Move& move : moves) {
+            Board temp_board = make_child(board, move, context, 0, depth - 1);
+            
+            path.push_back(temp_board.hash);
+            int score = -negamax(temp_board, depth - 1, -30000, -best_score, 1, path, context);
+            path.pop_back();
+            
+            if (score > best_score) {
+                best_score = score;
+                best_move = move;
+            }
+        }
+        
+        if (context.stopped) break;
+        result.best_move = best_move;
+        result.score = best_score;
+        result.depth = depth;
+        if (context.tt) {
+            context.tt->store(board.hash, best_move, best_score, depth, bound_exact);
+        }
+        result.pv = principal_variation(board, best_move, depth, path, context);
+        auto best = find_if(moves.begin(), moves.end(), [&](const Move& move) { return same_move(move, best_move); });
+        rotate(moves.begin(), best, best + 1);
+        
+        // Arm the limits once there is a move to fall back on
+        context.node_limit = limits.nodes;
+        context.check_stop_signal = true;
+        if (context.node_limit && context.nodes >= context.node_limit) break;
+        if (context.stop_signal && context.stop_signal->load(memory_order_relaxed)) break;
+        if (limits.movetime > 0) {
+            context.deadline = start + chrono::milliseconds(limits.movetime);
+            context.has_deadline = true;
+            if (chrono::steady_clock::now() >= context.deadline) break;
+        }
+    }
+    
+    if (in_tablebases && mate_in_moves(result.score) == 0) result.score = tablebase_score;
+    result.nodes = context.nodes;
+    result.tb_hits = context.tb_hits;
+    return result;
+}
@@ -1,6 +1,10 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include <chrono>
+#include <atomic>
 using namespace std;
 
 // Piece values: 0=empty, 1=pawn, 2=knight, 3=bishop, 4=rook, 5=queen, 6=king
@@ -13,27 +17,61 @@ struct Board {
     bool white_can_castle_queenside;
     bool black_can_castle_kingside;
     bool black_can_castle_queenside;
+    int halfmove_clock;  // Plies since the last capture or pawn move
+    int fullmove_number; // Starts at 1, incremented after black moves
+    uint64_t hash;       // Zobrist key, kept up to date by set_piece and make_move_simple
+    uint64_t pawn_hash;  // Zobrist key of the pawns alone, for the pawn hash table
+    
+    // Evaluation sums kept up to date by set_piece, from white's point of view
+    int mg_score;        // Middlegame material + piece-square total
+    int eg_score;        // Endgame material + piece-square total
+    int phase;           // Game phase: 24 with all minor and major pieces on, 0 with none
     
     Board();
 };
 
+// Moves pack into 16 bits: the from and to squares in six bits each and a
+// four-bit flag. The flag marks castling and en passant, which
+// make_move_simple carries out without looking at the pieces, or names the
+// promotion piece. The move generators and uci_to_move(board, text) set the
+// flags; moves built from squares alone have none. A move with from == to
+// is the null move, meaning none.
+const int move_castling = 1;
+const int move_en_passant = 2;
+const int move_promotion = 4; // Plus the piece - 2: 4 knight, 5 bishop, 6 rook, 7 queen
+
 struct Move {
-    int from;
-    int to;
-    int promotion; // 0=no promotion, 2=knight, 3=bishop, 4=rook, 5=queen
+    uint16_t from : 6;
+    uint16_t to : 6;
+    uint16_t flag : 4;
+    
+    Move(); // The null move, a1a1
+    Move(int f, int t, int p = 0); // p: 0=no promotion, 2=knight, 3=bishop, 4=rook, 5=queen
+    static Move with_flag(int f, int t, int flag); // Castling or en passant
     
-    Move(int f, int t, int p = 0);
+    int promotion() const; // Piece as for the constructor
+    bool is_castling() const;
+    bool is_en_passant() const;
+    
+    uint16_t bits() const; // from | to << 6 | flag << 12; 0 for Move()
+    static Move from_bits(uint16_t bits);
 };
 
 // Basic board functions
 bool is_valid_square(int square);
 string square_to_string(int square);
-int string_to_square(const string& str);
+int string_to_square(string_view str);
 Board create_starting_position();
 int get_piece(const Board& board, int square);
 void set_piece(Board& board, int square, int piece);
 bool is_white_to_move(const Board& board);
 
+// Zobrist hashing. set_piece and make_move_simple update board.hash
+// incrementally; code that writes Board fields directly must call
+// refresh_board, which recomputes the hash and evaluation sums from scratch.
+uint64_t compute_hash(const Board& board);
+void refresh_board(Board& board);
+
 // Move generation functions
 vector<Move> generate_pawn_moves(const Board& board, int square);
 vector<Move> generate_knight_moves(const Board& board, int square);
@@ -52,12 +90,327 @@ void make_move_simple(Board& board, const Move& move);
 // Legal move validation
 bool is_legal_move(const Board& board, const Move& move);
 
+// Draws that end a game; history holds the hashes of the game so far,
+// ending with the current position
+bool is_threefold_repetition(const Board& board, const vector<uint64_t>& history);
+bool is_insufficient_material(const Board& board);
+
+// Splits text into whitespace-separated tokens without copying. next()
+// returns an empty view once the text is exhausted.
+struct Tokenizer {
+    string_view rest;
+    
+    explicit Tokenizer(string_view text);
+    string_view next();
+};
+
+// FEN/EPD functions. The parsers return false, leaving board unchanged, if
+// the position is malformed; see parse_position_fields for what is checked.
+bool parse_fen(string_view fen, Board& board);
+Board parse_fen(string_view fen); // For FENs known to be valid, such as literals; an empty board otherwise
+string board_to_fen(const Board& board);
+bool parse_epd(string_view epd, Board& board, string_view* operations = nullptr);
+string board_to_epd(const Board& board);
+
+// Reads an EPD file through a read-only memory mapping, one line at a time.
+// Lines point into the mapping and stay valid for the reader's lifetime.
+class EpdReader {
+public:
+    explicit EpdReader(const string& path);
+    ~EpdReader();
+    EpdReader(const EpdReader&) = delete;
+    EpdReader& operator=(const EpdReader&) = delete;
+    
+    bool is_open() const;
+    bool next_line(string_view& line); // Skips blank lines; false at end of file
+    
+private:
+    const char* data;
+    size_t size;
+    size_t pos;
+};
+
 // UCI interface functions
 string move_to_uci(const Move& move);
-Move uci_to_move(const string& uci_str);
-Board parse_uci_position(const string& position_command);
+Move uci_to_move(const Board& board, string_view uci_str); // With the castling or en passant flag it has on board; null if malformed
+Board parse_uci_position(string_view position_command); // An empty board if the base position is malformed
+
+// State left behind by the last UCI "position" command. GUIs resend the whole
+// game before every "go"; when the new command extends the previous one only
+// the new moves are applied.
+struct UciPosition {
+    string command;           // Last position command applied
+    Board board;              // Resulting position
+    vector<uint64_t> history; // Hashes of every position reached, current one last
+};
+
+// False, leaving position unchanged, if the base position is malformed
+bool update_uci_position(UciPosition& position, string_view position_command);
 vector<Move> generate_all_legal_moves(const Board& board);
 
+// Legal moves of particular kinds. generate_evasions is for a side in
+// check: king moves, captures of a single checker and blocks of its line.
+// generate_quiet_checks gives the checking moves that neither capture nor
+// promote. gives_check takes a legal move and finds direct and discovered
+// checks without playing the move.
+vector<Move> generate_evasions(const Board& board);
+vector<Move> generate_quiet_checks(const Board& board);
+bool gives_check(const Board& board, const Move& move);
+
+// Standard algebraic notation ("Nbd7", "exd6", "O-O", "e8=Q+"), as used by
+// EPD bm operations. san_to_move returns the null move for no legal match.
+string move_to_san(const Board& board, const Move& move);
+Move san_to_move(const Board& board, string_view san);
+
+// Pawn-structure evaluation, cached by pawn_hash. Scores are from white's
+// point of view; passed[0] and passed[1] are bitmasks of the white and black
+// passed pawns.
+struct PawnEntry {
+    uint64_t key;
+    int mg_score;
+    int eg_score;
+    uint64_t passed[2];
+};
+
+PawnEntry evaluate_pawn_structure(const Board& board);
+
+// Zeroed memory for large tables, from mmap: page aligned, so cache-line
+// aligned, and committed lazily as it is touched. With huge pages wanted,
+// explicit huge pages (MAP_HUGETLB) are tried first, then transparent huge
+// pages (madvise), then normal pages; without, transparent huge pages are
+// refused so that the two can be compared.
+const int pages_normal = 0;
+const int pages_transparent = 1;
+const int pages_explicit = 2;
+
+const char* page_kind_name(int pages); // "normal pages", "transparent huge pages", "huge pages"
+
+class LargeBuffer {
+public:
+    LargeBuffer();
+    ~LargeBuffer();
+    LargeBuffer(const LargeBuffer&) = delete;
+    LargeBuffer& operator=(const LargeBuffer&) = delete;
+    
+    bool allocate(size_t bytes, bool huge_pages); // False, leaving the buffer empty, if out of memory
+    void release();
+    void zero();
+    
+    void* data() const;
+    size_t size() const;
+    int pages() const; // pages_*, the kind the buffer got
+    
+private:
+    void* mapping;
+    size_t mapping_size;
+    size_t bytes;
+    int page_kind;
+};
+
+// Direct-mapped pawn hash table. Each search thread owns one.
+class PawnHashTable {
+public:
+    explicit PawnHashTable(size_t entries = 16384); // Rounded down to a power of two
+    
+    const PawnEntry& probe(const Board& board);
+    void clear();
+    
+    uint64_t hits;
+    uint64_t probes;
+    double hit_rate() const;
+    
+private:
+    vector<PawnEntry> entries;
+    size_t mask;
+};
+
+// Direct-mapped cache of static evaluations keyed by Zobrist hash. Each
+// entry packs the upper 48 bits of the key with a 16-bit score.
+class EvalCache {
+public:
+    explicit EvalCache(size_t megabytes = 1);
+    
+    void resize(size_t megabytes, bool huge_pages = true); // 0 disables the cache
+    bool probe(uint64_t key, int& score);
+    void store(uint64_t key, int score);
+    void clear();
+    
+    uint64_t hits;        // Evaluations served from the cache
+    uint64_t evaluations; // Full evaluations computed
+    
+private:
+    LargeBuffer memory;
+    uint64_t* entries;
+    size_t count;
+};
+
+// Search results by Zobrist key, shared by the threads of an engine.
+// Buckets of four 16-byte entries fill one cache line. Each entry stores
+// its key XORed with its data, so an entry torn by a concurrent write fails
+// the key check instead of returning another position's data.
+const int bound_upper = 1; // Score is at most the stored score
+const int bound_lower = 2; // Score is at least the stored score
+const int bound_exact = 3;
+
+struct TTEntry {
+    uint64_t key;  // Zobrist key XOR data
+    uint64_t data; // Move, score, depth, bound and generation
+};
+
+struct TTHit {
+    Move move; // Null if none was stored
+    int score;
+    int depth;
+    int bound;
+    
+    TTHit();
+};
+
+class TranspositionTable {
+public:
+    explicit TranspositionTable(size_t megabytes = 16); // Rounded down to a power of two
+    ~TranspositionTable();
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+    
+    void resize(size_t megabytes, bool huge_pages = true); // Private memory; 0 disables the table
+    int pages() const; // pages_* of the private memory; pages_normal for a shared or loaded table
+    size_t megabytes() const; // Size of the table in use, 0 when disabled or allocation failed
+    
+    // Use the named POSIX shared-memory segment (shm_open), creating it
+    // with the given size if it does not exist; an existing segment keeps
+    // its size. Processes attached to the same segment read and write one
+    // table. The segment outlives the processes until it is unlinked
+    // (shm_unlink, or removing /dev/shm/NAME). False, leaving the table
+    // disabled, if the segment cannot be created or mapped. Each process
+    // ages entries by its own searches.
+    bool attach_shared(const string& name, size_t megabytes);
+    bool is_shared() const;
+    
+    // Write the table to a file, replacing it by rename so tables that
+    // loaded the old file keep their mapping, and map such a file as a
+    // private table of the same size. Pages are read in lazily as probes touch them, and
+    // writes stay in memory (copy-on-write), so the file is never changed.
+    // False if the file cannot be written, or is missing or malformed, in
+    // which case load leaves the table as it was.
+    bool save(const string& path) const;
+    bool load(const string& path);
+    
+    void clear(); // Does nothing to a shared table, which other processes may be using
+    void new_search(); // Entries from earlier searches become the first to be replaced
+    void prefetch(uint64_t key) const; // Start loading the key's bucket into cache
+    bool probe(uint64_t key, TTHit& hit) const;
+    void store(uint64_t key, const Move& move, int score, int depth, int bound);
+    int hashfull() const; // Permille of sampled entries written by the current search
+    
+private:
+    struct alignas(64) Bucket {
+        TTEntry entries[4];
+    };
+    
+    void release();
+    
+    Bucket* buckets;       // Into owned or the mapping
+    size_t count;          // Buckets, a power of two
+    LargeBuffer owned;
+    bool huge_pages;       // Wanted for owned
+    void* mapping;         // Shared segment or loaded file, header first; null if owned
+    size_t mapping_size;
+    bool shared;
+    uint8_t generation;
+};
+
+class NnueNetwork;
+struct NnueAccumulator;
+class SyzygyTablebases;
+
+const int max_search_depth = 64;
+const int mate_score = 20000;          // A mate n plies ahead scores +-(mate_score - n)
+const int tablebase_win_score = 19000; // Endgame-table wins, below mate scores
+
+// Per-thread search state that persists between searches
+struct SearchContext {
+    PawnHashTable pawn_table;
+    EvalCache eval_cache;
+    const NnueNetwork* network;           // Neural evaluation if set, classical otherwise
+    vector<NnueAccumulator> accumulators; // Search stack of NNUE accumulators, indexed by ply
+    TranspositionTable* tt;               // Null for none; may be shared with other threads
+    const SyzygyTablebases* tablebases;   // Endgame tables to probe; null for none
+    const atomic<bool>* stop_signal;      // Stops the search once set; null for none
+    int history[2][64][64];               // Quiet-move cutoffs by side to move, from and to square
+    vector<Move> killers;                 // Two quiet moves that caused cutoffs per ply
+    uint64_t nodes;                       // Nodes visited by the last search
+    uint64_t tb_hits;                     // Successful endgame-table probes of the last search
+    uint64_t node_limit;                  // Set by search from its limits; 0 for none
+    chrono::steady_clock::time_point deadline; // Set by search from its limits
+    bool has_deadline;
+    bool check_stop_signal;               // Set by search once an iteration completed
+    bool stopped;                         // A limit cut the last iteration short
+    
+    SearchContext();
+    void clear_heuristics(); // Forget the history and killer moves
+    ~SearchContext();
+    SearchContext(const SearchContext&) = delete;
+    SearchContext& operator=(const SearchContext&) = delete;
+};
+
+// Term counts behind the classical evaluation, white minus black, for
+// tuning. The white-relative score is the sum of each count times its
+// eval_params.h value, tapered by phase.
+const int max_phase = 24;
+
+struct EvalTrace {
+    int phase;           // Board phase clamped to max_phase
+    int pieces[7];       // By piece type
+    int pst[7][64];      // By piece type and table index
+    int doubled_pawns;
+    int isolated_pawns;
+    int backward_pawns;
+    int passed_pawns[8]; // By rank from the pawn's own side
+    int shield_pawns[2]; // One and two ranks ahead of the king
+};
+
+void trace_evaluation(const Board& board, EvalTrace& trace);
+
+// King and pawn against king from a bitbase solved at startup: true, with
+// win set if the side with the pawn wins, when the board holds exactly
+// those three pieces. evaluate_position scores these positions by it.
+bool probe_kpk(const Board& board, bool& win);
+
 // Evaluation and search functions
 int evaluate_position(const Board& board);
-Move search_best_move(const Board& board, int depth);
\ No newline at end of file
+int evaluate_position(const Board& board, SearchContext& context); // Uses the context's caches
+void evaluate_batch(const Board* boards, size_t count, int* out); // Same scores as evaluate_position
+Move search_best_move(const Board& board, int depth);
+Move search_best_move(const Board& board, int depth, const vector<uint64_t>& history,
+                      SearchContext& context);
+
+// Limits of an iterative-deepening search; 0 means no limit. The node and
+// time limits, like the context's stop signal, are checked as the search
+// goes: the iteration they interrupt is discarded.
+struct SearchLimits {
+    int depth;
+    uint64_t nodes;
+    int movetime; // Milliseconds
+};
+
+// Time to spend on a move from UCI clock values, in milliseconds
+int allocate_time(int time_left, int increment, int moves_to_go);
+
+// Moves to the mate a search score announces: positive when the side to
+// move mates, negative when it is mated, 0 for any other score
+int mate_in_moves(int score);
+
+struct SearchResult {
+    Move best_move; // Null if the side to move has no legal moves
+    int score;      // Centipawns for the side to move; mates as for mate_in_moves
+    int depth;      // Last completed iteration
+    uint64_t nodes;
+    uint64_t tb_hits;
+    vector<Move> pv; // Principal variation from best_move on, as far as the transposition table knows it
+    
+    SearchResult();
+};
+
+SearchResult search(const Board& board, const SearchLimits& limits, const vector<uint64_t>& history,
+                    SearchContext& context);
\ No newline at end of file
@@ -1,8 +1,26 @@
 #include "chess.h"
+#include "nnue.h"
+#include "eval_params.h"
+#include "packed.h"
+#include "engine.h"
+#include "book.h"
+#include "syzygy.h"
+#include "mate.h"
 #include <iostream>
 #include <cassert>
 #include <sstream>
-#include <fstream>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <algorithm>
+#include <array>
+#include <random>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 void test_square_utilities() {
     cout << "Testing square utilities..." << endl;
@@ -768,10 +786,10 @@ void test_pawn_promotion() {
     bool found_queen = false, found_rook = false, found_bishop = false, found_knight = false;
     for (const Move& move : promotion_moves) {
         assert(move.to == string_to_square("e8"));
-        if (move.promotion == 5) found_queen = true;
-        else if (move.promotion == 4) found_rook = true;
-        else if (move.promotion == 3) found_bishop = true;
-        else if (move.promotion == 2) found_knight = true;
+        if (move.promotion() == 5) found_queen = true;
+        else if (move.promotion() == 4) found_rook = true;
+        else if (move.promotion() == 3) found_bishop = true;
+        else if (move.promotion() == 2) found_knight = true;
     }
     assert(found_queen && found_rook && found_bishop && found_knight);
     
@@ -789,10 +807,10 @@ void test_pawn_promotion() {
     bool found_black_queen = false, found_black_rook = false, found_black_bishop = false, found_black_knight = false;
     for (const Move& move : black_promotion) {
         assert(move.to == string_to_square("d1"));
-        if (move.promotion == 5) found_black_queen = true;
-        else if (move.promotion == 4) found_black_rook = true;
-        else if (move.promotion == 3) found_black_bishop = true;
-        else if (move.promotion == 2) found_black_knight = true;
+        if (move.promotion() == 5) found_black_queen = true;
+        else if (move.promotion() == 4) found_black_rook = true;
+        else if (move.promotion() == 3) found_black_bishop = true;
+        else if (move.promotion() == 2) found_black_knight = true;
     }
     assert(found_black_queen && found_black_rook && found_black_bishop && found_black_knight);
     
@@ -823,7 +841,7 @@ void test_pawn_promotion() {
     // Should have 1 regular move with no promotion
     assert(no_promotion.size() == 1);
     assert(no_promotion[0].to == string_to_square("e7"));
-    assert(no_promotion[0].promotion == 0); // No promotion
+    assert(no_promotion[0].promotion() == 0); // No promotion
     
     cout << "✓ Pawn promotion move generation tests passed" << endl;
 }
@@ -961,7 +979,7 @@ void test_legal_move_validation() {
     board7.en_passant_square = string_to_square("c6"); // En passant available
     
     // En passant capture would remove the pawn blocking the rook's attack
-    Move en_passant_expose(string_to_square("d5"), string_to_square("c6"));
+    Move en_passant_expose = Move::with_flag(string_to_square("d5"), string_to_square("c6"), move_en_passant);
     assert(!is_legal_move(board7, en_passant_expose));
     
     // Test 8: Castling through check should be illegal
@@ -972,64 +990,12 @@ void test_legal_move_validation() {
     board8.white_can_castle_kingside = true;
     
     // Castling would move king through attacked f1 square
-    Move castle_through_check(string_to_square("e1"), string_to_square("g1"));
+    Move castle_through_check = Move::with_flag(string_to_square("e1"), string_to_square("g1"), move_castling);
     assert(!is_legal_move(board8, castle_through_check));
     
     cout << "✓ Legal move validation tests passed" << endl;
 }
 
-// FEN parsing (test-only)
-Board parse_fen(const string& fen) {
-    Board board;
-    istringstream iss(fen);
-    string pieces, turn, castling, en_passant, halfmove, fullmove;
-    
-    iss >> pieces >> turn >> castling >> en_passant >> halfmove >> fullmove;
-    
-    // Parse piece placement
-    int square = 56; // Start at a8
-    for (char c : pieces) {
-        if (c == '/') {
-            square -= 16; // Move to next rank down
-        } else if (isdigit(c)) {
-            square += (c - '0'); // Skip empty squares
-        } else {
-            // Place piece
-            int piece = 0;
-            switch (tolower(c)) {
-                case 'p': piece = 1; break;
-                case 'n': piece = 2; break;
-                case 'b': piece = 3; break;
-                case 'r': piece = 4; break;
-                case 'q': piece = 5; break;
-                case 'k': piece = 6; break;
-            }
-            if (islower(c)) piece = -piece; // Black piece
-            set_piece(board, square, piece);
-            square++;
-        }
-    }
-    
-    // Parse turn
-    board.white_to_move = (turn == "w");
-    
-    // Parse castling rights
-    board.white_can_castle_kingside = castling.find('K') != string::npos;
-    board.white_can_castle_queenside = castling.find('Q') != string::npos;
-    board.black_can_castle_kingside = castling.find('k') != string::npos;
-    board.black_can_castle_queenside = castling.find('q') != string::npos;
-    
-    // Parse en passant
-    if (en_passant != "-") {
-        board.en_passant_square = string_to_square(en_passant);
-    } else {
-        board.en_passant_square = -1;
-    }
-    
-    return board;
-}
-
-
 // Perft function
 long long perft(const Board& board, int depth) {
     if (depth == 0) return 1;
@@ -1047,39 +1013,36 @@ long long perft(const Board& board, int depth) {
 }
 
 struct PerftResult {
-    string fen;
+    string_view fen;
     vector<long long> depths;
 };
 
-PerftResult parse_perft_line(const string& line) {
+PerftResult parse_perft_line(string_view line) {
     PerftResult result;
     
     // Find FEN part (everything before first semicolon)
     size_t semicolon_pos = line.find(';');
-    if (semicolon_pos == string::npos) return result;
+    if (semicolon_pos == string_view::npos) return result;
     
     result.fen = line.substr(0, semicolon_pos);
     
-    // Parse depth results
-    string remaining = line.substr(semicolon_pos + 1);
-    istringstream iss(remaining);
-    string token;
-    
-    while (iss >> token) {
-        if (token.substr(0, 2) == ";D") {
-            // Extract depth number
-            int depth = stoi(token.substr(2));
-            
-            // Get the count
-            long long count;
-            iss >> count;
-            
-            // Ensure we have enough space in vector
-            while (result.depths.size() <= depth) {
-                result.depths.push_back(0);
-            }
-            result.depths[depth] = count;
+    // Parse depth results: ";D<depth> <count>" pairs
+    Tokenizer tokens(line.substr(semicolon_pos));
+    for (string_view token = tokens.next(); !token.empty(); token = tokens.next()) {
+        if (token.substr(0, 2) != ";D") continue;
+        
+        // Extract depth number and the count that follows it
+        int depth = 0;
+        long long count = 0;
+        from_chars(token.data() + 2, token.data() + token.size(), depth);
+        string_view count_token = tokens.next();
+        from_chars(count_token.data(), count_token.data() + count_token.size(), count);
+        
+        // Ensure we have enough space in vector
+        while (result.depths.size() <= size_t(depth)) {
+            result.depths.push_back(0);
         }
+        result.depths[depth] = count;
     }
     
     return result;
@@ -1124,6 +1087,1686 @@ void test_uci_position_parsing() {
     cout << "✓ UCI position parsing tests passed" << endl;
 }
 
+void test_tokenizer() {
+    cout << "Testing tokenizer..." << endl;
+    
+    Tokenizer tokens("  position\tstartpos  moves e2e4\r\n");
+    assert(tokens.next() == "position");
+    assert(tokens.next() == "startpos");
+    assert(tokens.next() == "moves");
+    assert(tokens.next() == "e2e4");
+    assert(tokens.next().empty());
+    assert(tokens.next().empty());
+    
+    // Tokens point into the original text
+    string_view text = "e7e8q";
+    Tokenizer single(text);
+    assert(single.next().data() == text.data());
+    
+    Move move = uci_to_move(parse_fen("4k3/4P3/8/8/8/8/8/4K3 w - - 0 1"), text);
+    assert(move.from == string_to_square("e7") && move.to == string_to_square("e8") && move.promotion() == 5);
+    
+    cout << "✓ Tokenizer tests passed" << endl;
+}
+
+void test_fen_parsing() {
+    cout << "Testing FEN/EPD parsing and serialization..." << endl;
+    
+    // Test 1: Starting position matches create_starting_position
+    string start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    Board board1 = parse_fen(start_fen);
+    Board expected1 = create_starting_position();
+    for (int i = 0; i < 64; i++) {
+        assert(board1.squares[i] == expected1.squares[i]);
+    }
+    assert(board1.white_to_move);
+    assert(board1.halfmove_clock == 0);
+    assert(board1.fullmove_number == 1);
+    assert(board_to_fen(expected1) == start_fen);
+    
+    // Test 2: Round trip with en passant, partial castling rights and clocks
+    string fen2 = "r3k2r/p1pp1pb1/bn2pnp1/2qPN3/1pP1P3/2N2Q1p/PP1BBPPP/R3K2R b Kq c3 3 17";
+    Board board2 = parse_fen(fen2);
+    assert(board2.en_passant_square == string_to_square("c3"));
+    assert(!board2.white_to_move);
+    assert(board2.white_can_castle_kingside && !board2.white_can_castle_queenside);
+    assert(!board2.black_can_castle_kingside && board2.black_can_castle_queenside);
+    assert(board2.halfmove_clock == 3);
+    assert(board2.fullmove_number == 17);
+    assert(board_to_fen(board2) == fen2);
+    
+    // Test 3: Clocks are maintained by make_move_simple
+    Board board3 = create_starting_position();
+    make_move_simple(board3, Move(string_to_square("g1"), string_to_square("f3")));
+    assert(board3.halfmove_clock == 1 && board3.fullmove_number == 1);
+    make_move_simple(board3, Move(string_to_square("g8"), string_to_square("f6")));
+    assert(board3.halfmove_clock == 2 && board3.fullmove_number == 2);
+    make_move_simple(board3, Move(string_to_square("e2"), string_to_square("e4")));
+    assert(board3.halfmove_clock == 0 && board3.fullmove_number == 2);
+    assert(board_to_fen(board3) == "rnbqkb1r/pppppppp/5n2/8/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq e3 0 2");
+    
+    // Test 4: EPD records with operations and clock opcodes
+    string_view ops;
+    Board board4;
+    assert(parse_epd("4k3/8/8/8/8/8/4P3/4K3 w - - bm e2e4; hmvc 7; fmvn 42; id \"kpk\";", board4, &ops));
+    assert(board4.halfmove_clock == 7);
+    assert(board4.fullmove_number == 42);
+    assert(ops.substr(0, 9) == "bm e2e4; ");
+    assert(board_to_epd(board4) == "4k3/8/8/8/8/8/4P3/4K3 w - - hmvc 7; fmvn 42;");
+    
+    // Test 5: EPD records carrying FEN-style clocks
+    Board board5;
+    assert(parse_epd("4k3/8/8/8/8/8/4P3/4K3 b - - 5 60 ;D1 5", board5, &ops));
+    assert(board5.halfmove_clock == 5 && board5.fullmove_number == 60);
+    assert(ops == ";D1 5");
+    
+    // Test 6: UCI position with FEN and moves
+    Board board6 = parse_uci_position("position fen " + fen2 + " moves c5c4 e2c4");
+    assert(get_piece(board6, string_to_square("c4")) == 3);
+    assert(board6.white_to_move == false);
+    assert(board6.halfmove_clock == 0);
+    assert(board6.fullmove_number == 18);
+    
+    Board board7 = parse_uci_position("position fen " + start_fen);
+    assert(board_to_fen(board7) == start_fen);
+    
+    // Test 7: Malformed positions are rejected and leave the board alone
+    const char* malformed[] = {
+        "garbage line here",
+        "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",  // Nine files
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq - 0 1",           // Seven ranks
+        "rnbqkbnr/pppxpppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",  // Unknown piece
+        "rnbq1bnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQ - 0 1",    // No black king
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1",  // Side to move
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQxk - 0 1",  // Castling letter
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e4 0 1", // En passant rank
+    };
+    Board kept = parse_fen(fen2);
+    for (const char* fen : malformed) {
+        assert(!parse_fen(fen, kept) && !parse_epd(fen, kept));
+        assert(board_to_fen(kept) == fen2);
+    }
+    assert(!parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - x 1", kept)); // EPD reads x as an operation
+    UciPosition position;
+    assert(update_uci_position(position, "position startpos moves e2e4"));
+    assert(!update_uci_position(position, "position fen rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"));
+    assert(!update_uci_position(position, "position nonsense"));
+    assert(position.command == "position startpos moves e2e4" && position.history.size() == 2);
+    
+    cout << "✓ FEN/EPD parsing tests passed" << endl;
+}
+
+// Walk the move tree checking the incrementally updated fields against a full recompute
+void check_incremental_tree(const Board& board, int depth) {
+    Board refreshed = board;
+    refresh_board(refreshed);
+    assert(board.hash == refreshed.hash);
+    assert(board.pawn_hash == refreshed.pawn_hash);
+    assert(board.mg_score == refreshed.mg_score);
+    assert(board.eg_score == refreshed.eg_score);
+    assert(board.phase == refreshed.phase);
+    if (depth == 0) return;
+    
+    for (const Move& move : generate_all_legal_moves(board)) {
+        Board temp_board = board;
+        make_move_simple(temp_board, move);
+        check_incremental_tree(temp_board, depth - 1);
+    }
+}
+
+void test_zobrist_hashing() {
+    cout << "Testing Zobrist hashing..." << endl;
+    
+    // Test 1: Incremental updates match a full recompute (castling, en passant, promotions)
+    check_incremental_tree(create_starting_position(), 3);
+    check_incremental_tree(parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"), 2);
+    check_incremental_tree(parse_fen("r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1"), 2);
+    
+    // Test 2: Transpositions reach the same hash
+    Board board1 = parse_uci_position("position startpos moves g1f3 g8f6 b1c3");
+    Board board2 = parse_uci_position("position startpos moves b1c3 g8f6 g1f3");
+    assert(board1.hash == board2.hash);
+    
+    // Test 3: Side to move, castling rights and en passant are part of the key
+    Board board3 = parse_fen("4k3/8/8/8/8/8/8/4K2R w K - 0 1");
+    Board board4 = parse_fen("4k3/8/8/8/8/8/8/4K2R b K - 0 1");
+    Board board5 = parse_fen("4k3/8/8/8/8/8/8/4K2R w - - 0 1");
+    assert(board3.hash != board4.hash);
+    assert(board3.hash != board5.hash);
+    Board board6 = parse_fen("4k3/8/8/8/4P3/8/8/4K3 b - e3 0 1");
+    Board board7 = parse_fen("4k3/8/8/8/4P3/8/8/4K3 b - - 0 1");
+    assert(board6.hash != board7.hash);
+    
+    cout << "✓ Zobrist hashing tests passed" << endl;
+}
+
+void test_incremental_uci_position() {
+    cout << "Testing incremental UCI position updates..." << endl;
+    
+    const string commands[] = {
+        "position startpos",
+        "position startpos moves e2e4",
+        "position startpos moves e2e4 e7e5",
+        "position startpos moves e2e4 e7e5 g1f3 b8c6",
+        "position startpos moves d2d4",                          // Diverges: rebuilt
+        "position fen 4k3/8/8/8/8/8/4P3/4K3 w - - 0 1 moves e2e4", // New base: rebuilt
+        "position fen 4k3/8/8/8/8/8/4P3/4K3 w - - 0 1 moves e2e4 e8d7",
+    };
+    
+    UciPosition position;
+    for (const string& command : commands) {
+        update_uci_position(position, command);
+        
+        // Same result as parsing the command from scratch
+        Board expected = parse_uci_position(command);
+        for (int i = 0; i < 64; i++) {
+            assert(position.board.squares[i] == expected.squares[i]);
+        }
+        assert(position.board.white_to_move == expected.white_to_move);
+        assert(position.board.hash == expected.hash);
+        assert(position.history.back() == expected.hash);
+    }
+    assert(position.history.size() == 3);
+    
+    // History grows by one entry per move when the game is extended
+    update_uci_position(position, "position startpos moves g1f3 g8f6 f3g1 f6g8");
+    assert(position.history.size() == 5);
+    assert(position.history.front() == position.history.back()); // Repetition visible
+    update_uci_position(position, "position startpos moves g1f3 g8f6 f3g1 f6g8 g1f3");
+    assert(position.history.size() == 6);
+    assert(position.history[1] == position.history[5]);
+    
+    cout << "✓ Incremental UCI position tests passed" << endl;
+}
+
+void test_evaluation() {
+    cout << "Testing evaluation..." << endl;
+    
+    // Test 1: Symmetric starting position is level, with full game phase
+    Board board1 = create_starting_position();
+    assert(evaluate_position(board1) == 0);
+    assert(board1.phase == 24);
+    
+    // Test 2: Mirrored positions evaluate the same for the side to move
+    Board board2 = parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    Board board3 = parse_fen("r3k2r/pppbbppp/2n2q1P/1P2p3/3pn3/BN2PNP1/P1PPQPB1/R3K2R b KQkq - 0 1");
+    assert(evaluate_position(board2) == evaluate_position(board3));
+    
+    // Test 3: Material advantage shows up, and the sign follows the side to move
+    Board board4 = parse_fen("4k3/8/8/8/8/8/3PP3/4K3 w - - 0 1");
+    assert(board4.phase == 0);
+    assert(evaluate_position(board4) > 50);
+    Board board5 = parse_fen("4k3/8/8/8/8/8/3PP3/4K3 b - - 0 1");
+    assert(evaluate_position(board5) == -evaluate_position(board4));
+    
+    // Test 4: Incremental sums follow captures, castling, en passant and promotion
+    check_incremental_tree(parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"), 2);
+    check_incremental_tree(parse_fen("rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8"), 2);
+    
+    cout << "✓ Evaluation tests passed" << endl;
+}
+
+void test_pawn_structure() {
+    cout << "Testing pawn structure evaluation..." << endl;
+    
+    // Test 1: Passed pawns are found for both sides
+    Board board1 = parse_fen("4k3/8/3p4/8/8/8/P3P3/4K3 w - - 0 1");
+    PawnEntry entry1 = evaluate_pawn_structure(board1);
+    assert(entry1.passed[0] == (1ULL << string_to_square("a2"))); // e2 is blocked by the d6 pawn's file
+    assert(entry1.passed[1] == 0);
+    
+    Board board2 = parse_fen("4k3/8/8/8/8/p7/8/4K3 w - - 0 1");
+    PawnEntry entry2 = evaluate_pawn_structure(board2);
+    assert(entry2.passed[1] == (1ULL << string_to_square("a3")));
+    assert(entry2.eg_score < 0); // Black's advanced passed pawn
+    
+    // Test 2: Doubled and isolated pawns are penalised
+    Board healthy = parse_fen("4k3/pppp4/8/8/8/8/PPPP4/4K3 w - - 0 1");
+    Board weak = parse_fen("4k3/pppp4/8/8/8/2P5/P1P1P3/4K3 w - - 0 1");
+    assert(evaluate_pawn_structure(healthy).mg_score == 0);
+    assert(evaluate_pawn_structure(weak).eg_score < 0);
+    
+    // Test 3: Mirrored pawn structures score opposite
+    Board board3 = parse_fen("4k3/pp3p2/2p5/3P4/8/8/PP3PPP/4K3 w - - 0 1");
+    Board board4 = parse_fen("4k3/pp3ppp/8/8/3p4/2P5/PP3P2/4K3 b - - 0 1");
+    PawnEntry entry3 = evaluate_pawn_structure(board3);
+    PawnEntry entry4 = evaluate_pawn_structure(board4);
+    assert(entry3.mg_score == -entry4.mg_score && entry3.eg_score == -entry4.eg_score);
+    
+    // Test 4: The pawn table serves repeats and matches the uncached evaluation
+    SearchContext context;
+    Board board5 = parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    for (const Move& move : generate_all_legal_moves(board5)) {
+        Board temp_board = board5;
+        make_move_simple(temp_board, move);
+        assert(evaluate_position(temp_board, context) == evaluate_position(temp_board));
+    }
+    assert(context.pawn_table.probes == generate_all_legal_moves(board5).size());
+    assert(context.pawn_table.hit_rate() > 0.5); // Most moves leave the pawns alone
+    
+    cout << "✓ Pawn structure tests passed" << endl;
+}
+
+void test_evaluate_batch() {
+    cout << "Testing batched evaluation..." << endl;
+    
+    // Test 1: Every position two plies from a few varied roots scores the same
+    // as evaluate_position; 7 roots plus children leave a batch that is not a
+    // multiple of four
+    const char* fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "8/5pk1/6p1/1P5p/P6P/6P1/5PK1/8 b - - 0 40",
+        "4k3/8/8/8/8/8/4P3/4K3 b - - 0 1",
+    };
+    vector<Board> boards;
+    for (const char* fen : fens) {
+        Board root = parse_fen(fen);
+        boards.push_back(root);
+        for (const Move& move : generate_all_legal_moves(root)) {
+            Board child = root;
+            make_move_simple(child, move);
+            boards.push_back(child);
+            for (const Move& reply : generate_all_legal_moves(child)) {
+                Board grandchild = child;
+                make_move_simple(grandchild, reply);
+                boards.push_back(grandchild);
+            }
+        }
+    }
+    vector<int> scores(boards.size(), 0);
+    evaluate_batch(boards.data(), boards.size(), scores.data());
+    for (size_t i = 0; i < boards.size(); i++) {
+        assert(scores[i] == evaluate_position(boards[i]));
+    }
+    
+    // Test 2: Short batches take the remainder path only
+    int short_scores[3] = {0, 0, 0};
+    evaluate_batch(boards.data() + 1, 3, short_scores);
+    for (int i = 0; i < 3; i++) {
+        assert(short_scores[i] == evaluate_position(boards[1 + i]));
+    }
+    evaluate_batch(boards.data(), 0, nullptr);
+    
+    cout << "✓ Batched evaluation tests passed" << endl;
+}
+
+// White-relative score rebuilt from an evaluation trace and eval_params.h
+int score_from_trace(const EvalTrace& trace) {
+    int mg = 0, eg = 0;
+    for (int type = 1; type <= 6; type++) {
+        mg += trace.pieces[type] * mg_piece_values[type];
+        eg += trace.pieces[type] * eg_piece_values[type];
+        for (int index = 0; index < 64; index++) {
+            mg += trace.pst[type][index] * mg_pst[type][index];
+            eg += trace.pst[type][index] * eg_pst[type][index];
+        }
+    }
+    mg -= trace.doubled_pawns * doubled_pawn_penalty[0] + trace.isolated_pawns * isolated_pawn_penalty[0] +
+          trace.backward_pawns * backward_pawn_penalty[0];
+    eg -= trace.doubled_pawns * doubled_pawn_penalty[1] + trace.isolated_pawns * isolated_pawn_penalty[1] +
+          trace.backward_pawns * backward_pawn_penalty[1];
+    for (int rank = 0; rank < 8; rank++) {
+        mg += trace.passed_pawns[rank] * passed_pawn_bonus[0][rank];
+        eg += trace.passed_pawns[rank] * passed_pawn_bonus[1][rank];
+    }
+    mg += trace.shield_pawns[0] * pawn_shield_bonus[0] + trace.shield_pawns[1] * pawn_shield_bonus[1];
+    return (mg * trace.phase + eg * (max_phase - trace.phase)) / max_phase;
+}
+
+void test_evaluation_trace() {
+    cout << "Testing evaluation trace..." << endl;
+    
+    // Test 1: Starting position counts cancel out
+    EvalTrace trace;
+    trace_evaluation(create_starting_position(), trace);
+    assert(trace.phase == 24 && trace.pieces[1] == 0 && trace.shield_pawns[0] == 0);
+    
+    // Test 2: Counts are white minus black
+    trace_evaluation(parse_fen("4k3/8/8/3P4/8/8/P1P5/4K3 b - - 0 1"), trace);
+    assert(trace.pieces[1] == 3 && trace.isolated_pawns == 1 &&
+           trace.passed_pawns[1] == 2 && trace.passed_pawns[4] == 1);
+    
+    // Test 3: The trace reproduces evaluate_position through the move tree
+    const char* fens[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "r1bq1rk1/pp2ppbp/2np1np1/8/3NP3/2N1BP2/PPPQ2PP/R3KB1R w KQ - 3 9",
+    };
+    for (const char* fen : fens) {
+        Board root = parse_fen(fen);
+        for (const Move& move : generate_all_legal_moves(root)) {
+            Board child = root;
+            make_move_simple(child, move);
+            trace_evaluation(child, trace);
+            int score = score_from_trace(trace);
+            assert(evaluate_position(child) == (child.white_to_move ? score : -score));
+        }
+    }
+    
+    cout << "✓ Evaluation trace tests passed" << endl;
+}
+
+void test_eval_cache() {
+    cout << "Testing evaluation cache..." << endl;
+    
+    // Test 1: Stored scores come back, including negative ones
+    EvalCache cache(1);
+    int score = 0;
+    assert(!cache.probe(0x123456789abcdef0ULL, score));
+    cache.store(0x123456789abcdef0ULL, -345);
+    assert(cache.probe(0x123456789abcdef0ULL, score) && score == -345);
+    assert(cache.hits == 1 && cache.evaluations == 1);
+    
+    // Test 2: A different key in the same slot misses
+    assert(!cache.probe(0xfedcba987654def0ULL, score));
+    
+    // Test 3: A disabled cache never hits
+    cache.resize(0);
+    cache.store(0x123456789abcdef0ULL, 10);
+    assert(!cache.probe(0x123456789abcdef0ULL, score));
+    
+    // Test 4: Cached evaluation matches the full evaluation through transpositions
+    SearchContext context;
+    const char* commands[] = {
+        "position startpos moves g1f3 g8f6 b1c3",
+        "position startpos moves b1c3 g8f6 g1f3",
+        "position startpos moves b1c3 g8f6 g1f3 b8c6",
+    };
+    for (const char* command : commands) {
+        Board board = parse_uci_position(command);
+        assert(evaluate_position(board, context) == evaluate_position(board));
+    }
+    assert(context.eval_cache.hits == 1);
+    assert(context.eval_cache.evaluations == 2);
+    
+    cout << "✓ Evaluation cache tests passed" << endl;
+}
+
+// Walk the move tree checking incremental accumulator updates against a refresh
+void check_nnue_tree(const NnueNetwork& network, const Board& board,
+                     const NnueAccumulator& accumulator, int depth) {
+    NnueAccumulator refreshed;
+    network.refresh(board, refreshed);
+    assert(memcmp(refreshed.values, accumulator.values, sizeof(refreshed.values)) == 0);
+    assert(refreshed.king_squares[0] == accumulator.king_squares[0] &&
+           refreshed.king_squares[1] == accumulator.king_squares[1]);
+    if (depth == 0) return;
+    
+    for (const Move& move : generate_all_legal_moves(board)) {
+        Board temp_board = board;
+        make_move_simple(temp_board, move);
+        NnueAccumulator child;
+        network.update(board, move, accumulator, temp_board, child);
+        check_nnue_tree(network, temp_board, child, depth - 1);
+    }
+}
+
+void test_nnue() {
+    cout << "Testing NNUE evaluation (" << nnue_simd_name() << ")..." << endl;
+    
+    NnueNetwork network;
+    network.randomize(12345);
+    
+    // Test 1: Incremental updates match a refresh (captures, castling, en passant, promotions)
+    const char* fens[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    };
+    for (const char* fen : fens) {
+        Board board = parse_fen(fen);
+        NnueAccumulator accumulator;
+        network.refresh(board, accumulator);
+        check_nnue_tree(network, board, accumulator, 2);
+    }
+    
+    // Test 2: Both perspectives are symmetric, so mirrored positions score the same
+    Board board1 = parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    Board board2 = parse_fen("r3k2r/pppbbppp/2n2q1P/1P2p3/3pn3/BN2PNP1/P1PPQPB1/R3K2R b KQkq - 0 1");
+    NnueAccumulator accumulator1, accumulator2;
+    network.refresh(board1, accumulator1);
+    network.refresh(board2, accumulator2);
+    assert(network.evaluate(accumulator1, true) == network.evaluate(accumulator2, false));
+    
+    // Test 3: Save and load round trip; malformed files are rejected
+    string path = "/tmp/agent4k_test.nnue";
+    assert(network.save(path));
+    NnueNetwork loaded;
+    assert(loaded.load(path));
+    NnueAccumulator accumulator3;
+    loaded.refresh(board1, accumulator3);
+    assert(loaded.evaluate(accumulator3, true) == network.evaluate(accumulator1, true));
+    FILE* file = fopen(path.c_str(), "wb");
+    fputs("not a network", file);
+    fclose(file);
+    assert(!loaded.load(path));
+    assert(!loaded.load("/nonexistent/agent4k.nnue"));
+    remove(path.c_str());
+    
+    // Test 4: Search uses the network through the accumulator stack
+    SearchContext context;
+    context.network = &network;
+    Move best = search_best_move(board1, 2, vector<uint64_t>(1, board1.hash), context);
+    assert(is_legal_move(board1, best));
+    assert(context.nodes > 0);
+    
+    cout << "✓ NNUE evaluation tests passed" << endl;
+}
+
+void test_search_limits() {
+    cout << "Testing search limits..." << endl;
+    
+    SearchContext context;
+    Board start = create_starting_position();
+    vector<uint64_t> history(1, start.hash);
+    
+    // Test 1: A depth limit completes exactly that many iterations
+    SearchResult result = search(start, SearchLimits{2, 0, 0}, history, context);
+    assert(result.depth == 2 && result.nodes == context.nodes);
+    assert(result.best_move.from != result.best_move.to);
+    
+    // Test 2: A node limit stops within the iteration it interrupts, keeping
+    // the last completed one
+    result = search(start, SearchLimits{0, 500, 0}, history, context);
+    assert(result.depth == 2 && result.nodes <= 500);
+    
+    // Test 3: The first iteration completes even under a tiny node limit
+    result = search(start, SearchLimits{0, 1, 0}, history, context);
+    assert(result.depth == 1 && result.best_move.from != result.best_move.to);
+    
+    // Test 4: Mate in one is found with a mate score; a mated side has no move
+    Board board = parse_fen("r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4");
+    result = search(board, SearchLimits{2, 0, 0}, vector<uint64_t>(1, board.hash), context);
+    assert(move_to_uci(result.best_move) == "h5f7" && result.score == mate_score - 1);
+    make_move_simple(board, result.best_move);
+    result = search(board, SearchLimits{2, 0, 0}, vector<uint64_t>(1, board.hash), context);
+    assert(result.best_move.from == result.best_move.to && result.score == -mate_score);
+    
+    // Test 5: Of several mates the nearest is played and scored by its
+    // distance, also when the transposition table supplies the scores
+    board = parse_fen("7k/8/6K1/8/8/8/8/Q7 w - - 0 1");
+    TranspositionTable table(1);
+    context.tt = &table;
+    for (int pass = 0; pass < 2; pass++) {
+        result = search(board, SearchLimits{5, 0, 0}, vector<uint64_t>(1, board.hash), context);
+        assert(result.score == mate_score - 1 && mate_in_moves(result.score) == 1);
+    }
+    context.tt = nullptr;
+    make_move_simple(board, result.best_move);
+    assert(generate_all_legal_moves(board).empty() && is_in_check(board, false));
+    assert(mate_in_moves(mate_score - 3) == 2 && mate_in_moves(-(mate_score - 4)) == -2);
+    assert(mate_in_moves(tablebase_win_score) == 0 && mate_in_moves(-350) == 0);
+    
+    cout << "✓ Search limit tests passed" << endl;
+}
+
+void test_engine() {
+    cout << "Testing engine objects..." << endl;
+    
+    Board start = create_starting_position();
+    Board kiwipete = parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    vector<uint64_t> start_history(1, start.hash), kiwipete_history(1, kiwipete.hash);
+    SearchLimits limits = {4, 0, 0};
+    
+    // Test 1: Engines share nothing, so two searching at once give the
+    // same results as each searching alone
+    Engine first, second;
+    SearchResult alone[2] = {first.search(start, limits, start_history),
+                             second.search(kiwipete, limits, kiwipete_history)};
+    first.new_game();
+    second.new_game();
+    SearchResult together[2];
+    thread other([&]() { together[1] = second.search(kiwipete, limits, kiwipete_history); });
+    together[0] = first.search(start, limits, start_history);
+    other.join();
+    for (int i = 0; i < 2; i++) {
+        assert(move_to_uci(alone[i].best_move) == move_to_uci(together[i].best_move));
+        assert(alone[i].score == together[i].score && alone[i].nodes == together[i].nodes);
+    }
+    
+    // Test 2: The principal variation starts with the best move and is
+    // playable; the transposition table carries results over to the next
+    // search
+    Board line = kiwipete;
+    assert(!alone[1].pv.empty() && alone[1].pv.size() <= 4);
+    assert(move_to_uci(alone[1].pv[0]) == move_to_uci(alone[1].best_move));
+    for (const Move& move : alone[1].pv) {
+        vector<Move> legal = generate_all_legal_moves(line);
+        assert(any_of(legal.begin(), legal.end(), [&](const Move& m) { return move_to_uci(m) == move_to_uci(move); }));
+        make_move_simple(line, move);
+    }
+    SearchResult again = first.search(start, limits, start_history);
+    assert(again.depth == 4 && again.nodes < together[0].nodes);
+    assert(first.hashfull() >= 0);
+    
+    // Test 3: Helper threads search along; the main thread's limits still apply
+    EngineOptions options;
+    options.threads = 3;
+    options.hash = 4;
+    Engine parallel(options);
+    SearchResult result = parallel.search(kiwipete, limits, kiwipete_history);
+    assert(result.depth == 4 && is_legal_move(kiwipete, result.best_move));
+    result = parallel.search(kiwipete, SearchLimits{0, 3000, 0}, kiwipete_history);
+    assert(result.depth >= 1 && is_legal_move(kiwipete, result.best_move));
+    
+    // Test 4: stop() from another thread ends an unlimited search with the
+    // last completed iteration
+    atomic<bool> returned(false);
+    thread stopper([&]() {
+        while (!returned) {
+            this_thread::sleep_for(chrono::milliseconds(50));
+            parallel.stop();
+        }
+    });
+    result = parallel.search(start, SearchLimits{0, 0, 0}, start_history);
+    returned = true;
+    stopper.join();
+    assert(result.depth >= 1 && is_legal_move(start, result.best_move));
+    
+    cout << "✓ Engine tests passed" << endl;
+}
+
+// Score stored for a key in the shared table test, so a reader can tell
+// whether an entry's data belongs to its key
+static int shared_test_score(uint64_t key) {
+    return int(key * 0x9e3779b97f4a7c15ULL >> 50) - 4096;
+}
+
+void test_shared_transposition_table() {
+    cout << "Testing shared transposition table..." << endl;
+    
+    string name = "/agent4k_test_tt_" + to_string(getpid());
+    shm_unlink(name.c_str());
+    TranspositionTable table(0);
+    assert(table.attach_shared(name, 1) && table.is_shared());
+    
+    // Test 1: Two processes hammer the same few buckets at once; every hit
+    // either process reads carries the data written for its key
+    pid_t child = fork();
+    assert(child >= 0);
+    bool child_process = child == 0;
+    TranspositionTable attached(0);
+    TranspositionTable& mine = child_process ? attached : table;
+    bool ok = !child_process || attached.attach_shared(name, 64);
+    mt19937_64 rng(child_process ? 2 : 1);
+    for (int i = 0; i < 200000 && ok; i++) {
+        uint64_t key = (rng() % 64) << 40 | (rng() % 8); // 8 buckets, 64 keys each
+        if (i % 2 == 0) {
+            mine.store(key, Move(int(key % 64), int(key % 64) ^ int(key % 63 + 1)), shared_test_score(key), int(key % 50),
+                       bound_exact);
+        } else {
+            TTHit hit;
+            if (mine.probe(key, hit)) {
+                ok = hit.score == shared_test_score(key) && hit.depth == int(key % 50) && hit.bound == bound_exact &&
+                     hit.move.from == int(key % 64) && hit.move.to == (int(key % 64) ^ int(key % 63 + 1));
+            }
+        }
+    }
+    if (child_process) {
+        // The child also leaves a search behind for the parent
+        EngineOptions options;
+        options.shared_hash = name;
+        Engine engine(options);
+        Board board = parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+        ok = ok && engine.hash_shared() && engine.search(board, SearchLimits{4, 0, 0}, vector<uint64_t>(1, board.hash)).depth == 4;
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    assert(waitpid(child, &status, 0) == child);
+    assert(ok && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    
+    // Test 2: A second process's search is reused: the same search in
+    // this process needs far fewer nodes than with a private table
+    Board board = parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    vector<uint64_t> history(1, board.hash);
+    Engine fresh;
+    EngineOptions options;
+    options.shared_hash = name;
+    Engine sharing(options);
+    assert(sharing.hash_shared());
+    uint64_t private_nodes = fresh.search(board, SearchLimits{4, 0, 0}, history).nodes;
+    uint64_t shared_nodes = sharing.search(board, SearchLimits{4, 0, 0}, history).nodes;
+    assert(shared_nodes * 4 < private_nodes);
+    
+    // Test 3: ucinewgame leaves the shared table alone, and attaching with
+    // another size maps the existing segment
+    sharing.new_game();
+    assert(sharing.search(board, SearchLimits{4, 0, 0}, history).nodes == shared_nodes);
+    TranspositionTable other(0);
+    assert(other.attach_shared(name, 512) && other.is_shared());
+    shm_unlink(name.c_str());
+    
+    // Test 4: A segment whose header claims more buckets than it holds is
+    // refused, even when the claimed size overflows
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    assert(fd >= 0 && ftruncate(fd, 4096) == 0);
+    char forged[16] = {'A', '4', 'K', 'T', 'T', 'S', 'H', '1'};
+    uint64_t forged_count = 1ULL << 58;
+    memcpy(forged + 8, &forged_count, sizeof(forged_count));
+    assert(pwrite(fd, forged, sizeof(forged), 0) == ssize_t(sizeof(forged)));
+    close(fd);
+    TranspositionTable forged_table(0);
+    assert(!forged_table.attach_shared(name, 1) && !forged_table.is_shared());
+    shm_unlink(name.c_str());
+    
+    cout << "✓ Shared transposition table tests passed" << endl;
+}
+
+void test_transposition_table_file() {
+    cout << "Testing transposition table files..." << endl;
+    
+    Board board = parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    vector<uint64_t> history(1, board.hash);
+    string path = "/tmp/agent4k_test.hash";
+    
+    // Test 1: A saved table resumes the search in another engine, which
+    // takes the file's size
+    EngineOptions options;
+    options.hash = 2;
+    Engine saving(options);
+    uint64_t first_nodes = saving.search(board, SearchLimits{4, 0, 0}, history).nodes;
+    assert(saving.save_hash(path));
+    Engine loading;
+    assert(loading.load_hash(path));
+    SearchResult resumed = loading.search(board, SearchLimits{4, 0, 0}, history);
+    assert(resumed.depth == 4 && resumed.nodes * 4 < first_nodes);
+    
+    // Test 2: Searching a loaded table does not change the file
+    Engine reloaded;
+    assert(reloaded.load_hash(path));
+    assert(reloaded.search(board, SearchLimits{4, 0, 0}, history).nodes == resumed.nodes);
+    
+    // Test 3: Saving over a loaded file leaves its mappings intact
+    assert(reloaded.save_hash(path));
+    assert(reloaded.search(board, SearchLimits{4, 0, 0}, history).nodes == resumed.nodes);
+    
+    // Test 4: Missing and malformed files are rejected, keeping the table;
+    // ucinewgame empties a loaded table
+    remove(path.c_str()); // Replace rather than truncate the mapped file
+    FILE* file = fopen(path.c_str(), "wb");
+    fputs("not a table", file);
+    fclose(file);
+    assert(!loading.load_hash(path));
+    assert(!loading.load_hash("/nonexistent/agent4k.hash"));
+    remove(path.c_str());
+    char forged[64] = {'A', '4', 'K', 'T', 'T', 'F', 'L', '1'};
+    uint64_t forged_count = 1ULL << 58; // Times 64-byte buckets wraps to 0
+    memcpy(forged + 8, &forged_count, sizeof(forged_count));
+    file = fopen(path.c_str(), "wb");
+    fwrite(forged, 1, sizeof(forged), file);
+    fclose(file);
+    assert(!loading.load_hash(path));
+    assert(loading.search(board, SearchLimits{4, 0, 0}, history).nodes == resumed.nodes);
+    loading.new_game();
+    assert(loading.search(board, SearchLimits{4, 0, 0}, history).nodes == first_nodes);
+    remove(path.c_str());
+    
+    cout << "✓ Transposition table file tests passed" << endl;
+}
+
+void test_large_buffers() {
+    cout << "Testing large table allocation..." << endl;
+    
+    // Test 1: Buffers are zeroed and cache-line aligned whatever pages they
+    // get; small ones never get huge pages
+    for (size_t size : {size_t(4096), size_t(3 << 20), size_t(16 << 20)}) {
+        for (bool huge : {false, true}) {
+            LargeBuffer buffer;
+            assert(buffer.allocate(size, huge) && buffer.size() == size);
+            const unsigned char* bytes = static_cast<const unsigned char*>(buffer.data());
+            assert(uintptr_t(bytes) % 64 == 0);
+            assert(bytes[0] == 0 && bytes[size / 2] == 0 && bytes[size - 1] == 0);
+            assert(huge || buffer.pages() == pages_normal);
+            assert(size >= (2 << 20) || buffer.pages() == pages_normal);
+            
+            memset(buffer.data(), 0xab, size);
+            buffer.zero();
+            assert(bytes[0] == 0 && bytes[size - 1] == 0);
+        }
+    }
+    
+    // Test 2: Tables work on either kind of pages
+    TranspositionTable table(0);
+    assert(table.megabytes() == 0);
+    for (bool huge : {false, true}) {
+        table.resize(8, huge);
+        assert(table.megabytes() == 8);
+        assert(huge || table.pages() == pages_normal);
+        table.store(12345, Move(12, 28), 42, 3, bound_exact);
+        TTHit hit;
+        assert(table.probe(12345, hit) && hit.score == 42 && hit.move.to == 28);
+        table.clear();
+        assert(!table.probe(12345, hit));
+    }
+    table.resize(3, false);
+    assert(table.megabytes() == 2); // Rounded down to a power of two
+    EvalCache cache(0);
+    cache.resize(4, true);
+    cache.store(777, -15);
+    int score = 0;
+    assert(cache.probe(777, score) && score == -15);
+    
+    cout << "✓ Large table allocation tests passed" << endl;
+}
+
+void test_polyglot_book() {
+    cout << "Testing Polyglot opening books..." << endl;
+    
+    // Test 1: Keys match the reference positions of the Polyglot format,
+    // including en passant only counting when a capture is possible
+    struct { const char* fen; uint64_t key; } references[] = {
+        {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 0x463b96181691fc9cULL},
+        {"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", 0x823c9b50fd114196ULL},
+        {"rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2", 0x0756b94461c50fb0ULL},
+        {"rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2", 0x662fafb965db29d4ULL},
+        {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", 0x22a48b5a8e47ff78ULL},
+        {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3", 0x652a607ca3f242c1ULL},
+        {"rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4", 0x00fdd303c946bdd9ULL},
+        {"rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3", 0x3c8123ea7b067637ULL},
+        {"rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4", 0x5c3f9b829b279560ULL},
+    };
+    for (const auto& reference : references) {
+        assert(polyglot_key(parse_fen(reference.fen)) == reference.key);
+    }
+    
+    // Test 2: Castling is encoded as the king taking its rook, and
+    // promotions and ordinary moves round-trip
+    Board castling = parse_fen("r3k2r/1P6/8/8/8/8/8/R3K2R w KQkq - 0 1");
+    assert(polyglot_move(uci_to_move(castling, "e1g1")) == (7 | 0 << 3 | 4 << 6 | 0 << 9));
+    for (const char* uci : {"e1g1", "e1c1", "e1f1", "a1a8", "b7b8q", "b7a8n"}) {
+        Move move = uci_to_move(castling, uci);
+        assert(move_to_uci(decode_polyglot_move(polyglot_move(move), castling)) == uci);
+    }
+    
+    // Test 3: A book sorted by key finds every move of a position between
+    // other positions' entries, skipping illegal ones
+    Board start = create_starting_position();
+    Board after_e4 = start;
+    make_move_simple(after_e4, uci_to_move(start, "e2e4"));
+    struct { Board board; const char* move; int weight; } entries[] = {
+        {start, "e2e4", 30}, {start, "d2d4", 10}, {start, "e2e5", 50}, {start, "g1f3", 0},
+        {after_e4, "e7e5", 5}, {after_e4, "c7c5", 7},
+    };
+    vector<array<uint8_t, 16>> records;
+    for (const auto& entry : entries) {
+        uint64_t key = polyglot_key(entry.board);
+        uint16_t move = polyglot_move(uci_to_move(entry.board, entry.move));
+        array<uint8_t, 16> record = {};
+        for (int i = 0; i < 8; i++) record[i] = uint8_t(key >> (56 - 8 * i));
+        record[8] = uint8_t(move >> 8);
+        record[9] = uint8_t(move);
+        record[10] = uint8_t(entry.weight >> 8);
+        record[11] = uint8_t(entry.weight);
+        records.push_back(record);
+    }
+    stable_sort(records.begin(), records.end(), [](const array<uint8_t, 16>& a, const array<uint8_t, 16>& b) {
+        return memcmp(a.data(), b.data(), 8) < 0;
+    });
+    string path = "/tmp/agent4k_test_book.bin";
+    FILE* file = fopen(path.c_str(), "wb");
+    for (const array<uint8_t, 16>& record : records) fwrite(record.data(), 1, record.size(), file);
+    fclose(file);
+    
+    PolyglotBook book;
+    assert(book.open(path) && book.size() == 6);
+    vector<BookMove> moves = book.moves(start);
+    assert(moves.size() == 3); // e2e5 is illegal
+    assert(move_to_uci(moves[0].move) == "e2e4" && moves[0].weight == 30);
+    assert(move_to_uci(moves[1].move) == "d2d4" && moves[2].weight == 0);
+    assert(book.moves(after_e4).size() == 2);
+    assert(book.moves(parse_fen("8/8/4k3/8/8/3K4/8/8 w - - 0 1")).empty());
+    
+    // Test 4: Best-move selection takes the heaviest move; weighted selection
+    // follows the weights and never plays a zero-weight move
+    mt19937_64 rng(1);
+    assert(move_to_uci(book.choose(start, true, rng)) == "e2e4");
+    int e4 = 0, d4 = 0;
+    for (int i = 0; i < 4000; i++) {
+        string move = move_to_uci(book.choose(start, false, rng));
+        assert(move == "e2e4" || move == "d2d4");
+        (move == "e2e4" ? e4 : d4)++;
+    }
+    assert(e4 > 2 * d4 && e4 < 4 * d4);
+    Move none = book.choose(parse_fen("8/8/4k3/8/8/3K4/8/8 w - - 0 1"), false, rng);
+    assert(none.from == none.to);
+    
+    // Test 5: Files that are not whole entries are refused
+    file = fopen(path.c_str(), "ab");
+    fputc(0, file);
+    fclose(file);
+    assert(!book.open(path) && !book.is_open());
+    remove(path.c_str());
+    
+    cout << "✓ Polyglot opening book tests passed" << endl;
+}
+
+// Write a Syzygy table whose every position stores the same value, one
+// section per side to move: the header, pieces K, Q, k and the single
+// values, padded to the format's 64-byte multiple plus 16
+static void write_single_value_table(const string& path, bool dtz, const vector<uint8_t>& values) {
+    vector<uint8_t> bytes;
+    if (dtz) {
+        bytes = {0xd7, 0x66, 0x0c, 0xa5, 0x00};
+    } else {
+        bytes = {0x71, 0xe8, 0x23, 0x5d, 0x01}; // Split: KQvK differs from KvKQ
+    }
+    bytes.push_back(0x00);                      // Leading group first
+    for (uint8_t piece : {0x66, 0x55, 0xee}) bytes.push_back(piece);
+    bytes.push_back(0x00);                      // Word alignment
+    for (uint8_t value : values) {
+        bytes.push_back(0x80);                  // Single value, white to move stored first
+        bytes.push_back(value);
+    }
+    bytes.resize(80, 0);
+    FILE* file = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+}
+
+// Append a little-endian integer of size bytes
+static void append_le(vector<uint8_t>& bytes, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) bytes.push_back(uint8_t(value >> (8 * i)));
+}
+
+// One compressed section of a test table, in the parts the format lays
+// out apart: the sizes with the symbol tree, the sparse index, the block
+// lengths and the coded blocks
+struct TestTableSection {
+    vector<uint8_t> sizes;
+    vector<uint8_t> sparse_index;
+    vector<uint8_t> block_lengths;
+    vector<uint8_t> blocks;
+};
+
+// Compress a section's values as the generator does: a leaf symbol per
+// value, two rounds pairing the most frequent neighbouring symbols, and
+// canonical Huffman codes with the longest codes numbered first, in blocks
+// of 2^block_bits bytes with a sparse index entry every 2^span_bits
+// positions
+static TestTableSection compress_test_section(const vector<uint8_t>& values, uint8_t flags,
+                                              int block_bits, int span_bits) {
+    struct Symbol {
+        int left, right; // Child symbols, or the value and 0xfff for a leaf
+        int values;      // Positions it expands to
+    };
+    vector<Symbol> symbols;
+    vector<int> leaf(256, -1);
+    vector<int> tokens;
+    for (uint8_t value : values) {
+        if (leaf[value] < 0) {
+            leaf[value] = int(symbols.size());
+            symbols.push_back({value, 0xfff, 1});
+        }
+        tokens.push_back(leaf[value]);
+    }
+    if (symbols.size() == 1) symbols.push_back({values[0] ^ 1, 0xfff, 1}); // Codes need two symbols
+    
+    for (int round = 0; round < 2; round++) {
+        size_t n = symbols.size();
+        vector<int> counts(n * n, 0);
+        for (size_t i = 0; i + 1 < tokens.size(); i += 2) counts[tokens[i] * n + tokens[i + 1]]++;
+        vector<int> pair_symbol(n * n, -1);
+        for (int chosen = 0; chosen < 4; chosen++) {
+            size_t best = max_element(counts.begin(), counts.end()) - counts.begin();
+            if (counts[best] < 2) break;
+            counts[best] = 0;
+            pair_symbol[best] = int(symbols.size());
+            symbols.push_back({int(best / n), int(best % n), symbols[best / n].values + symbols[best % n].values});
+        }
+        vector<int> paired;
+        for (size_t i = 0; i < tokens.size(); i++) {
+            int symbol = i + 1 < tokens.size() ? pair_symbol[tokens[i] * n + tokens[i + 1]] : -1;
+            if (symbol >= 0) {
+                paired.push_back(symbol);
+                i++;
+            } else {
+                paired.push_back(tokens[i]);
+            }
+        }
+        tokens.swap(paired);
+    }
+    
+    // Huffman code lengths for every symbol, as pairs refer to symbols
+    // that may never be coded on their own
+    size_t count = symbols.size();
+    vector<uint64_t> weight(count, 0);
+    for (int token : tokens) weight[token]++;
+    vector<int> parent(count, -1);
+    vector<int> open(count);
+    for (size_t i = 0; i < count; i++) open[i] = int(i);
+    while (open.size() > 1) {
+        sort(open.begin(), open.end(), [&](int a, int b) { return weight[a] > weight[b]; });
+        int a = open.back();
+        open.pop_back();
+        int b = open.back();
+        open.pop_back();
+        parent[a] = parent[b] = int(weight.size());
+        open.push_back(int(weight.size()));
+        weight.push_back(weight[a] + weight[b]);
+        parent.push_back(-1);
+    }
+    vector<int> length(count, 0);
+    for (size_t i = 0; i < count; i++) {
+        for (int node = int(i); parent[node] >= 0; node = parent[node]) length[i]++;
+    }
+    
+    // Canonical numbering: longest codes first, each length's codes
+    // starting from the base left after the longer ones
+    vector<int> order(count);
+    for (size_t i = 0; i < count; i++) order[i] = int(i);
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return length[a] > length[b]; });
+    vector<int> number(count);
+    for (size_t i = 0; i < count; i++) number[order[i]] = int(i);
+    int max_length = length[order.front()], min_length = length[order.back()];
+    vector<int> lowest(max_length + 1, 0), base(max_length + 1, 0), per_length(max_length + 2, 0);
+    for (int l : length) per_length[l]++;
+    for (int l = max_length - 1; l >= min_length; l--) {
+        lowest[l] = lowest[l + 1] + per_length[l + 1];
+        assert((base[l + 1] + per_length[l + 1]) % 2 == 0);
+        base[l] = (base[l + 1] + per_length[l + 1]) / 2;
+    }
+    
+    // Blocks are filled with whole codes, most significant bit first
+    size_t block_size = size_t(1) << block_bits;
+    TestTableSection section;
+    vector<size_t> block_start;
+    size_t bit = block_size * 8, position = 0;
+    for (int token : tokens) {
+        int bits = length[token];
+        uint64_t code = uint64_t(base[bits] + number[token] - lowest[bits]);
+        if (bit + bits > block_size * 8) {
+            block_start.push_back(position);
+            section.blocks.resize(section.blocks.size() + block_size, 0);
+            bit = 0;
+        }
+        uint8_t* block = section.blocks.data() + section.blocks.size() - block_size;
+        for (int i = bits - 1; i >= 0; i--, bit++) {
+            if (code >> i & 1) block[bit / 8] |= uint8_t(0x80 >> bit % 8);
+        }
+        position += symbols[token].values;
+    }
+    for (size_t i = 0; i < block_start.size(); i++) {
+        size_t end = i + 1 < block_start.size() ? block_start[i + 1] : values.size();
+        append_le(section.block_lengths, end - block_start[i] - 1, 2);
+    }
+    
+    // Each span's entry locates its middle position, past the last block
+    // for the final span
+    size_t span = size_t(1) << span_bits;
+    for (size_t middle = span / 2; middle - span / 2 < values.size(); middle += span) {
+        size_t block = upper_bound(block_start.begin(), block_start.end(), middle) - block_start.begin() - 1;
+        assert(middle - block_start[block] < 65536);
+        append_le(section.sparse_index, block, 4);
+        append_le(section.sparse_index, middle - block_start[block], 2);
+    }
+    
+    section.sizes = {flags, uint8_t(block_bits), uint8_t(span_bits), 0};
+    append_le(section.sizes, block_start.size(), 4);
+    section.sizes.push_back(uint8_t(max_length));
+    section.sizes.push_back(uint8_t(min_length));
+    for (int l = min_length; l <= max_length; l++) append_le(section.sizes, lowest[l], 2);
+    append_le(section.sizes, count, 2);
+    for (int symbol : order) {
+        const Symbol& s = symbols[symbol];
+        int left = s.right == 0xfff ? s.left : number[s.left];
+        int right = s.right == 0xfff ? 0xfff : number[s.right];
+        section.sizes.push_back(uint8_t(left));
+        section.sizes.push_back(uint8_t(left >> 8 | (right & 0xf) << 4));
+        section.sizes.push_back(uint8_t(right >> 4));
+    }
+    if (count & 1) section.sizes.push_back(0);
+    return section;
+}
+
+// Write a compressed Syzygy table: the header lists the pieces, in table
+// order and the same for both sides to move, once per file of the leading
+// pawn; sections go by file, then by side to move
+static void write_test_table(const string& path, bool dtz, bool split, bool pawns,
+                             const vector<uint8_t>& pieces, const vector<TestTableSection>& sections) {
+    vector<uint8_t> bytes;
+    if (dtz) {
+        bytes = {0xd7, 0x66, 0x0c, 0xa5};
+    } else {
+        bytes = {0x71, 0xe8, 0x23, 0x5d};
+    }
+    bytes.push_back(uint8_t(split | pawns << 1));
+    for (int file = 0; file < (pawns ? 4 : 1); file++) {
+        bytes.push_back(0x00);                  // Leading group first
+        for (uint8_t piece : pieces) bytes.push_back(uint8_t(piece | piece << 4));
+    }
+    if (bytes.size() & 1) bytes.push_back(0x00);
+    for (const TestTableSection& section : sections) bytes.insert(bytes.end(), section.sizes.begin(), section.sizes.end());
+    for (const TestTableSection& section : sections) {
+        bytes.insert(bytes.end(), section.sparse_index.begin(), section.sparse_index.end());
+    }
+    for (const TestTableSection& section : sections) {
+        bytes.insert(bytes.end(), section.block_lengths.begin(), section.block_lengths.end());
+    }
+    for (const TestTableSection& section : sections) {
+        bytes.resize((bytes.size() + 63) & ~size_t(63), 0);
+        bytes.insert(bytes.end(), section.blocks.begin(), section.blocks.end());
+    }
+    bytes.resize(bytes.size() + 8, 0);          // The decoder reads ahead of the last code
+    while (bytes.size() % 64 != 16) bytes.push_back(0);
+    FILE* file = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+}
+
+static uint64_t test_binomial(int n, int k) {
+    if (n < k) return 0;
+    uint64_t result = 1;
+    for (int i = 0; i < k; i++) result = result * uint64_t(n - i) / uint64_t(i + 1);
+    return result;
+}
+
+static int test_off_diagonal(int square) {
+    return square / 8 - square % 8;
+}
+
+// The index of a pawnless position in a table, numbered as the format
+// does but written apart from the decoder: squares in table order, folded
+// so the first lies in the a1-d1-d4 triangle, the leading three unique
+// pieces or two kings placed together, then each further group of like
+// pieces numbered by the squares left free
+static uint64_t pawnless_test_index(vector<int> squares, bool unique_pieces, const vector<int>& group_lengths) {
+    const int triangle[10] = {1, 2, 3, 10, 11, 19, 0, 9, 18, 27}; // Diagonal squares last
+    auto triangle_index = [&](int square) { return int(find(triangle, triangle + 10, square) - triangle); };
+    auto below_diagonal = [](int square) {
+        int index = 0;
+        for (int other = 0; other < square; other++) index += test_off_diagonal(other) < 0;
+        return index;
+    };
+    
+    if (squares[0] % 8 > 3) {
+        for (int& square : squares) square ^= 7;
+    }
+    if (squares[0] / 8 > 3) {
+        for (int& square : squares) square ^= 56;
+    }
+    int leading = unique_pieces ? 3 : 2;
+    for (int i = 0; i < leading; i++) {
+        if (test_off_diagonal(squares[i]) == 0) continue;
+        if (test_off_diagonal(squares[i]) > 0) {
+            for (int& square : squares) square = square % 8 * 8 + square / 8;
+        }
+        break;
+    }
+    
+    uint64_t index;
+    if (unique_pieces) {
+        int s0 = squares[0], s1 = squares[1], s2 = squares[2];
+        int adjust1 = s1 > s0, adjust2 = (s2 > s0) + (s2 > s1);
+        if (test_off_diagonal(s0)) {
+            index = (triangle_index(s0) * 63 + (s1 - adjust1)) * 62 + s2 - adjust2;
+        } else if (test_off_diagonal(s1)) {
+            index = (6 * 63 + s0 / 8 * 28 + below_diagonal(s1)) * 62 + s2 - adjust2;
+        } else if (test_off_diagonal(s2)) {
+            index = 6 * 63 * 62 + 4 * 28 * 62 + s0 / 8 * 7 * 28 + (s1 / 8 - adjust1) * 28 + below_diagonal(s2);
+        } else {
+            index = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + s0 / 8 * 7 * 6 + (s1 / 8 - adjust1) * 6 + s2 / 8 - adjust2;
+        }
+    } else {
+        // The 462 king placements: the second king not above the diagonal
+        // when the first is on it, both on the diagonal numbered last
+        static const vector<int> kings = [&] {
+            vector<int> codes(10 * 64, -1), both_on_diagonal;
+            int code = 0;
+            for (int first = 0; first < 10; first++) {
+                for (int second = 0; second < 64; second++) {
+                    int square = triangle[first];
+                    if (abs(square % 8 - second % 8) <= 1 && abs(square / 8 - second / 8) <= 1) continue;
+                    if (test_off_diagonal(square) == 0 && test_off_diagonal(second) > 0) continue;
+                    if (test_off_diagonal(square) == 0 && test_off_diagonal(second) == 0) {
+                        both_on_diagonal.push_back(first * 64 + second);
+                    } else {
+                        codes[first * 64 + second] = code++;
+                    }
+                }
+            }
+            for (int placement : both_on_diagonal) codes[placement] = code++;
+            assert(code == 462);
+            return codes;
+        }();
+        index = uint64_t(kings[triangle_index(squares[0]) * 64 + squares[1]]);
+    }
+    
+    uint64_t multiplier = unique_pieces ? 31332 : 462;
+    int placed = leading, free_squares = 64 - leading;
+    for (int length : group_lengths) {
+        sort(squares.begin() + placed, squares.begin() + placed + length);
+        uint64_t n = 0;
+        for (int i = 0; i < length; i++) {
+            int square = squares[placed + i];
+            int adjust = int(count_if(squares.begin(), squares.begin() + placed, [&](int other) { return other < square; }));
+            n += test_binomial(square - adjust, i + 1);
+        }
+        index += n * multiplier;
+        multiplier *= test_binomial(free_squares, length);
+        free_squares -= length;
+        placed += length;
+    }
+    return index;
+}
+
+// The index of a KPvK position in the section of the pawn's file, the
+// pawn mirrored onto files a-d: its rank, then each king numbered by the
+// squares left free
+static uint64_t kpk_test_index(int pawn, int king, int other_king, int& file) {
+    if (pawn % 8 > 3) {
+        pawn ^= 7;
+        king ^= 7;
+        other_king ^= 7;
+    }
+    file = pawn % 8;
+    return uint64_t(pawn / 8 - 1) + uint64_t(king - (king > pawn)) * 6 +
+           uint64_t(other_king - (other_king > pawn) - (other_king > king)) * 6 * 63;
+}
+
+static Board board_with_pieces(const vector<pair<int, int>>& pieces, bool white_to_move) {
+    Board board;
+    for (const auto& piece : pieces) set_piece(board, piece.first, piece.second);
+    board.white_to_move = white_to_move;
+    return board;
+}
+
+// The same position with colours swapped and ranks mirrored
+static Board flip_colours(const Board& board) {
+    Board flipped;
+    for (int square = 0; square < 64; square++) {
+        if (board.squares[square]) set_piece(flipped, square ^ 56, -board.squares[square]);
+    }
+    flipped.white_to_move = !board.white_to_move;
+    return flipped;
+}
+
+// A KRvK position's key, side << 18 | king << 12 | rook << 6 | black king,
+// mirrored so the white king is on a1-d4
+static int fold_krk(int key) {
+    int king = key >> 12 & 63;
+    int flip = (king % 8 > 3 ? 7 : 0) | (king / 8 > 3 ? 56 : 0);
+    return key ^ (flip << 12 | flip << 6 | flip);
+}
+
+// Plies to mate in KRvK by folded key, solved by retrograde analysis over
+// the engine's legal moves; -1 where white does not win or the position
+// is illegal
+static vector<int> solve_krk() {
+    const int count = 2 << 18;
+    vector<int> dtm(count, -1);
+    vector<bool> legal(count, false);
+    vector<int> first(count + 1, 0), successors;
+    for (int key = 0; key < count; key++) {
+        first[key] = int(successors.size());
+        int side = key >> 18, king = key >> 12 & 63, rook = key >> 6 & 63, black_king = key & 63;
+        bool touching = abs(king % 8 - black_king % 8) <= 1 && abs(king / 8 - black_king / 8) <= 1;
+        if (key != fold_krk(key) || king == rook || rook == black_king || touching) continue;
+        Board board = board_with_pieces({{king, 6}, {rook, 4}, {black_king, -6}}, side == 0);
+        if (side == 0 && is_in_check(board, false)) continue;
+        legal[key] = true;
+        vector<Move> moves = generate_all_legal_moves(board);
+        for (const Move& move : moves) {
+            if (side == 1) {
+                successors.push_back(move.to == rook ? -1 : king << 12 | rook << 6 | move.to); // -1: drawn
+            } else if (move.from == king) {
+                successors.push_back(fold_krk(1 << 18 | move.to << 12 | rook << 6 | black_king));
+            } else {
+                successors.push_back(1 << 18 | king << 12 | move.to << 6 | black_king);
+            }
+        }
+        if (side == 1 && moves.empty() && is_in_check(board, false)) dtm[key] = 0;
+    }
+    first[count] = int(successors.size());
+    
+    // White mates in ply when some move reaches a loss in ply - 1; black is
+    // mated in ply when every move does so, the longest taking ply - 1
+    for (int ply = 1, quiet = 0; quiet < 2; ply++) {
+        bool found = false;
+        int side = ply % 2 ? 0 : 1;
+        for (int key = side << 18; key < (side + 1) << 18; key++) {
+            if (!legal[key] || dtm[key] >= 0 || first[key] == first[key + 1]) continue;
+            bool all = true, any = false;
+            for (int i = first[key]; i < first[key + 1]; i++) {
+                int child = successors[i] < 0 ? -1 : dtm[successors[i]];
+                any = any || child == ply - 1;
+                all = all && child >= 0;
+            }
+            if (side == 0 ? any : all && any) {
+                dtm[key] = ply;
+                found = true;
+            }
+        }
+        quiet = found ? 0 : quiet + 1;
+    }
+    return dtm;
+}
+
+// Positions the tables do not reach keep the previous value, as the
+// generator fills them to compress well
+static void fill_unreached(vector<uint8_t>& values) {
+    uint8_t previous = 0;
+    for (uint8_t& value : values) {
+        if (value == 0xff) value = previous;
+        previous = value;
+    }
+}
+
+// A pseudo-random value for the four-piece test tables, constant over
+// runs of 16 positions so that pairs form
+static uint8_t four_piece_value(uint64_t index, int side) {
+    return uint8_t(((index >> 4) * 2654435761u + uint64_t(side) * 40503u) >> 16 & 0xffff) % 5;
+}
+
+void test_syzygy_tablebases() {
+    cout << "Testing Syzygy tablebase probing..." << endl;
+    
+    string directory = "/tmp/agent4k_test_syzygy";
+    mkdir(directory.c_str(), 0755);
+    
+    // Test 1: Bare kings are drawn without any tables; missing or
+    // malformed tables are not probed
+    SyzygyTablebases tablebases;
+    int wdl = 99, dtz = 99;
+    FILE* file = fopen((directory + "/KRvK.rtbw").c_str(), "wb");
+    fputs("not a table", file);
+    fclose(file);
+    assert(tablebases.load(directory) == 0 && tablebases.max_pieces() == 0);
+    assert(!tablebases.probe_wdl(parse_fen("8/8/4k3/8/8/3K4/8/8 w - - 0 1"), wdl));
+    remove((directory + "/KRvK.rtbw").c_str());
+    
+    // Test 2: A KQvK table that is won for white to move and lost for black
+    // to move, read for either colouring of the material
+    write_single_value_table(directory + "/KQvK.rtbw", false, {4, 0});
+    write_single_value_table(directory + "/KQvK.rtbz", true, {5});
+    assert(tablebases.load(directory + ":/nonexistent") == 1 && tablebases.max_pieces() == 3);
+    assert(tablebases.probe_wdl(parse_fen("8/8/8/4k3/8/8/8/KQ6 w - - 0 1"), wdl) && wdl == wdl_win);
+    assert(tablebases.probe_wdl(parse_fen("8/8/8/4k3/8/8/8/KQ6 b - - 0 1"), wdl) && wdl == wdl_loss);
+    assert(tablebases.probe_wdl(parse_fen("kq6/8/8/8/4K3/8/8/8 b - - 0 1"), wdl) && wdl == wdl_win);
+    assert(tablebases.probe_wdl(parse_fen("8/8/4k3/8/8/3K4/8/8 w - - 0 1"), wdl) && wdl == wdl_draw);
+    
+    // Test 3: Captures are searched rather than read: a hanging queen draws
+    assert(tablebases.probe_wdl(parse_fen("8/8/8/8/8/8/3k4/K2Q4 b - - 0 1"), wdl) && wdl == wdl_draw);
+    
+    // Test 4: DTZ counts plies, and is found through the other side's
+    // moves when the table stores only one side to move
+    assert(tablebases.probe_dtz(parse_fen("8/8/8/4k3/8/8/8/KQ6 w - - 0 1"), dtz) && dtz == 11);
+    assert(tablebases.probe_dtz(parse_fen("8/8/8/4k3/8/8/8/KQ6 b - - 0 1"), dtz) && dtz == -12);
+    
+    // Test 5: Castling rights and positions with more pieces are not probed
+    assert(!tablebases.probe_wdl(parse_fen("4k3/8/8/8/8/8/8/4K2Q w K - 0 1"), wdl));
+    assert(!tablebases.probe_wdl(parse_fen("8/8/8/4k3/8/8/8/KQR5 w - - 0 1"), wdl));
+    
+    // Test 6: At the root only the moves keeping the win are left, never
+    // one that hangs the queen
+    Board board = parse_fen("8/8/8/8/8/8/3k4/KQ6 w - - 0 1");
+    vector<Move> moves = generate_all_legal_moves(board);
+    size_t legal = moves.size();
+    int score = 0;
+    assert(tablebases.filter_root_moves(board, moves, score) && score == tablebase_win_score);
+    assert(!moves.empty() && moves.size() < legal);
+    for (const Move& move : moves) {
+        Board child = board;
+        make_move_simple(child, move);
+        assert(tablebases.probe_wdl(child, wdl) && wdl == wdl_loss);
+    }
+    
+    // Test 7: The search keeps to those moves, reports the table result and
+    // counts its probes
+    SearchContext context;
+    context.tablebases = &tablebases;
+    SearchResult result = search(board, SearchLimits{3, 0, 0}, vector<uint64_t>(1, board.hash), context);
+    assert(result.score == tablebase_win_score && result.tb_hits > 0);
+    assert(any_of(moves.begin(), moves.end(), [&](const Move& move) {
+        return move.from == result.best_move.from && move.to == result.best_move.to;
+    }));
+    
+    remove((directory + "/KQvK.rtbw").c_str());
+    remove((directory + "/KQvK.rtbz").c_str());
+    rmdir(directory.c_str());
+    
+    cout << "✓ Syzygy tablebase tests passed" << endl;
+}
+
+void test_syzygy_decoding() {
+    cout << "Testing Syzygy table decoding..." << endl;
+    
+    string directory = "/tmp/agent4k_test_syzygy_decoding";
+    mkdir(directory.c_str(), 0755);
+    const int win = 4, draw = 2, loss = 0; // Stored WDL values
+    const uint8_t unset = 0xff;
+    
+    // Test 1: KRvK solved from the rules: the longest mate takes 16 moves,
+    // 31 plies with white to move and 32 with black to move
+    vector<int> dtm = solve_krk();
+    assert(*max_element(dtm.begin(), dtm.begin() + (1 << 18)) == 31);
+    assert(*max_element(dtm.begin() + (1 << 18), dtm.end()) == 32);
+    
+    // Compressed KRvK tables of the solution, pieces K, R, k; positions
+    // folded onto one index must agree, which checks the index's
+    // symmetries against the rules
+    vector<vector<uint8_t>> krk_wdl(2, vector<uint8_t>(31332, unset));
+    vector<uint8_t> krk_dtz(31332, unset);
+    for (int key = 0; key < (2 << 18); key++) {
+        int side = key >> 18, king = key >> 12 & 63, rook = key >> 6 & 63, black_king = key & 63;
+        bool touching = abs(king % 8 - black_king % 8) <= 1 && abs(king / 8 - black_king / 8) <= 1;
+        if (king == rook || rook == black_king || touching) continue;
+        if (side == 0 && is_in_check(board_with_pieces({{king, 6}, {rook, 4}, {black_king, -6}}, true), false)) continue;
+        int mate = dtm[fold_krk(key)];
+        uint64_t index = pawnless_test_index({king, rook, black_king}, true, {});
+        uint8_t value = uint8_t(mate < 0 ? draw : side == 0 ? win : loss);
+        assert(krk_wdl[side][index] == unset || krk_wdl[side][index] == value);
+        krk_wdl[side][index] = value;
+        if (side == 0 && mate > 0) krk_dtz[index] = uint8_t(mate - 1);
+    }
+    for (vector<uint8_t>& values : krk_wdl) fill_unreached(values);
+    fill_unreached(krk_dtz);
+    write_test_table(directory + "/KRvK.rtbw", false, true, false, {0x6, 0x4, 0xe},
+                     {compress_test_section(krk_wdl[0], 0, 5, 6), compress_test_section(krk_wdl[1], 0, 5, 6)});
+    write_test_table(directory + "/KRvK.rtbz", true, false, false, {0x6, 0x4, 0xe},
+                     {compress_test_section(krk_dtz, 4, 5, 6)}); // DTZ in plies, white to move stored
+    
+    // KPvK tables from the KPK bitbase, pieces P, K, k, a section per file
+    // of the pawn and side to move
+    vector<vector<uint8_t>> kpk_wdl(8, vector<uint8_t>(6 * 63 * 62, unset));
+    for (int pawn = 8; pawn < 56; pawn++) {
+        for (int king = 0; king < 64; king++) {
+            for (int black_king = 0; black_king < 64; black_king++) {
+                bool touching = abs(king % 8 - black_king % 8) <= 1 && abs(king / 8 - black_king / 8) <= 1;
+                if (pawn == king || pawn == black_king || touching) continue;
+                for (int side = 0; side < 2; side++) {
+                    Board board = board_with_pieces({{pawn, 1}, {king, 6}, {black_king, -6}}, side == 0);
+                    if (is_in_check(board, side == 1)) continue;
+                    bool wins;
+                    assert(probe_kpk(board, wins));
+                    int file;
+                    uint64_t index = kpk_test_index(pawn, king, black_king, file);
+                    uint8_t value = uint8_t(!wins ? draw : side == 0 ? win : loss);
+                    uint8_t& stored = kpk_wdl[2 * file + side][index];
+                    assert(stored == unset || stored == value);
+                    stored = value;
+                }
+            }
+        }
+    }
+    vector<TestTableSection> kpk_sections;
+    for (vector<uint8_t>& values : kpk_wdl) {
+        fill_unreached(values);
+        kpk_sections.push_back(compress_test_section(values, 0, 5, 7));
+    }
+    write_test_table(directory + "/KPvK.rtbw", false, true, true, {0x1, 0x6, 0xe}, kpk_sections);
+    
+    // Four-piece tables of arbitrary values by index: KRvKN with a group
+    // after the unique pieces, KRRvK with the kings leading and a pair
+    vector<TestTableSection> krkn_sections, krrk_sections;
+    for (int side = 0; side < 2; side++) {
+        vector<uint8_t> krkn(31332 * 61), krrk(462 * 1891);
+        for (size_t i = 0; i < krkn.size(); i++) krkn[i] = four_piece_value(i, side);
+        for (size_t i = 0; i < krrk.size(); i++) krrk[i] = four_piece_value(i, side);
+        krkn_sections.push_back(compress_test_section(krkn, 0, 6, 10));
+        krrk_sections.push_back(compress_test_section(krrk, 0, 6, 10));
+    }
+    write_test_table(directory + "/KRvKN.rtbw", false, true, false, {0x6, 0x4, 0xe, 0xa}, krkn_sections);
+    write_test_table(directory + "/KRRvK.rtbw", false, true, false, {0x6, 0xe, 0x4, 0x4}, krrk_sections);
+    
+    SyzygyTablebases tablebases;
+    assert(tablebases.load(directory) == 4 && tablebases.max_pieces() == 4);
+    
+    // Test 2: KRvK positions across the board, in both colourings, read
+    // back their result; DTZ, found through white's replies with black to
+    // move, is the distance to mate
+    int wdl = 99, dtz = 99;
+    for (int key = 0; key < (2 << 18); key += 29) {
+        int side = key >> 18, king = key >> 12 & 63, rook = key >> 6 & 63, black_king = key & 63;
+        bool touching = abs(king % 8 - black_king % 8) <= 1 && abs(king / 8 - black_king / 8) <= 1;
+        if (king == rook || rook == black_king || touching) continue;
+        Board board = board_with_pieces({{king, 6}, {rook, 4}, {black_king, -6}}, side == 0);
+        if (side == 0 && is_in_check(board, false)) continue;
+        int mate = dtm[fold_krk(key)];
+        int expected = mate < 0 ? wdl_draw : side == 0 ? wdl_win : wdl_loss;
+        assert(tablebases.probe_wdl(board, wdl) && wdl == expected);
+        assert(tablebases.probe_wdl(flip_colours(board), wdl) && wdl == expected);
+        if (key % 3) continue;
+        int expected_dtz = mate < 0 ? 0 : side == 0 ? mate : mate == 0 ? -1 : -mate;
+        assert(tablebases.probe_dtz(board, dtz) && dtz == expected_dtz);
+        assert(tablebases.probe_dtz(flip_colours(board), dtz) && dtz == expected_dtz);
+    }
+    assert(tablebases.probe_dtz(parse_fen("7k/8/6K1/8/8/8/8/R7 w - - 0 1"), dtz) && dtz == 1);
+    assert(tablebases.probe_dtz(parse_fen("R6k/8/6K1/8/8/8/8/8 b - - 0 1"), dtz) && dtz == -1);
+    assert(tablebases.probe_wdl(parse_fen("8/8/8/8/8/8/8/kR2K3 b - - 0 1"), wdl) && wdl == wdl_draw);
+    
+    // Test 3: KPvK positions on every file, the pawn of either colour,
+    // read back the bitbase's result
+    for (int key = 8 << 12; key < 56 << 12; key += 11) {
+        int pawn = key >> 12, king = key >> 6 & 63, black_king = key & 63;
+        bool touching = abs(king % 8 - black_king % 8) <= 1 && abs(king / 8 - black_king / 8) <= 1;
+        if (pawn == king || pawn == black_king || touching) continue;
+        for (int side = 0; side < 2; side++) {
+            Board board = board_with_pieces({{pawn, 1}, {king, 6}, {black_king, -6}}, side == 0);
+            if (is_in_check(board, side == 1)) continue;
+            bool wins;
+            assert(probe_kpk(board, wins));
+            int expected = !wins ? wdl_draw : side == 0 ? wdl_win : wdl_loss;
+            assert(tablebases.probe_wdl(board, wdl) && wdl == expected);
+            assert(tablebases.probe_wdl(flip_colours(board), wdl) && wdl == expected);
+        }
+    }
+    
+    // Test 4: Four-piece positions without captures read back the value
+    // stored at their index, in both colourings
+    mt19937_64 rng(1);
+    for (int table = 0; table < 2; table++) {
+        bool krkn = table == 0;
+        int checked = 0;
+        while (checked < 4000) {
+            int squares[4];
+            for (int& square : squares) square = int(rng() % 64);
+            int king = squares[0], second = squares[1], third = squares[2], fourth = squares[3];
+            // KRvKN: K, R, k, n; KRRvK: K, k, R, R
+            int black_king = krkn ? third : second;
+            bool touching = abs(king % 8 - black_king % 8) <= 1 && abs(king / 8 - black_king / 8) <= 1;
+            bool distinct = king != second && king != third && king != fourth && second != third &&
+                            second != fourth && third != fourth;
+            if (!distinct || touching) continue;
+            bool white_to_move = rng() % 2;
+            Board board = krkn ? board_with_pieces({{king, 6}, {second, 4}, {third, -6}, {fourth, -2}}, white_to_move)
+                               : board_with_pieces({{king, 6}, {second, -6}, {third, 4}, {fourth, 4}}, white_to_move);
+            if (is_in_check(board, !white_to_move)) continue;
+            vector<Move> moves = generate_all_legal_moves(board);
+            if (any_of(moves.begin(), moves.end(), [&](const Move& move) { return board.squares[move.to] != 0; })) continue;
+            uint64_t index = krkn ? pawnless_test_index({king, second, third, fourth}, true, {1})
+                                  : pawnless_test_index({king, second, third, fourth}, false, {2});
+            int expected = four_piece_value(index, white_to_move ? 0 : 1) - 2;
+            assert(tablebases.probe_wdl(board, wdl) && wdl == expected);
+            assert(tablebases.probe_wdl(flip_colours(board), wdl) && wdl == expected);
+            checked++;
+        }
+    }
+    
+    for (const char* name : {"KRvK.rtbw", "KRvK.rtbz", "KPvK.rtbw", "KRvKN.rtbw", "KRRvK.rtbw"}) {
+        remove((directory + "/" + name).c_str());
+    }
+    rmdir(directory.c_str());
+    
+    cout << "✓ Syzygy table decoding tests passed" << endl;
+}
+
+void test_draw_rules_and_time() {
+    cout << "Testing draw rules and time allocation..." << endl;
+    
+    // Test 1: Knights shuffling out and back repeat the start a third time
+    // after eight plies, not before
+    Board board = create_starting_position();
+    vector<uint64_t> history(1, board.hash);
+    const char* shuffle[] = {"g1f3", "g8f6", "f3g1", "f6g8", "g1f3", "g8f6", "f3g1", "f6g8"};
+    for (int i = 0; i < 8; i++) {
+        assert(!is_threefold_repetition(board, history));
+        make_move_simple(board, uci_to_move(board, shuffle[i]));
+        history.push_back(board.hash);
+    }
+    assert(is_threefold_repetition(board, history));
+    
+    // Test 2: Only bare kings or a single minor piece cannot mate
+    assert(is_insufficient_material(parse_fen("8/8/4k3/8/8/3K4/8/8 w - - 0 1")));
+    assert(is_insufficient_material(parse_fen("8/8/4k3/8/8/3K4/8/6N1 w - - 0 1")));
+    assert(!is_insufficient_material(parse_fen("8/8/4k3/8/8/3K4/8/5BN1 w - - 0 1")));
+    assert(!is_insufficient_material(parse_fen("8/8/4k3/8/8/3K4/P7/8 w - - 0 1")));
+    
+    // Test 3: The clock is split over the remaining moves and never more
+    // than half of it is spent on one move
+    assert(allocate_time(60000, 0, 0) == 2000);
+    assert(allocate_time(60000, 1000, 10) == 6750);
+    assert(allocate_time(1000, 10000, 0) == 470);
+    assert(allocate_time(10, 0, 0) == 1);
+    
+    cout << "✓ Draw rule and time allocation tests passed" << endl;
+}
+
+void test_kpk_bitbase() {
+    cout << "Testing KPK bitbase..." << endl;
+    
+    // Test 1: King in front of a centre pawn on the sixth wins with either
+    // side to move; the rook pawn draws
+    bool win = false;
+    assert(probe_kpk(parse_fen("4k3/8/4K3/4P3/8/8/8/8 w - - 0 1"), win) && win);
+    assert(probe_kpk(parse_fen("4k3/8/4K3/4P3/8/8/8/8 b - - 0 1"), win) && win);
+    assert(probe_kpk(parse_fen("k7/8/K7/P7/8/8/8/8 w - - 0 1"), win) && !win);
+    
+    // Test 2: An undefended pawn next to the black king is taken
+    assert(probe_kpk(parse_fen("8/8/8/8/8/8/3kP3/7K b - - 0 1"), win) && !win);
+    assert(probe_kpk(parse_fen("8/8/8/8/8/8/3kP3/7K w - - 0 1"), win) && win);
+    
+    // Test 3: Colour- and file-mirrored positions give the same results
+    assert(probe_kpk(parse_fen("8/8/8/8/3p4/3k4/8/3K4 b - - 0 1"), win) && win);
+    assert(probe_kpk(parse_fen("7k/8/7K/7P/8/8/8/8 w - - 0 1"), win) && !win);
+    assert(probe_kpk(parse_fen("8/8/8/8/7p/7k/8/7K b - - 0 1"), win) && !win);
+    
+    // Test 4: Only exactly king and pawn against king is probed
+    assert(!probe_kpk(parse_fen("4k3/8/4K3/4P3/8/8/8/7N w - - 0 1"), win));
+    assert(!probe_kpk(parse_fen("4k3/8/4K3/3PP3/8/8/8/8 w - - 0 1"), win));
+    assert(!probe_kpk(parse_fen("4k3/8/8/8/8/8/8/4K3 w - - 0 1"), win));
+    
+    // Test 5: The evaluation follows the bitbase
+    assert(evaluate_position(parse_fen("k7/8/K7/P7/8/8/8/8 w - - 0 1")) == 0);
+    int score = evaluate_position(parse_fen("4k3/8/4K3/4P3/8/8/8/8 w - - 0 1"));
+    assert(score > 400 && score < evaluate_position(parse_fen("4k3/8/4K3/8/8/8/8/4Q3 w - - 0 1")));
+    assert(evaluate_position(parse_fen("4k3/8/4K3/4P3/8/8/8/8 b - - 0 1")) == -score);
+    
+    cout << "✓ KPK bitbase tests passed" << endl;
+}
+
+void test_mate_solver() {
+    cout << "Testing proof-number mate search..." << endl;
+    
+    MateSolver solver(1);
+    SearchLimits limits = {0, 0, 0};
+    
+    // Test 1: Mate in one
+    MateResult result = solver.solve(parse_fen("r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4"),
+                                     1, limits);
+    assert(result.moves == 1 && result.pv.size() == 1);
+    assert(move_to_uci(result.pv[0]) == "h5f7");
+    
+    // Test 2: Mates in two through a sacrifice, with the full line; none
+    // in one move
+    Board board = parse_fen("2r1r1k1/5ppp/8/8/Q7/8/5PPP/4R1K1 w - - 0 1");
+    assert(solver.solve(board, 1, limits).moves == 0);
+    result = solver.solve(board, 3, limits);
+    assert(result.moves == 2 && result.pv.size() == 3);
+    assert(move_to_uci(result.pv[0]) == "e1e8" && move_to_uci(result.pv[1]) == "c8e8" &&
+           move_to_uci(result.pv[2]) == "a4e8");
+    
+    result = solver.solve(parse_fen("r2qk2r/pb4pp/1n2Pb2/2B2Q2/p1p5/2P5/2B2PPP/RN2R1K1 w - - 1 1"), 2, limits);
+    assert(result.moves == 2 && move_to_uci(result.pv[0]) == "f5g6");
+    Board end = parse_fen("r2qk2r/pb4pp/1n2Pb2/2B2Q2/p1p5/2P5/2B2PPP/RN2R1K1 w - - 1 1");
+    for (const Move& move : result.pv) make_move_simple(end, move);
+    assert(is_in_check(end, end.white_to_move) && generate_all_legal_moves(end).empty());
+    
+    // Test 3: No mate from the starting position, and a node limit stops
+    // the search
+    result = solver.solve(create_starting_position(), 2, limits);
+    assert(result.moves == 0 && !result.stopped);
+    SearchLimits tight = {0, 1, 0};
+    result = solver.solve(parse_fen("r2qk2r/pb4pp/1n2Pb2/2B2Q2/p1p5/2P5/2B2PPP/RN2R1K1 w - - 1 1"), 5, tight);
+    assert(result.moves == 0 && result.stopped && result.nodes <= 2);
+    
+    // Test 4: A node limit the proof fits in still gives the mate and its
+    // first move, however little of the line it leaves time to follow
+    solver.clear();
+    result = solver.solve(board, 3, limits);
+    solver.clear();
+    SearchLimits just_enough = {0, result.nodes + 1, 0};
+    MateResult limited = solver.solve(board, 3, just_enough);
+    assert(limited.moves == 2 && !limited.pv.empty() && limited.pv.size() <= 3);
+    assert(move_to_uci(limited.pv[0]) == "e1e8");
+    
+    cout << "✓ Proof-number mate search tests passed" << endl;
+}
+
+// Moves as sorted from | to << 6 | promotion << 12 codes, for comparing
+// move lists regardless of order
+static vector<int> move_codes(const vector<Move>& moves) {
+    vector<int> codes;
+    for (const Move& move : moves) codes.push_back(move.from | move.to << 6 | move.promotion() << 12);
+    sort(codes.begin(), codes.end());
+    return codes;
+}
+
+// Compares the dedicated generators and gives_check with filtering every
+// pseudo-legal move, at each node of the tree below board
+static void check_move_generators(const Board& board, int depth) {
+    vector<Move> legal, quiet_checks;
+    for (const Move& move : generate_all_moves(board)) {
+        if (!is_legal_move(board, move)) continue;
+        legal.push_back(move);
+        Board child = board;
+        make_move_simple(child, move);
+        bool check = is_in_check(child, child.white_to_move);
+        assert(gives_check(board, move) == check);
+        bool quiet = board.squares[move.to] == 0 && move.promotion() == 0 &&
+                     !(abs(board.squares[move.from]) == 1 && move.to == board.en_passant_square);
+        if (check && quiet) quiet_checks.push_back(move);
+        if (depth > 1) check_move_generators(child, depth - 1);
+    }
+    assert(move_codes(generate_all_legal_moves(board)) == move_codes(legal));
+    assert(move_codes(generate_quiet_checks(board)) == move_codes(quiet_checks));
+    if (is_in_check(board, board.white_to_move)) {
+        assert(move_codes(generate_evasions(board)) == move_codes(legal));
+    }
+}
+
+void test_move_generators() {
+    cout << "Testing evasion and quiet-check generators..." << endl;
+    
+    // Test 1: Evasions of a double check are king moves only, and en
+    // passant can take a checking pawn
+    Board board = parse_fen("4k3/8/5N2/8/8/8/8/4RK2 b - - 0 1");
+    for (const Move& move : generate_evasions(board)) assert(move.from == string_to_square("e8"));
+    board = parse_fen("8/8/8/2k5/3Pp3/8/8/4K3 b - d3 0 1");
+    vector<Move> evasions = generate_evasions(board);
+    assert(find_if(evasions.begin(), evasions.end(), [](const Move& move) {
+        return move_to_uci(move) == "e4d3";
+    }) != evasions.end());
+    
+    // Test 2: Discovered checks and castling into check
+    board = parse_fen("4k3/8/8/8/8/8/4N3/4R1K1 w - - 0 1");
+    assert(generate_quiet_checks(board).size() == 5); // Every knight move
+    board = parse_fen("5k2/8/8/8/8/8/8/4K2R w K - 0 1");
+    assert(gives_check(board, uci_to_move(board, "e1g1")));
+    
+    // Test 3: The generators agree with filtering all moves in tricky trees
+    check_move_generators(parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"), 2);
+    check_move_generators(parse_fen("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1"), 3);
+    check_move_generators(parse_fen("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"), 3);
+    check_move_generators(parse_fen("rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPPPNnPP/RNBQK2R w KQ - 1 8"), 2);
+    
+    cout << "✓ Evasion and quiet-check generator tests passed" << endl;
+}
+
 void test_uci_move_format() {
     cout << "Testing UCI move format conversion..." << endl;
     
@@ -1131,46 +2774,211 @@ void test_uci_move_format() {
     Move move1(string_to_square("e2"), string_to_square("e4"));
     assert(move_to_uci(move1) == "e2e4");
     
-    Move parsed1 = uci_to_move("e2e4");
+    Board start = create_starting_position();
+    Move parsed1 = uci_to_move(start, "e2e4");
     assert(parsed1.from == string_to_square("e2"));
     assert(parsed1.to == string_to_square("e4"));
-    assert(parsed1.promotion == 0);
+    assert(parsed1.promotion() == 0);
     
     // Test 2: Promotion move
     Move move2(string_to_square("e7"), string_to_square("e8"), 5); // queen promotion
     assert(move_to_uci(move2) == "e7e8q");
     
-    Move parsed2 = uci_to_move("e7e8q");
+    Board promoting = parse_fen("1n2k3/P3P3/8/8/8/8/8/4K3 w - - 0 1");
+    Move parsed2 = uci_to_move(promoting, "e7e8q");
     assert(parsed2.from == string_to_square("e7"));
     assert(parsed2.to == string_to_square("e8"));
-    assert(parsed2.promotion == 5);
+    assert(parsed2.promotion() == 5);
     
     // Test 3: Knight promotion
     Move move3(string_to_square("a7"), string_to_square("b8"), 2); // knight promotion
     assert(move_to_uci(move3) == "a7b8n");
     
-    Move parsed3 = uci_to_move("a7b8n");
+    Move parsed3 = uci_to_move(promoting, "a7b8n");
     assert(parsed3.from == string_to_square("a7"));
     assert(parsed3.to == string_to_square("b8"));
-    assert(parsed3.promotion == 2);
+    assert(parsed3.promotion() == 2);
     
     // Test 4: Castling moves
     Move move4(string_to_square("e1"), string_to_square("g1")); // kingside castling
     assert(move_to_uci(move4) == "e1g1");
     
-    Move parsed4 = uci_to_move("e1g1");
+    Board castling = parse_fen("4k3/8/8/8/8/8/8/4K2R w K - 0 1");
+    Move parsed4 = uci_to_move(castling, "e1g1");
     assert(parsed4.from == string_to_square("e1"));
     assert(parsed4.to == string_to_square("g1"));
-    assert(parsed4.promotion == 0);
+    assert(parsed4.promotion() == 0 && parsed4.is_castling());
+    
+    // Test 5: Malformed text is the null move
+    Move parsed5 = uci_to_move(start, "e2");
+    assert(parsed5.from == parsed5.to);
     
     cout << "✓ UCI move format conversion tests passed" << endl;
 }
 
+void test_move_encoding() {
+    cout << "Testing 16-bit move encoding..." << endl;
+    
+    // Test 1: Squares, promotions and flags survive the round trip
+    static_assert(sizeof(Move) == 2, "moves pack into 16 bits");
+    Move promotion(string_to_square("b7"), string_to_square("a8"), 5);
+    assert(promotion.promotion() == 5 && !promotion.is_castling() && !promotion.is_en_passant());
+    Move copy = Move::from_bits(promotion.bits());
+    assert(copy.from == promotion.from && copy.to == promotion.to && copy.promotion() == 5);
+    assert(Move().bits() == 0 && Move().from == Move().to);
+    
+    // Test 2: The generators and the board-aware UCI parser set the flags
+    Board board = parse_fen("r3k2r/8/8/3pP3/8/8/8/R3K2R w KQkq d6 0 1");
+    int castles = 0, en_passant = 0;
+    for (const Move& move : generate_all_legal_moves(board)) {
+        castles += move.is_castling();
+        en_passant += move.is_en_passant();
+    }
+    assert(castles == 2 && en_passant == 1);
+    assert(uci_to_move(board, "e1c1").is_castling() && uci_to_move(board, "e5d6").is_en_passant());
+    assert(uci_to_move(board, "e1d1").flag == 0);
+    
+    // Test 3: make_move_simple moves the rook and removes the pawn by flag
+    Board castled = board;
+    make_move_simple(castled, uci_to_move(board, "e1g1"));
+    assert(castled.squares[string_to_square("f1")] == 4 && castled.squares[string_to_square("h1")] == 0);
+    Board captured = board;
+    make_move_simple(captured, uci_to_move(board, "e5d6"));
+    assert(captured.squares[string_to_square("d5")] == 0 && captured.hash == compute_hash(captured));
+    
+    cout << "✓ 16-bit move encoding tests passed" << endl;
+}
+
+void test_san_format() {
+    cout << "Testing SAN move format conversion..." << endl;
+    
+    // Test 1: Pawn pushes, piece moves and castling
+    Board board = parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    assert(move_to_san(board, Move(string_to_square("a2"), string_to_square("a4"))) == "a4");
+    assert(move_to_san(board, Move(string_to_square("e5"), string_to_square("f7"))) == "Nxf7");
+    assert(move_to_san(board, Move(string_to_square("d5"), string_to_square("e6"))) == "dxe6");
+    assert(move_to_san(board, uci_to_move(board, "e1g1")) == "O-O");
+    assert(move_to_san(board, uci_to_move(board, "e1c1")) == "O-O-O");
+    
+    // Test 2: Disambiguation by file, then by rank
+    Board board2 = parse_fen("6k1/8/8/8/8/8/4K3/R6R w - - 0 1");
+    assert(move_to_san(board2, Move(string_to_square("a1"), string_to_square("d1"))) == "Rad1");
+    Board board3 = parse_fen("4k3/8/R7/8/8/8/R7/4K3 w - - 0 1");
+    assert(move_to_san(board3, Move(string_to_square("a2"), string_to_square("a4"))) == "R2a4");
+    
+    // Test 3: Promotion with check and mate
+    Board board4 = parse_fen("4k3/1P6/8/8/8/8/8/4K3 w - - 0 1");
+    assert(move_to_san(board4, Move(string_to_square("b7"), string_to_square("b8"), 5)) == "b8=Q+");
+    Board board5 = parse_fen("r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4");
+    assert(move_to_san(board5, Move(string_to_square("h5"), string_to_square("f7"))) == "Qxf7#");
+    
+    // Test 4: Parsing accepts suffixes and round-trips every legal move
+    Move mate = san_to_move(board5, "Qxf7#");
+    assert(mate.from == string_to_square("h5") && mate.to == string_to_square("f7"));
+    Move unmatched = san_to_move(board5, "Qxf6");
+    assert(unmatched.from == unmatched.to);
+    for (const Move& move : generate_all_legal_moves(board)) {
+        Move parsed = san_to_move(board, move_to_san(board, move));
+        assert(parsed.from == move.from && parsed.to == move.to && parsed.promotion() == move.promotion());
+    }
+    
+    cout << "✓ SAN move format conversion tests passed" << endl;
+}
+
+void test_packed_positions() {
+    cout << "Testing packed positions..." << endl;
+    
+    // Test 1: Round trip through the move tree, covering castling rights,
+    // en passant and promotions
+    const char* fens[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+    };
+    vector<Board> boards;
+    for (const char* fen : fens) {
+        Board root = parse_fen(fen);
+        boards.push_back(root);
+        for (const Move& move : generate_all_legal_moves(root)) {
+            Board child = root;
+            make_move_simple(child, move);
+            boards.push_back(child);
+        }
+    }
+    for (const Board& board : boards) {
+        PackedPosition packed;
+        assert(pack_position(board, packed));
+        Board unpacked;
+        assert(unpack_position(packed, unpacked));
+        assert(board_to_fen(unpacked) == board_to_fen(board));
+        assert(unpacked.hash == board.hash && unpacked.mg_score == board.mg_score);
+    }
+    
+    // Test 2: Optional fields
+    PackedPosition packed;
+    assert(pack_position(boards[0], packed));
+    assert(packed_result(packed) == packed_result_unknown && packed.best_move == 0);
+    set_packed_result(packed, packed_result_black_win);
+    assert(packed_result(packed) == packed_result_black_win && (packed.flags & 1) == 0);
+    Board promoting = parse_fen("2n1k3/3P4/8/8/8/8/8/R3K3 w Q - 0 1");
+    Move promotion = unpack_move(pack_move(Move(string_to_square("d7"), string_to_square("c8"), 2)), promoting);
+    assert(move_to_uci(promotion) == "d7c8n");
+    assert(unpack_move(pack_move(Move(string_to_square("e1"), string_to_square("c1"))), promoting).is_castling());
+    assert(unpack_move(pack_move(Move(string_to_square("e1"), string_to_square("e3"))), promoting).bits() == 0);
+    assert(unpack_move(0, promoting).bits() == 0);
+    assert(parse_game_result("c9 \"1/2-1/2\";") == packed_result_draw);
+    assert(parse_game_result("[1.0]") == packed_result_white_win);
+    assert(parse_game_result("hmvc 0;") == packed_result_unknown);
+    
+    // Test 3: Malformed records are rejected: a piece code above 11, more
+    // than 32 pieces, a missing king and an en passant file above 8
+    vector<PackedPosition> malformed(4);
+    for (PackedPosition& bad : malformed) assert(pack_position(boards[0], bad));
+    malformed[0].pieces[0] |= 0xc;
+    malformed[1].occupancy = ~0ULL;
+    malformed[2].pieces[0] &= 0x0f; // White's king on e1 becomes a pawn
+    malformed[3].fullmove_and_ep |= 9 << 12;
+    Board rejected;
+    for (const PackedPosition& bad : malformed) assert(!unpack_position(bad, rejected));
+    
+    // Test 4: Writer and reader agree, across a buffer flush, and the reader
+    // skips malformed records
+    string path = "/tmp/agent4k_test.bin";
+    {
+        PackedWriter writer(path);
+        assert(writer.is_open());
+        for (int i = 0; i < 5000; i++) {
+            assert(pack_position(boards[i % boards.size()], packed));
+            packed.score = int16_t(i - 2500);
+            assert(writer.write(packed));
+            if (i == 100) assert(writer.write(malformed[0]));
+        }
+        assert(writer.write(malformed[1]));
+    }
+    assert(is_packed_file(path));
+    PackedReader reader(path);
+    assert(reader.is_open() && reader.size() == 5002);
+    Board board;
+    const PackedPosition* record;
+    int count = 0;
+    while (reader.next(board, &record)) {
+        assert(board.hash == boards[count % boards.size()].hash);
+        assert(record->score == count - 2500);
+        count++;
+    }
+    assert(count == 5000 && reader.rejected == 2);
+    remove(path.c_str());
+    assert(!is_packed_file("src/perftsuite.epd"));
+    
+    cout << "✓ Packed position tests passed" << endl;
+}
+
 void test_perft() {
     cout << "Testing perft (comprehensive move generation validation)..." << endl;
     
     // Try to read the full perft suite
-    ifstream file("src/perftsuite.epd");
+    EpdReader file("src/perftsuite.epd");
     if (!file.is_open()) {
         cout << "Warning: Could not open src/perftsuite.epd, running basic tests only" << endl;
         
@@ -1186,13 +2994,11 @@ void test_perft() {
     
     int passed = 0, failed = 0;
     int position_count = 0;
-    string line;
+    string_view line;
     
     cout << "Loading full perft suite..." << endl;
     
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        
+    while (file.next_line(line)) {
         PerftResult test = parse_perft_line(line);
         if (test.fen.empty()) continue;
         
@@ -1229,8 +3035,6 @@ void test_perft() {
         }
     }
     
-    file.close();
-    
     cout << "Perft comprehensive suite results: " << passed << " passed, " << failed << " failed across " << position_count << " positions" << endl;
     
     if (failed > 0) {
@@ -1259,7 +3063,32 @@ int main() {
     test_check_detection();
     test_legal_move_validation();
     test_uci_position_parsing();
+    test_tokenizer();
+    test_fen_parsing();
+    test_zobrist_hashing();
+    test_incremental_uci_position();
+    test_evaluation();
+    test_pawn_structure();
+    test_evaluate_batch();
+    test_evaluation_trace();
+    test_eval_cache();
+    test_nnue();
+    test_search_limits();
+    test_draw_rules_and_time();
+    test_engine();
+    test_shared_transposition_table();
+    test_transposition_table_file();
+    test_large_buffers();
+    test_polyglot_book();
+    test_syzygy_tablebases();
+    test_syzygy_decoding();
+    test_kpk_bitbase();
+    test_mate_solver();
+    test_move_generators();
     test_uci_move_format();
+    test_move_encoding();
+    test_san_format();
+    test_packed_positions();
     test_perft();
     
     cout << "\n✓ All tests passed!" << endl;
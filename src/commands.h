@@ -0,0 +1,10 @@
+#pragma once
+
+// Command-line modes of the engine executable. Without arguments it runs
+// the UCI loop; "agent4k <command> [arguments]" runs one of these instead.
+// Each takes the arguments after the command name and returns the exit code.
+
+int analyse_command(int argc, char* argv[]);  // analyse.cpp
+int convert_command(int argc, char* argv[]);  // convert.cpp
+int match_command(int argc, char* argv[]);    // match.cpp
+int selfplay_command(int argc, char* argv[]); // selfplay.cpp
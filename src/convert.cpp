@@ -0,0 +1,123 @@
+#include "commands.h"
+#include "chess.h"
+#include "packed.h"
+#include <iostream>
+#include <fstream>
+#include <charconv>
+
+// agent4k convert INPUT OUTPUT
+//
+// Converts between EPD and the packed binary format (packed.h); the
+// direction follows from whether INPUT is a packed file. EPD operations
+// carry the optional fields: ce (score for the side to move), bm (best
+// move, SAN or coordinate notation) and the game result as c9 "1-0" or a
+// bracketed white score.
+
+// Optional packed fields from an EPD line's operations
+static void parse_operations(const Board& board, string_view operations, PackedPosition& packed) {
+    Tokenizer tokens(operations);
+    for (string_view opcode = tokens.next(); !opcode.empty(); opcode = tokens.next()) {
+        string_view operand = tokens.next();
+        if (!operand.empty() && operand.back() == ';') operand.remove_suffix(1);
+
+        if (opcode == "ce") {
+            int score;
+            const char* end = operand.data() + operand.size();
+            auto result = from_chars(operand.data(), end, score);
+            if (result.ec == errc() && result.ptr == end) {
+                packed.score = int16_t(max(-32767, min(32767, score)));
+            }
+        } else if (opcode == "bm") {
+            Move move = san_to_move(board, operand);
+            if (move.from == move.to) {
+                move = uci_to_move(board, operand);
+                if (move.from == move.to || !is_legal_move(board, move)) continue;
+            }
+            packed.best_move = pack_move(move);
+        }
+    }
+    set_packed_result(packed, parse_game_result(operations));
+}
+
+static int epd_to_packed(const string& input, const string& output) {
+    EpdReader reader(input);
+    if (!reader.is_open()) {
+        cerr << "Cannot open " << input << endl;
+        return 1;
+    }
+    PackedWriter writer(output);
+    if (!writer.is_open()) {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+    }
+
+    string_view line;
+    uint64_t skipped = 0, invalid = 0;
+    while (reader.next_line(line)) {
+        string_view operations;
+        Board board;
+        if (!parse_epd(line, board, &operations)) {
+            invalid++;
+            continue;
+        }
+        PackedPosition packed;
+        if (!pack_position(board, packed)) {
+            skipped++;
+            continue;
+        }
+        parse_operations(board, operations, packed);
+        writer.write(packed);
+    }
+    if (!writer.flush()) {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+    }
+    cout << "Wrote " << writer.count << " positions to " << output;
+    if (skipped) cout << " (skipped " << skipped << " with more than 32 pieces)";
+    if (invalid) cout << " (skipped " << invalid << " invalid lines)";
+    cout << endl;
+    return 0;
+}
+
+static int packed_to_epd(const string& input, const string& output) {
+    PackedReader reader(input);
+    if (!reader.is_open()) {
+        cerr << "Cannot open " << input << endl;
+        return 1;
+    }
+    ofstream out(output);
+    if (!out) {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+    }
+
+    Board board;
+    const PackedPosition* packed;
+    while (reader.next(board, &packed)) {
+        out << board_to_epd(board);
+        // A best move that is not legal here is left out, as parse_operations does
+        Move best = unpack_move(packed->best_move, board);
+        if (best.from != best.to) out << " bm " << move_to_san(board, best) << ";";
+        if (packed->score != 0 || packed->best_move != 0) out << " ce " << packed->score << ";";
+        if (packed_result(*packed) != packed_result_unknown) {
+            out << " c9 \"" << game_result_string(packed_result(*packed)) << "\";";
+        }
+        out << "\n";
+    }
+    if (!out.flush()) {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+    }
+    cout << "Wrote " << reader.size() - reader.rejected << " positions to " << output;
+    if (reader.rejected) cout << " (skipped " << reader.rejected << " malformed records)";
+    cout << endl;
+    return 0;
+}
+
+int convert_command(int argc, char* argv[]) {
+    if (argc != 2) {
+        cerr << "Usage: agent4k convert INPUT OUTPUT" << endl;
+        return 1;
+    }
+    return is_packed_file(argv[0]) ? packed_to_epd(argv[0], argv[1]) : epd_to_packed(argv[0], argv[1]);
+}
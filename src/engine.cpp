@@ -0,0 +1,155 @@
+#include "engine.h"
+#include "nnue.h"
+
+Engine::Engine(const EngineOptions& options)
+    : tt(0), stop_signal(false), job(0), running(0), quit(false), job_depth(0) {
+    set_options(options);
+}
+
+Engine::~Engine() {
+    stop_helpers();
+}
+
+void Engine::set_options(const EngineOptions& options) {
+    EngineOptions previous = settings;
+    bool first = contexts.empty();
+    size_t previous_threads = contexts.size();
+    settings = options;
+    settings.threads = max(1, options.threads);
+
+    bool pages_changed = options.large_pages != previous.large_pages;
+    if (first || options.hash != previous.hash || options.shared_hash != previous.shared_hash || pages_changed) {
+        if (options.shared_hash.empty()) {
+            tt.resize(options.hash, options.large_pages);
+        } else {
+            tt.attach_shared(options.shared_hash, options.hash);
+        }
+    }
+    if (first || settings.threads != previous.threads) {
+        stop_helpers();
+        contexts.resize(settings.threads);
+        for (unique_ptr<SearchContext>& context : contexts) {
+            if (!context) context.reset(new SearchContext());
+        }
+        quit = false;
+        for (int i = 1; i < settings.threads; i++) {
+            helpers.emplace_back(&Engine::helper_loop, this, i, job);
+        }
+    }
+
+    for (size_t i = 0; i < contexts.size(); i++) {
+        unique_ptr<SearchContext>& context = contexts[i];
+        bool new_context = i >= previous_threads;
+        if (first || new_context || options.eval_cache != previous.eval_cache || pages_changed) {
+            context->eval_cache.resize(options.eval_cache, options.large_pages);
+        } else if (options.network != previous.network) {
+            context->eval_cache.clear(); // Cached scores came from the other evaluator
+        }
+        context->network = options.network;
+        context->tablebases = options.tablebases;
+        context->tt = &tt;
+        context->stop_signal = &stop_signal;
+    }
+}
+
+const EngineOptions& Engine::options() const {
+    return settings;
+}
+
+void Engine::new_game() {
+    tt.clear();
+    for (unique_ptr<SearchContext>& context : contexts) {
+        context->clear_heuristics();
+    }
+}
+
+bool Engine::save_hash(const string& path) const {
+    return tt.save(path);
+}
+
+bool Engine::load_hash(const string& path) {
+    return tt.load(path);
+}
+
+SearchResult Engine::search(const Board& board, const SearchLimits& limits, const vector<uint64_t>& history) {
+    stop_signal = false;
+    tt.new_search();
+
+    if (!helpers.empty()) {
+        lock_guard<mutex> guard(lock);
+        job_board = board;
+        job_history = history;
+        job_depth = limits.depth;
+        running = int(helpers.size());
+        job++;
+        wake.notify_all();
+    }
+
+    SearchResult result = ::search(board, limits, history, *contexts[0]);
+
+    if (!helpers.empty()) {
+        stop_signal = true;
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [this]() { return running == 0; });
+        for (size_t i = 1; i < contexts.size(); i++) {
+            result.nodes += contexts[i]->nodes;
+            result.tb_hits += contexts[i]->tb_hits;
+        }
+    }
+    return result;
+}
+
+void Engine::stop() {
+    stop_signal = true;
+}
+
+int Engine::hashfull() const {
+    return tt.hashfull();
+}
+
+int Engine::hash_pages() const {
+    return tt.pages();
+}
+
+size_t Engine::hash_megabytes() const {
+    return tt.megabytes();
+}
+
+bool Engine::hash_shared() const {
+    return tt.is_shared();
+}
+
+const SearchContext& Engine::main_context() const {
+    return *contexts[0];
+}
+
+// Helpers share the depth limit; the main thread stops them through the
+// stop signal when its own search ends. done is the last job number posted
+// before the helper was created.
+void Engine::helper_loop(int index, uint64_t done) {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [&]() { return quit || job != done; });
+        if (quit) return;
+        done = job;
+        Board board = job_board;
+        vector<uint64_t> history = job_history;
+        int depth = job_depth;
+        guard.unlock();
+
+        ::search(board, SearchLimits{depth, 0, 0}, history, *contexts[index]);
+
+        guard.lock();
+        if (--running == 0) finished.notify_all();
+    }
+}
+
+void Engine::stop_helpers() {
+    {
+        lock_guard<mutex> guard(lock);
+        quit = true;
+        wake.notify_all();
+    }
+    for (thread& helper : helpers) helper.join();
+    helpers.clear();
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "chess.h"
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// A self-contained searcher: the transposition table, the search threads
+// with their caches and move-ordering history, and the options all belong
+// to the object, and nothing is shared between objects. Any number of
+// engines can search at the same time in one process.
+//
+// With more than one thread the extra threads search the same position
+// (lazy SMP); they only share the transposition table, which steers the
+// main thread. The main thread applies the limits and its result is the
+// engine's result.
+
+struct EngineOptions {
+    size_t hash = 16;                             // Transposition table megabytes; 0 for none
+    string shared_hash;                           // Shared-memory segment name for the table; private if empty
+    int threads = 1;
+    size_t eval_cache = 1;                        // Eval cache megabytes per thread
+    bool large_pages = true;                      // Huge pages for the tables when the system has them
+    const NnueNetwork* network = nullptr;         // Neural evaluation if set; not owned
+    const SyzygyTablebases* tablebases = nullptr; // Endgame tables to probe if set; not owned
+};
+
+class Engine {
+public:
+    explicit Engine(const EngineOptions& options = EngineOptions());
+    ~Engine();
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    // Resize the tables and thread pool; must not be called during a search
+    void set_options(const EngineOptions& options);
+    const EngineOptions& options() const;
+
+    // Forget the transposition table and move-ordering history
+    void new_game();
+
+    // Persist the transposition table, or replace it with a saved one
+    // (TranspositionTable::save and load); must not be called during a search
+    bool save_hash(const string& path) const;
+    bool load_hash(const string& path);
+
+    // Blocks until a limit is reached or stop() is called. history holds
+    // the hashes of the game so far, as for the search function.
+    SearchResult search(const Board& board, const SearchLimits& limits, const vector<uint64_t>& history);
+
+    // Ends the running search from another thread, keeping the last
+    // completed iteration
+    void stop();
+
+    int hashfull() const;                    // Permille of the table used by the last search
+    bool hash_shared() const;                // False if shared_hash is empty or could not be attached
+    int hash_pages() const;                  // pages_* the private table got
+    size_t hash_megabytes() const;           // Size of the table actually allocated, 0 if none
+    const SearchContext& main_context() const; // Caches of the main thread, for statistics
+
+private:
+    void helper_loop(int index, uint64_t done);
+    void stop_helpers();
+
+    EngineOptions settings;
+    TranspositionTable tt;
+    vector<unique_ptr<SearchContext>> contexts; // One per thread, the main thread's first
+    atomic<bool> stop_signal;
+
+    // Helper threads wait for a new job number, then search job_board
+    vector<thread> helpers;
+    mutex lock;
+    condition_variable wake;     // Signals a new job or quit
+    condition_variable finished; // Signals running == 0
+    uint64_t job;
+    int running;                 // Helpers still searching the current job
+    bool quit;
+    Board job_board;
+    vector<uint64_t> job_history;
+    int job_depth;
+};
@@ -1,32 +1,283 @@
 #include "chess.h"
+#include "engine.h"
+#include "nnue.h"
+#include "book.h"
+#include "syzygy.h"
+#include "mate.h"
+#include "commands.h"
 #include <iostream>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <charconv>
+#include <unistd.h>
 using namespace std;
 
-int main() {
-    Board board;
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        string command = argv[1];
+        if (command == "analyse") return analyse_command(argc - 2, argv + 2);
+        if (command == "convert") return convert_command(argc - 2, argv + 2);
+        if (command == "match") return match_command(argc - 2, argv + 2);
+        if (command == "selfplay") return selfplay_command(argc - 2, argv + 2);
+        cerr << "Unknown command " << command << "; commands: analyse, convert, match, selfplay" << endl;
+        return 1;
+    }
+    
+    UciPosition position;
+    update_uci_position(position, "position startpos"); // Until the GUI sends one
+    Engine engine;
+    string hash_file; // HashFile option
+    unique_ptr<NnueNetwork> network;
+    unique_ptr<SyzygyTablebases> tablebases;
+    PolyglotBook book;
+    MateSolver mate_solver;
+    bool own_book = false, book_best_move = false;
+    mt19937_64 book_rng(random_device{}());
     string line;
     
+    // The size and page kind the table got, which decide how costly its
+    // misses are; the size is rounded down to a power of two, and is 0 when
+    // the memory could not be allocated
+    auto report_hash = [&engine]() {
+        const EngineOptions& options = engine.options();
+        if (options.shared_hash.empty() && options.hash > 0) {
+            size_t megabytes = engine.hash_megabytes();
+            if (megabytes == 0) {
+                cout << "info string hash failed to allocate " << options.hash << " MB, searching without a table" << endl;
+            } else {
+                cout << "info string hash " << megabytes << " MB on " << page_kind_name(engine.hash_pages()) << endl;
+            }
+        }
+    };
+    
     while (getline(cin, line)) {
         if (line == "uci") {
             cout << "id name Agent4k" << endl;
             cout << "id author Claude" << endl;
+            cout << "option name Hash type spin default 16 min 0 max 65536" << endl;
+            cout << "option name LargePages type check default true" << endl;
+            cout << "option name HashFile type string default <empty>" << endl;
+            cout << "option name SaveHash type button" << endl;
+            cout << "option name LoadHash type button" << endl;
+            cout << "option name SharedHash type string default <empty>" << endl;
+            cout << "option name Threads type spin default 1 min 1 max 256" << endl;
+            cout << "option name EvalCache type spin default 1 min 0 max 1024" << endl;
+            cout << "option name EvalFile type string default <empty>" << endl;
+            cout << "option name SyzygyPath type string default <empty>" << endl;
+            cout << "option name OwnBook type check default false" << endl;
+            cout << "option name BookFile type string default <empty>" << endl;
+            cout << "option name BookBestMove type check default false" << endl;
             cout << "uciok" << endl;
+            report_hash();
         }
         else if (line == "isready") {
             cout << "readyok" << endl;
         }
+        else if (line.substr(0, 9) == "setoption") {
+            // setoption name <id> value <x>
+            Tokenizer tokens(line);
+            tokens.next(); // Skip "setoption"
+            tokens.next(); // Skip "name"
+            string_view name = tokens.next();
+            tokens.next(); // Skip "value"
+            string value(tokens.rest.substr(min(tokens.rest.size(), tokens.rest.find_first_not_of(' '))));
+            value.erase(value.find_last_not_of(" \t\r") + 1);
+            
+            // A spin option's value clamped to its advertised range; false,
+            // leaving the option alone, unless it is a whole number
+            long long spin = 0;
+            auto spin_value = [&value, &spin](long long low, long long high) {
+                const char* end = value.data() + value.size();
+                auto result = from_chars(value.data(), end, spin);
+                if (result.ec != errc() || result.ptr != end) return false;
+                spin = min(high, max(low, spin));
+                return true;
+            };
+            
+            EngineOptions options = engine.options();
+            if ((name == "Hash" && spin_value(0, 65536)) || name == "LargePages") {
+                if (name == "Hash") options.hash = size_t(spin);
+                if (name == "LargePages") options.large_pages = value != "false";
+                engine.set_options(options);
+                report_hash();
+            }
+            else if (name == "HashFile") {
+                // Setting the file loads it when it exists, so a restarted
+                // session resumes with the table it saved
+                hash_file = value == "<empty>" ? "" : value;
+                if (!hash_file.empty() && access(hash_file.c_str(), F_OK) == 0) {
+                    bool loaded = engine.load_hash(hash_file);
+                    cout << "info string " << (loaded ? "loaded hash from " : "failed to load hash from ")
+                         << hash_file << endl;
+                }
+            }
+            else if (name == "SaveHash" || name == "LoadHash") {
+                bool save = name == "SaveHash";
+                bool ok = !hash_file.empty() && (save ? engine.save_hash(hash_file) : engine.load_hash(hash_file));
+                cout << "info string " << (ok ? "" : "failed to ") << (save ? "save hash to " : "load hash from ")
+                     << (hash_file.empty() ? "<no HashFile>" : hash_file) << endl;
+            }
+            else if (name == "SharedHash") {
+                // Engines given the same name share one table; empty or "<empty>" for a private one
+                options.shared_hash = value == "<empty>" ? "" : value;
+                engine.set_options(options);
+                if (!options.shared_hash.empty()) {
+                    cout << "info string " << (engine.hash_shared() ? "attached" : "failed to attach")
+                         << " shared hash " << options.shared_hash << endl;
+                }
+            }
+            else if (name == "Threads" && spin_value(1, 256)) {
+                options.threads = int(spin);
+            }
+            else if (name == "EvalCache" && spin_value(0, 1024)) {
+                options.eval_cache = size_t(spin);
+            }
+            else if (name == "EvalFile") {
+                // An empty value or "<empty>" switches back to the classical evaluation
+                options.network = nullptr;
+                engine.set_options(options);
+                network.reset();
+                if (!value.empty() && value != "<empty>") {
+                    network.reset(new NnueNetwork());
+                    if (network->load(value)) {
+                        options.network = network.get();
+                        cout << "info string NNUE evaluation loaded from " << value
+                             << " (" << nnue_simd_name() << ")" << endl;
+                    } else {
+                        network.reset();
+                        cout << "info string failed to load EvalFile " << value
+                             << ", using classical evaluation" << endl;
+                    }
+                }
+            }
+            else if (name == "SyzygyPath") {
+                // Directories separated by ':'; empty or "<empty>" for none
+                options.tablebases = nullptr;
+                engine.set_options(options);
+                tablebases.reset();
+                if (!value.empty() && value != "<empty>") {
+                    tablebases.reset(new SyzygyTablebases());
+                    int found = tablebases->load(value);
+                    cout << "info string found " << found << " tablebases";
+                    if (found > 0) {
+                        options.tablebases = tablebases.get();
+                        cout << " up to " << tablebases->max_pieces() << " pieces";
+                    } else {
+                        tablebases.reset();
+                    }
+                    cout << endl;
+                }
+            }
+            else if (name == "OwnBook") {
+                own_book = value == "true";
+            }
+            else if (name == "BookBestMove") {
+                // Always the highest-weight move instead of one drawn by weight
+                book_best_move = value == "true";
+            }
+            else if (name == "BookFile") {
+                book.close();
+                if (!value.empty() && value != "<empty>") {
+                    if (book.open(value)) {
+                        cout << "info string book " << value << " with " << book.size() << " entries" << endl;
+                    } else {
+                        cout << "info string failed to open BookFile " << value << endl;
+                    }
+                }
+            }
+            engine.set_options(options);
+        }
+        else if (line == "ucinewgame") {
+            engine.new_game();
+        }
         else if (line.substr(0, 8) == "position") {
-            board = parse_uci_position(line);
+            if (!update_uci_position(position, line)) {
+                cout << "info string invalid position, keeping the previous one" << endl;
+            }
         }
         else if (line.substr(0, 2) == "go") {
-            // Search for best move
-            Move best_move = search_best_move(board, 3); // 3-ply search
+            // go [depth N] [nodes N] [movetime MS] [wtime MS btime MS winc MS binc MS movestogo N]
+            // [mate N]; a plain go searches 3 plies
+            SearchLimits limits = {0, 0, 0};
+            int time_left[2] = {0, 0}, increment[2] = {0, 0}, moves_to_go = 0, mate_moves = 0;
+            Tokenizer tokens(line);
+            tokens.next(); // Skip "go"
+            for (string_view token = tokens.next(); !token.empty(); token = tokens.next()) {
+                // Flags such as infinite and ponder take no value and are ignored
+                auto value = [&tokens]() { return atoll(string(tokens.next()).c_str()); };
+                if (token == "depth") {
+                    limits.depth = max(1, int(value()));
+                } else if (token == "nodes") {
+                    limits.nodes = max(0LL, value());
+                } else if (token == "movetime") {
+                    limits.movetime = max(1, int(value()));
+                } else if (token == "wtime" || token == "btime") {
+                    time_left[token == "btime"] = int(value());
+                } else if (token == "winc" || token == "binc") {
+                    increment[token == "binc"] = int(value());
+                } else if (token == "movestogo") {
+                    moves_to_go = int(value());
+                } else if (token == "mate") {
+                    mate_moves = max(1, int(value()));
+                }
+            }
+            int side = position.board.white_to_move ? 0 : 1;
+            if (limits.movetime == 0 && time_left[side] > 0) {
+                limits.movetime = allocate_time(time_left[side], increment[side], moves_to_go);
+            }
+            const Board& board = position.board;
+            if (mate_moves > 0) {
+                // The proof-number solver only tries checks; when it finds no
+                // mate the full search looks as deep as the mate would be
+                auto start = chrono::steady_clock::now();
+                MateResult mate = mate_solver.solve(board, mate_moves, limits);
+                long long elapsed_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+                if (mate.moves > 0) {
+                    cout << "info depth " << 2 * mate.moves - 1 << " score mate " << mate.moves << " nodes " << mate.nodes
+                         << " nps " << mate.nodes * 1000 / max(1LL, elapsed_ms) << " time " << elapsed_ms << " pv";
+                    for (const Move& move : mate.pv) cout << " " << move_to_uci(move);
+                    cout << endl;
+                    cout << "bestmove " << move_to_uci(mate.pv[0]) << endl;
+                    continue;
+                }
+                cout << "info string no mate in " << mate_moves << " by checks after " << mate.nodes << " nodes"
+                     << (mate.stopped ? " (limit reached)" : "") << endl;
+                if (limits.depth == 0) limits.depth = 2 * mate_moves - 1;
+                // The search gets only what the solver left of the limits
+                if (limits.movetime > 0) limits.movetime = int(max(1LL, limits.movetime - elapsed_ms));
+                if (limits.nodes > 0) limits.nodes = max<uint64_t>(1, limits.nodes - min(limits.nodes, mate.nodes));
+            }
+            if (limits.depth == 0 && limits.nodes == 0 && limits.movetime == 0) limits.depth = 3;
+            
+            Move book_move = own_book ? book.choose(board, book_best_move, book_rng) : Move();
+            if (book_move.from != book_move.to) {
+                cout << "info string book move" << endl;
+                cout << "bestmove " << move_to_uci(book_move) << endl;
+                continue;
+            }
+            
+            auto start = chrono::steady_clock::now();
+            SearchResult result = engine.search(board, limits, position.history);
+            long long elapsed_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
             
-            if (best_move.from != best_move.to) {
-                // Get evaluation for info line
-                int score = evaluate_position(board);
-                cout << "info score cp " << score << endl;
-                cout << "bestmove " << move_to_uci(best_move) << endl;
+            if (result.best_move.from != result.best_move.to) {
+                int mate = mate_in_moves(result.score);
+                cout << "info depth " << result.depth << (mate ? " score mate " : " score cp ")
+                     << (mate ? mate : result.score) << " nodes " << result.nodes
+                     << " nps " << result.nodes * 1000 / max(1LL, elapsed_ms)
+                     << " hashfull " << engine.hashfull() << " tbhits " << result.tb_hits
+                     << " time " << elapsed_ms << " pv";
+                for (const Move& move : result.pv) cout << " " << move_to_uci(move);
+                cout << endl;
+                const SearchContext& context = engine.main_context();
+                cout << "info string pawn hash hit rate "
+                     << int(context.pawn_table.hit_rate() * 100) << "% ("
+                     << context.pawn_table.hits << "/" << context.pawn_table.probes << ")" << endl;
+                cout << "info string eval cache hits " << context.eval_cache.hits
+                     << " full evaluations " << context.eval_cache.evaluations << endl;
+                cout << "bestmove " << move_to_uci(result.best_move) << endl;
             } else {
                 cout << "bestmove a1a1" << endl;
             }
@@ -0,0 +1,465 @@
+#include "commands.h"
+#include "chess.h"
+#include "packed.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// agent4k match --engine1 PATH --engine2 PATH [--games N] [--concurrency N]
+//               [--tc SECONDS+INC | --movetime MS] [--openings EPD]
+//               [--option1 NAME=VALUE] [--option2 NAME=VALUE]
+//               [--sprt ELO0 ELO1 ALPHA BETA]
+//
+// Plays engine1 against engine2, both run as child processes speaking UCI
+// over pipes. Each of the --concurrency workers owns one instance of each
+// engine and plays whole games. Games come in pairs from the same opening
+// with colours swapped; openings are the EPD lines in order, or the
+// starting position. A side loses on time, by crashing or by playing an
+// illegal move. Results are reported as engine1's Elo difference with a
+// 95% error margin and, with --sprt, the log-likelihood ratio of a
+// sequential test of elo1 against elo0, which stops the match once it
+// crosses a bound.
+
+struct MatchOptions {
+    string engines[2];
+    vector<string> engine_options[2]; // setoption commands
+    string openings;
+    uint64_t games = 100;
+    int concurrency = max(1u, thread::hardware_concurrency());
+    int base_time = 10000; // ms per game
+    int increment = 100;   // ms per move
+    int movetime = 0;      // ms per move, replaces the clock when set
+    bool sprt = false;
+    double elo0 = 0, elo1 = 5, alpha = 0.05, beta = 0.05;
+};
+
+// Time given to an engine for the handshake, and for a move beyond its clock
+const int startup_timeout = 10000;
+const int move_timeout_margin = 1000;
+
+// A UCI engine running as a child process
+class UciEngine {
+public:
+    UciEngine() : pid(-1), to_engine(-1), from_engine(-1) {}
+    ~UciEngine() { stop(); }
+    UciEngine(const UciEngine&) = delete;
+    UciEngine& operator=(const UciEngine&) = delete;
+
+    // Launch the engine and complete the uci/isready handshake
+    bool start(const string& path, const vector<string>& options) {
+        stop();
+        int input[2], output[2];
+        if (pipe2(input, O_CLOEXEC) != 0) return false;
+        if (pipe2(output, O_CLOEXEC) != 0) {
+            close(input[0]);
+            close(input[1]);
+            return false;
+        }
+
+        pid = fork();
+        if (pid == 0) {
+            dup2(input[0], STDIN_FILENO);
+            dup2(output[1], STDOUT_FILENO);
+            close(input[0]);
+            close(input[1]);
+            close(output[0]);
+            close(output[1]);
+            execl(path.c_str(), path.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+        close(input[0]);
+        close(output[1]);
+        to_engine = input[1];
+        from_engine = output[0];
+        if (pid < 0) {
+            stop();
+            return false;
+        }
+
+        buffer.clear();
+        name = path;
+        string line;
+        if (!send("uci")) return false;
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(startup_timeout);
+        while (line != "uciok") {
+            if (!read_line(line, deadline)) return false;
+            if (line.compare(0, 8, "id name ") == 0) name = line.substr(8);
+        }
+        for (const string& option : options) {
+            if (!send(option)) return false;
+        }
+        return is_ready();
+    }
+
+    bool is_ready() {
+        if (!send("isready")) return false;
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(startup_timeout);
+        string line;
+        while (line != "readyok") {
+            if (!read_line(line, deadline)) return false;
+        }
+        return true;
+    }
+
+    bool running() const { return pid > 0; }
+
+    bool send(const string& command) {
+        string line = command + "\n";
+        const char* bytes = line.data();
+        size_t remaining = line.size();
+        while (remaining > 0) {
+            ssize_t written = write(to_engine, bytes, remaining);
+            if (written <= 0) return false;
+            bytes += written;
+            remaining -= written;
+        }
+        return true;
+    }
+
+    // Next output line, without the line ending; false on timeout or exit
+    bool read_line(string& line, chrono::steady_clock::time_point deadline) {
+        while (true) {
+            size_t end = buffer.find('\n');
+            if (end != string::npos) {
+                line = buffer.substr(0, end);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                buffer.erase(0, end + 1);
+                return true;
+            }
+
+            auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+            if (left.count() <= 0) return false;
+            pollfd descriptor = {from_engine, POLLIN, 0};
+            if (poll(&descriptor, 1, int(min<int64_t>(left.count(), 1000000))) <= 0) continue;
+
+            char chunk[4096];
+            ssize_t length = read(from_engine, chunk, sizeof(chunk));
+            if (length <= 0) return false;
+            buffer.append(chunk, length);
+        }
+    }
+
+    // Ask the engine to quit, and kill it if it does not
+    void stop() {
+        if (to_engine >= 0) {
+            send("quit");
+            close(to_engine);
+        }
+        if (from_engine >= 0) close(from_engine);
+        to_engine = from_engine = -1;
+        if (pid <= 0) {
+            pid = -1;
+            return;
+        }
+        for (int i = 0; i < 100 && waitpid(pid, nullptr, WNOHANG) == 0; i++) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            if (i == 99) {
+                kill(pid, SIGKILL);
+                waitpid(pid, nullptr, 0);
+            }
+        }
+        pid = -1;
+    }
+
+    string name; // From "id name", or the path
+
+private:
+    pid_t pid;
+    int to_engine;
+    int from_engine;
+    string buffer; // Output read but not yet returned
+};
+
+struct GameResult {
+    int result; // packed_result_*
+    string reason;
+    bool forfeit; // Lost by a failing engine, which is restarted afterwards
+};
+
+// Play one game from the opening; engines[0] has white
+static GameResult play_game(UciEngine* engines[2], const Board& opening, const MatchOptions& options) {
+    Board board = opening;
+    vector<uint64_t> history(1, board.hash);
+    string position = "position fen " + board_to_fen(board) + " moves";
+    int clock[2] = {options.base_time, options.base_time}; // By colour, white first
+
+    for (UciEngine* engine : {engines[0], engines[1]}) {
+        if (!engine->send("ucinewgame") || !engine->is_ready()) {
+            bool white = engine == engines[0];
+            return {white ? packed_result_black_win : packed_result_white_win, "engine not ready", true};
+        }
+    }
+
+    while (true) {
+        vector<Move> moves = generate_all_legal_moves(board);
+        if (moves.empty()) {
+            if (!is_in_check(board, board.white_to_move)) return {packed_result_draw, "stalemate", false};
+            return {board.white_to_move ? packed_result_black_win : packed_result_white_win, "checkmate", false};
+        }
+        if (board.halfmove_clock >= 100) return {packed_result_draw, "fifty moves", false};
+        if (is_threefold_repetition(board, history)) return {packed_result_draw, "threefold repetition", false};
+        if (is_insufficient_material(board)) return {packed_result_draw, "insufficient material", false};
+
+        int side = board.white_to_move ? 0 : 1;
+        int loss = side == 0 ? packed_result_black_win : packed_result_white_win;
+        UciEngine& engine = *engines[side];
+
+        string go = "go movetime " + to_string(options.movetime);
+        int allowed = options.movetime + move_timeout_margin;
+        if (options.movetime == 0) {
+            go = "go wtime " + to_string(clock[0]) + " btime " + to_string(clock[1]) +
+                 " winc " + to_string(options.increment) + " binc " + to_string(options.increment);
+            allowed = clock[side];
+        }
+
+        auto start = chrono::steady_clock::now();
+        if (!engine.send(position) || !engine.send(go)) return {loss, "engine disconnected", true};
+        string line;
+        auto deadline = start + chrono::milliseconds(allowed);
+        while (line.compare(0, 9, "bestmove ") != 0) {
+            if (!engine.read_line(line, deadline)) {
+                bool timeout = chrono::steady_clock::now() >= deadline;
+                return {loss, timeout ? "loss on time" : "engine disconnected", true};
+            }
+        }
+        if (options.movetime == 0) {
+            int elapsed = int(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count());
+            if (elapsed > clock[side]) return {loss, "loss on time", false};
+            clock[side] += options.increment - elapsed;
+        }
+
+        Tokenizer tokens(string_view(line).substr(9));
+        string_view uci = tokens.next();
+        auto played = find_if(moves.begin(), moves.end(), [&](const Move& move) { return move_to_uci(move) == uci; });
+        if (played == moves.end()) return {loss, "illegal move " + string(uci), true};
+
+        make_move_simple(board, *played);
+        history.push_back(board.hash);
+        position += " " + string(uci);
+    }
+}
+
+// Shared between the worker threads
+struct MatchState {
+    mutex lock; // Guards everything below and the output
+    vector<Board> openings;
+    uint64_t games_started = 0;
+    uint64_t games_finished = 0;
+    uint64_t wins = 0, draws = 0, losses = 0; // For engine1
+    bool stop = false;
+    string sprt_verdict;
+    string names[2];
+};
+
+// Score statistics of engine1 from its wins, draws and losses
+struct MatchScore {
+    double games;
+    double score;    // Mean points per game
+    double variance; // Per game
+};
+
+static MatchScore match_score(uint64_t wins, uint64_t draws, uint64_t losses) {
+    MatchScore result;
+    result.games = double(wins + draws + losses);
+    if (result.games == 0) return {0, 0.5, 0};
+    result.score = (wins + 0.5 * draws) / result.games;
+    double s = result.score;
+    result.variance = (wins * (1 - s) * (1 - s) + draws * (0.5 - s) * (0.5 - s) + losses * s * s) / result.games;
+    return result;
+}
+
+static double score_to_elo(double score) {
+    score = min(max(score, 1e-6), 1 - 1e-6);
+    return -400 * log10(1 / score - 1);
+}
+
+static double elo_to_score(double elo) {
+    return 1 / (1 + pow(10, -elo / 400));
+}
+
+// Generalised SPRT log-likelihood ratio for elo1 against elo0, from the
+// normal approximation of the game score
+static double sprt_llr(const MatchScore& score, double elo0, double elo1) {
+    if (score.variance <= 0) return 0;
+    double s0 = elo_to_score(elo0), s1 = elo_to_score(elo1);
+    return score.games * (s1 - s0) * (2 * score.score - s0 - s1) / (2 * score.variance);
+}
+
+static void print_score(MatchState& state, const MatchOptions& options) {
+    MatchScore score = match_score(state.wins, state.draws, state.losses);
+    cout << "Score of " << state.names[0] << " vs " << state.names[1] << ": " << state.wins << " - "
+         << state.losses << " - " << state.draws << " [" << fixed << setprecision(3) << score.score << "] "
+         << state.games_finished << endl;
+
+    if (score.games < 2) return;
+    double margin = 1.96 * sqrt(score.variance / score.games);
+    double elo = score_to_elo(score.score);
+    double error = (score_to_elo(score.score + margin) - score_to_elo(score.score - margin)) / 2;
+    cout << "Elo difference: " << setprecision(1) << elo << " +/- " << error << endl;
+
+    if (!options.sprt) return;
+    double lower = log(options.beta / (1 - options.alpha));
+    double upper = log((1 - options.beta) / options.alpha);
+    double llr = sprt_llr(score, options.elo0, options.elo1);
+    cout << "SPRT: llr " << setprecision(2) << llr << " (" << lower << ", " << upper << ") [" << options.elo0
+         << ", " << options.elo1 << "]";
+    if (llr >= upper) state.sprt_verdict = "H1 accepted";
+    if (llr <= lower) state.sprt_verdict = "H0 accepted";
+    if (!state.sprt_verdict.empty()) {
+        cout << " - " << state.sprt_verdict;
+        state.stop = true;
+    }
+    cout << endl;
+}
+
+static void match_thread(const MatchOptions& options, MatchState& state) {
+    UciEngine engines[2];
+    while (true) {
+        uint64_t game;
+        {
+            lock_guard<mutex> guard(state.lock);
+            if (state.stop || state.games_started >= options.games) return;
+            game = state.games_started++;
+        }
+
+        // Start the engines, or restart them after a forfeit
+        for (int i = 0; i < 2; i++) {
+            if (engines[i].running()) continue;
+            bool started = engines[i].start(options.engines[i], options.engine_options[i]);
+            lock_guard<mutex> guard(state.lock);
+            if (!started) {
+                cerr << "Cannot start " << options.engines[i] << endl;
+                state.stop = true;
+                return;
+            }
+            state.names[i] = engines[i].name;
+        }
+
+        // Pairs of games share an opening; engine1 has white in the first
+        const Board& opening = state.openings[(game / 2) % state.openings.size()];
+        bool engine1_white = game % 2 == 0;
+        UciEngine* players[2] = {&engines[engine1_white ? 0 : 1], &engines[engine1_white ? 1 : 0]};
+        GameResult result = play_game(players, opening, options);
+        if (result.forfeit) {
+            // A late engine may still be searching, and its output would
+            // confuse the next game
+            players[0]->stop();
+            players[1]->stop();
+        }
+
+        lock_guard<mutex> guard(state.lock);
+        state.games_finished++;
+        bool draw = result.result == packed_result_draw;
+        bool white_won = result.result == packed_result_white_win;
+        if (draw) {
+            state.draws++;
+        } else if (white_won == engine1_white) {
+            state.wins++;
+        } else {
+            state.losses++;
+        }
+        cout << "Game " << game + 1 << " (" << players[0]->name << " vs " << players[1]->name << "): "
+             << game_result_string(result.result) << " {" << result.reason << "}" << endl;
+        print_score(state, options);
+    }
+}
+
+// "10+0.1" in seconds
+static bool parse_time_control(const string& text, MatchOptions& options) {
+    char* end;
+    double base = strtod(text.c_str(), &end);
+    double increment = 0;
+    if (*end == '+') increment = strtod(end + 1, &end);
+    if (*end != '\0' || base <= 0 || increment < 0) return false;
+    options.base_time = int(base * 1000);
+    options.increment = int(increment * 1000);
+    options.movetime = 0;
+    return true;
+}
+
+int match_command(int argc, char* argv[]) {
+    MatchOptions options;
+    bool valid = true;
+    for (int i = 0; i < argc && valid; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if ((arg == "--engine1" || arg == "--engine2") && has_value) {
+            options.engines[arg == "--engine2"] = argv[++i];
+        } else if ((arg == "--option1" || arg == "--option2") && has_value) {
+            string option = argv[++i];
+            size_t equals = option.find('=');
+            string name = option.substr(0, equals);
+            string value = equals == string::npos ? "" : option.substr(equals + 1);
+            options.engine_options[arg == "--option2"].push_back("setoption name " + name + " value " + value);
+        } else if (arg == "--openings" && has_value) {
+            options.openings = argv[++i];
+        } else if (arg == "--games" && has_value) {
+            options.games = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--concurrency" && has_value) {
+            options.concurrency = max(1, atoi(argv[++i]));
+        } else if (arg == "--tc" && has_value) {
+            valid = parse_time_control(argv[++i], options);
+        } else if (arg == "--movetime" && has_value) {
+            options.movetime = max(1, atoi(argv[++i]));
+        } else if (arg == "--sprt" && i + 4 < argc) {
+            options.sprt = true;
+            options.elo0 = atof(argv[++i]);
+            options.elo1 = atof(argv[++i]);
+            options.alpha = atof(argv[++i]);
+            options.beta = atof(argv[++i]);
+            valid = options.elo0 < options.elo1 && options.alpha > 0 && options.alpha < 1 &&
+                    options.beta > 0 && options.beta < 1;
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid || options.engines[0].empty() || options.engines[1].empty() || options.games == 0) {
+        cerr << "Usage: agent4k match --engine1 PATH --engine2 PATH [--games N] [--concurrency N]" << endl
+             << "                     [--tc SECONDS+INC | --movetime MS] [--openings EPD]" << endl
+             << "                     [--option1 NAME=VALUE] [--option2 NAME=VALUE]" << endl
+             << "                     [--sprt ELO0 ELO1 ALPHA BETA]" << endl;
+        return 1;
+    }
+
+    MatchState state;
+    if (!options.openings.empty()) {
+        EpdReader reader(options.openings);
+        if (!reader.is_open()) {
+            cerr << "Cannot open " << options.openings << endl;
+            return 1;
+        }
+        string_view line;
+        while (reader.next_line(line)) {
+            Board opening;
+            if (parse_epd(line, opening)) {
+                state.openings.push_back(opening);
+            } else {
+                cerr << "Skipping invalid opening: " << line << endl;
+            }
+        }
+    }
+    if (state.openings.empty()) state.openings.push_back(create_starting_position());
+    state.names[0] = options.engines[0];
+    state.names[1] = options.engines[1];
+
+    // Writes to an engine that exited fail instead of killing the match
+    signal(SIGPIPE, SIG_IGN);
+
+    vector<thread> threads;
+    int workers = int(min<uint64_t>(options.concurrency, options.games));
+    for (int i = 0; i < workers; i++) threads.emplace_back(match_thread, cref(options), ref(state));
+    for (thread& t : threads) t.join();
+
+    if (state.games_finished == 0) return 1;
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include "mate.h"
+#include <algorithm>
+
+// Proof and disproof numbers of solved positions: a proven mate has proof
+// 0 and disproof infinite, a refuted one the reverse
+const uint32_t pn_infinite = 1u << 30;
+
+static uint32_t add_saturated(uint32_t a, uint32_t b) {
+    return min(a + b, pn_infinite);
+}
+
+// The same position with a different number of plies left is a different
+// problem, so the plies are mixed into the key
+static uint64_t node_key(const Board& board, int plies) {
+    return board.hash ^ (uint64_t(plies + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+MateResult::MateResult() : moves(0), nodes(0), stopped(false) {}
+
+MateSolver::MateSolver(size_t megabytes)
+    : entries(nullptr), buckets(0), nodes(0), node_limit(0), has_deadline(false), stopped(false), root_key(0) {
+    resize(megabytes);
+}
+
+void MateSolver::resize(size_t megabytes) {
+    buckets = 0;
+    if (megabytes > 0) {
+        buckets = 1;
+        while (buckets * 2 * 4 * sizeof(Entry) <= megabytes * 1024 * 1024) buckets *= 2;
+    }
+    if (!memory.allocate(buckets * 4 * sizeof(Entry), true)) buckets = 0;
+    entries = static_cast<Entry*>(memory.data());
+}
+
+void MateSolver::clear() {
+    memory.zero();
+}
+
+MateSolver::Entry* MateSolver::probe(uint64_t key) {
+    if (buckets == 0) return nullptr;
+    Entry* bucket = entries + (key & (buckets - 1)) * 4;
+    for (int i = 0; i < 4; i++) {
+        if (bucket[i].key == key) return &bucket[i];
+    }
+    return nullptr;
+}
+
+// Replaces the entry with the least work behind it, judged by its proof
+// and disproof numbers; solved entries are kept while unsolved ones remain
+void MateSolver::store(uint64_t key, uint32_t proof, uint32_t disproof) {
+    if (buckets == 0) return;
+    Entry* bucket = entries + (key & (buckets - 1)) * 4;
+    Entry* victim = &bucket[0];
+    uint64_t least = UINT64_MAX;
+    for (int i = 0; i < 4; i++) {
+        if (bucket[i].key == key || bucket[i].key == 0) {
+            victim = &bucket[i];
+            break;
+        }
+        bool solved = bucket[i].proof == 0 || bucket[i].disproof == 0;
+        uint64_t work = solved ? UINT64_MAX - 1 : uint64_t(bucket[i].proof) + bucket[i].disproof;
+        if (work < least) {
+            least = work;
+            victim = &bucket[i];
+        }
+    }
+    victim->key = key;
+    victim->proof = proof;
+    victim->disproof = disproof;
+}
+
+// Positions not in the table count as one position each to prove or refute
+void MateSolver::lookup(const Board& board, int plies, uint32_t& proof, uint32_t& disproof) {
+    const Entry* entry = probe(node_key(board, plies));
+    proof = entry ? entry->proof : 1;
+    disproof = entry ? entry->disproof : 1;
+}
+
+bool MateSolver::out_of_time() {
+    if (stopped) return true;
+    if (node_limit && nodes >= node_limit) {
+        stopped = true;
+    } else if (has_deadline && (nodes & 1023) == 0) {
+        stopped = chrono::steady_clock::now() >= deadline;
+    }
+    return stopped;
+}
+
+// Searches below the position until its proof number reaches
+// proof_threshold or its disproof number disproof_threshold, then stores
+// both. The attacker is to move when plies is odd: its proof number is the
+// smallest of its children's, its disproof number their sum, and the other
+// way round for the defender. The child searched is the one that decides
+// the node's smaller number, with thresholds that return control once
+// another child would be better.
+void MateSolver::expand(const Board& board, int plies, uint32_t proof_threshold, uint32_t disproof_threshold) {
+    if (out_of_time()) return;
+    nodes++;
+    bool attacker = plies % 2 == 1;
+    uint64_t key = node_key(board, plies);
+
+    vector<Board> children;
+    vector<Move> moves;
+    for (const Move& move : generate_all_legal_moves(board)) {
+        if (attacker && !gives_check(board, move)) continue;
+        Board child = board;
+        make_move_simple(child, move);
+        children.push_back(child);
+        moves.push_back(move);
+        if (!attacker && plies == 0) break; // Not mated, which is all that matters here
+    }
+    if (children.empty() || plies == 0) {
+        bool mated = !attacker && children.empty() && is_in_check(board, board.white_to_move);
+        store(key, mated ? 0 : pn_infinite, mated ? pn_infinite : 0);
+        return;
+    }
+
+    while (true) {
+        uint32_t proof = attacker ? pn_infinite : 0;
+        uint32_t disproof = attacker ? 0 : pn_infinite;
+        size_t best = 0;
+        uint32_t best_value = pn_infinite, second_value = pn_infinite;
+        uint32_t best_proof = 0, best_disproof = 0;
+        for (size_t i = 0; i < children.size(); i++) {
+            uint32_t child_proof, child_disproof;
+            lookup(children[i], plies - 1, child_proof, child_disproof);
+            if (attacker) {
+                proof = min(proof, child_proof);
+                disproof = add_saturated(disproof, child_disproof);
+            } else {
+                proof = add_saturated(proof, child_proof);
+                disproof = min(disproof, child_disproof);
+            }
+            uint32_t value = attacker ? child_proof : child_disproof;
+            if (value < best_value) {
+                second_value = best_value;
+                best_value = value;
+                best = i;
+                best_proof = child_proof;
+                best_disproof = child_disproof;
+            } else if (value < second_value) {
+                second_value = value;
+            }
+        }
+
+        if (proof >= proof_threshold || disproof >= disproof_threshold || stopped) {
+            if (proof == 0 && key == root_key) root_move = moves[best]; // The check that proves it
+            store(key, proof, disproof);
+            return;
+        }
+
+        uint32_t next = add_saturated(second_value, 1);
+        if (attacker) {
+            expand(children[best], plies - 1, min(proof_threshold, next),
+                   disproof_threshold - disproof + best_disproof);
+        } else {
+            expand(children[best], plies - 1, proof_threshold - proof + best_proof,
+                   min(disproof_threshold, next));
+        }
+    }
+}
+
+bool MateSolver::prove(const Board& board, int plies) {
+    root_key = node_key(board, plies);
+    expand(board, plies, pn_infinite, pn_infinite);
+    uint32_t proof, disproof;
+    lookup(board, plies, proof, disproof);
+    return !stopped && proof == 0;
+}
+
+// The fewest plies, from plies up to max_plies in steps of two, in which
+// the position is a forced mate; -1 if there is none or a limit was reached
+int MateSolver::shortest_mate(const Board& board, int plies, int max_plies) {
+    for (; plies <= max_plies && !stopped; plies += 2) {
+        if (prove(board, plies)) return plies;
+    }
+    return -1;
+}
+
+MateResult MateSolver::solve(const Board& board, int moves, const SearchLimits& limits) {
+    MateResult result;
+    nodes = 0;
+    node_limit = limits.nodes;
+    has_deadline = limits.movetime > 0;
+    deadline = chrono::steady_clock::now() + chrono::milliseconds(limits.movetime);
+    stopped = false;
+
+    int plies = shortest_mate(board, 1, 2 * moves - 1);
+    result.nodes = nodes;
+    result.stopped = stopped;
+    if (plies < 0) return result;
+    result.moves = (plies + 1) / 2;
+
+    // The proof's first check mates soonest, since shorter mates were
+    // ruled out first. Past it, follow the reply that delays the mate
+    // longest and the check that mates soonest. Most proofs are still in
+    // the table, so this is usually quick; it may use as many nodes again
+    // as the search, and what it has followed when a limit is reached is
+    // the PV.
+    result.pv.push_back(root_move);
+    Board position = board;
+    make_move_simple(position, root_move);
+    plies--;
+    node_limit = nodes + max<uint64_t>(nodes, 10000);
+    if (limits.nodes) node_limit = min(node_limit, limits.nodes);
+    while (plies > 0) {
+        bool attacker = plies % 2 == 1;
+        Move chosen;
+        int chosen_plies = attacker ? plies : -1;
+        for (const Move& move : generate_all_legal_moves(position)) {
+            if (attacker && !gives_check(position, move)) continue;
+            Board child = position;
+            make_move_simple(child, move);
+            int child_plies = shortest_mate(child, attacker ? 0 : 1, plies - 1);
+            if (child_plies < 0) continue;
+            if (attacker ? child_plies < chosen_plies : child_plies > chosen_plies) {
+                chosen = move;
+                chosen_plies = child_plies;
+            }
+        }
+        if (chosen.from == chosen.to || stopped) break; // Mated, or the choice is incomplete
+        result.pv.push_back(chosen);
+        make_move_simple(position, chosen);
+        plies = chosen_plies;
+    }
+    return result;
+}
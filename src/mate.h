@@ -0,0 +1,60 @@
+#pragma once
+#include "chess.h"
+
+// Mate search by depth-first proof-number search (df-pn). The attacker
+// tries only checking moves and the defender every legal reply, so the
+// tree stays narrow, and nodes are expanded where the fewest positions
+// remain to prove or refute rather than in depth order. Only mates in
+// which every attacking move gives check are found.
+//
+// Proof and disproof numbers live in the solver's own table, keyed by
+// position and the plies left, and are kept between searches.
+
+struct MateResult {
+    int moves;       // Moves to mate, 0 if none was found
+    vector<Move> pv; // The mate, the defender resisting longest
+    uint64_t nodes;
+    bool stopped;    // A limit ended the search before mates up to the requested length were ruled out
+
+    MateResult();
+};
+
+class MateSolver {
+public:
+    explicit MateSolver(size_t megabytes = 16); // Rounded down to a power of two
+    MateSolver(const MateSolver&) = delete;
+    MateSolver& operator=(const MateSolver&) = delete;
+
+    void resize(size_t megabytes);
+    void clear();
+
+    // The shortest mate in at most moves moves for the side to move.
+    // Limits are as for search; the depth limit is ignored.
+    MateResult solve(const Board& board, int moves, const SearchLimits& limits);
+
+private:
+    struct Entry {
+        uint64_t key;      // Position hash mixed with the plies left
+        uint32_t proof;    // Proof number: positions left to prove the mate
+        uint32_t disproof; // Disproof number: positions left to refute it
+    };
+
+    Entry* probe(uint64_t key);
+    void store(uint64_t key, uint32_t proof, uint32_t disproof);
+    void lookup(const Board& board, int plies, uint32_t& proof, uint32_t& disproof);
+    void expand(const Board& board, int plies, uint32_t proof_threshold, uint32_t disproof_threshold);
+    bool prove(const Board& board, int plies);
+    int shortest_mate(const Board& board, int plies, int max_plies);
+    bool out_of_time();
+
+    LargeBuffer memory;
+    Entry* entries;
+    size_t buckets; // Of four entries, one cache line
+    uint64_t nodes;
+    uint64_t node_limit;
+    bool has_deadline;
+    chrono::steady_clock::time_point deadline;
+    bool stopped;
+    uint64_t root_key; // Node proved by prove(), whose proving check is recorded
+    Move root_move;
+};
@@ -0,0 +1,303 @@
+#include "nnue.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <immintrin.h>
+
+// Quantisation: accumulators are clipped to [0, nnue_clip] and the output
+// sum is at scale nnue_clip * nnue_output_quant
+const int nnue_clip = 255;
+const int nnue_output_quant = 64;
+const int nnue_output_scale = 400;
+const int nnue_max_score = 15000; // Keep clear of the mate scores
+
+const char nnue_magic[8] = {'A', '4', 'K', 'N', 'N', 'U', 'E', '1'};
+
+// SIMD kernels. apply computes out = in + sum(adds) - sum(subs) over one
+// perspective's accumulator; dot computes the output layer's weighted sum.
+typedef void (*ApplyKernel)(int16_t* out, const int16_t* in,
+                            const int16_t* const* adds, int add_count,
+                            const int16_t* const* subs, int sub_count);
+typedef int32_t (*DotKernel)(const int16_t* us, const int16_t* them, const int16_t* weights);
+
+static void apply_scalar(int16_t* out, const int16_t* in,
+                         const int16_t* const* adds, int add_count,
+                         const int16_t* const* subs, int sub_count) {
+    for (int i = 0; i < nnue_hidden_size; i++) {
+        int16_t value = in[i];
+        for (int a = 0; a < add_count; a++) value += adds[a][i];
+        for (int s = 0; s < sub_count; s++) value -= subs[s][i];
+        out[i] = value;
+    }
+}
+
+static int32_t dot_scalar(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    int32_t sum = 0;
+    for (int i = 0; i < nnue_hidden_size; i++) {
+        sum += min(max<int32_t>(us[i], 0), nnue_clip) * weights[i];
+        sum += min(max<int32_t>(them[i], 0), nnue_clip) * weights[nnue_hidden_size + i];
+    }
+    return sum;
+}
+
+__attribute__((target("sse4.1")))
+static void apply_sse41(int16_t* out, const int16_t* in,
+                        const int16_t* const* adds, int add_count,
+                        const int16_t* const* subs, int sub_count) {
+    for (int i = 0; i < nnue_hidden_size; i += 8) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        for (int a = 0; a < add_count; a++) {
+            value = _mm_add_epi16(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(adds[a] + i)));
+        }
+        for (int s = 0; s < sub_count; s++) {
+            value = _mm_sub_epi16(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(subs[s] + i)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), value);
+    }
+}
+
+__attribute__((target("sse4.1")))
+static int32_t dot_sse41(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i clip = _mm_set1_epi16(nnue_clip);
+    __m128i sum = _mm_setzero_si128();
+
+    for (int half = 0; half < 2; half++) {
+        const int16_t* values = half == 0 ? us : them;
+        const int16_t* half_weights = weights + half * nnue_hidden_size;
+        for (int i = 0; i < nnue_hidden_size; i += 8) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+            v = _mm_min_epi16(_mm_max_epi16(v, zero), clip);
+            __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(half_weights + i));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(v, w));
+        }
+    }
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static void apply_avx2(int16_t* out, const int16_t* in,
+                       const int16_t* const* adds, int add_count,
+                       const int16_t* const* subs, int sub_count) {
+    for (int i = 0; i < nnue_hidden_size; i += 16) {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        for (int a = 0; a < add_count; a++) {
+            value = _mm256_add_epi16(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(adds[a] + i)));
+        }
+        for (int s = 0; s < sub_count; s++) {
+            value = _mm256_sub_epi16(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(subs[s] + i)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), value);
+    }
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_avx2(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i clip = _mm256_set1_epi16(nnue_clip);
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int half = 0; half < 2; half++) {
+        const int16_t* values = half == 0 ? us : them;
+        const int16_t* half_weights = weights + half * nnue_hidden_size;
+        for (int i = 0; i < nnue_hidden_size; i += 16) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+            v = _mm256_min_epi16(_mm256_max_epi16(v, zero), clip);
+            __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(half_weights + i));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(v, w));
+        }
+    }
+
+    __m128i low = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    low = _mm_add_epi32(low, _mm_shuffle_epi32(low, 0x4e));
+    low = _mm_add_epi32(low, _mm_shuffle_epi32(low, 0xb1));
+    return _mm_cvtsi128_si32(low);
+}
+
+struct NnueKernels {
+    ApplyKernel apply;
+    DotKernel dot;
+    const char* name;
+};
+
+// Pick the widest kernels the CPU supports, once
+static const NnueKernels& nnue_kernels() {
+    static const NnueKernels kernels = []() {
+        if (__builtin_cpu_supports("avx2")) return NnueKernels{apply_avx2, dot_avx2, "avx2"};
+        if (__builtin_cpu_supports("sse4.1")) return NnueKernels{apply_sse41, dot_sse41, "sse4.1"};
+        return NnueKernels{apply_scalar, dot_scalar, "scalar"};
+    }();
+    return kernels;
+}
+
+const char* nnue_simd_name() {
+    return nnue_kernels().name;
+}
+
+// Feature index of a piece on a square, seen from one side with its king on
+// king_square. Black's view is mirrored vertically so both sides see their
+// own pieces moving up the board.
+static int feature_index(int perspective, int king_square, int piece, int square) {
+    if (perspective == 1) {
+        king_square ^= 56;
+        square ^= 56;
+    }
+    bool own = (piece > 0) == (perspective == 0);
+    int piece_index = (own ? 0 : 6) + abs(piece) - 1;
+    return (king_square * 12 + piece_index) * 64 + square;
+}
+
+static int find_king(const Board& board, int perspective) {
+    int king = perspective == 0 ? 6 : -6;
+    for (int square = 0; square < 64; square++) {
+        if (board.squares[square] == king) return square;
+    }
+    return -1;
+}
+
+NnueNetwork::NnueNetwork()
+    : feature_weights(size_t(nnue_input_size) * nnue_hidden_size, 0),
+      feature_biases(nnue_hidden_size, 0),
+      output_weights(2 * nnue_hidden_size, 0),
+      output_bias(0) {}
+
+bool NnueNetwork::load(const string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    char magic[8];
+    uint32_t input_size = 0, hidden_size = 0;
+    bool ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, nnue_magic, 8) == 0 &&
+              fread(&input_size, 4, 1, file) == 1 && input_size == uint32_t(nnue_input_size) &&
+              fread(&hidden_size, 4, 1, file) == 1 && hidden_size == uint32_t(nnue_hidden_size);
+
+    // Read into temporaries so a truncated file leaves the network unchanged
+    vector<int16_t> weights(feature_weights.size()), biases(feature_biases.size());
+    vector<int16_t> outputs(output_weights.size());
+    int32_t bias = 0;
+    ok = ok && fread(weights.data(), sizeof(int16_t), weights.size(), file) == weights.size() &&
+         fread(biases.data(), sizeof(int16_t), biases.size(), file) == biases.size() &&
+         fread(outputs.data(), sizeof(int16_t), outputs.size(), file) == outputs.size() &&
+         fread(&bias, sizeof(int32_t), 1, file) == 1;
+    fclose(file);
+    if (!ok) return false;
+
+    feature_weights.swap(weights);
+    feature_biases.swap(biases);
+    output_weights.swap(outputs);
+    output_bias = bias;
+    return true;
+}
+
+bool NnueNetwork::save(const string& path) const {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    uint32_t input_size = nnue_input_size, hidden_size = nnue_hidden_size;
+    bool ok = fwrite(nnue_magic, 1, 8, file) == 8 &&
+              fwrite(&input_size, 4, 1, file) == 1 &&
+              fwrite(&hidden_size, 4, 1, file) == 1 &&
+              fwrite(feature_weights.data(), sizeof(int16_t), feature_weights.size(), file) == feature_weights.size() &&
+              fwrite(feature_biases.data(), sizeof(int16_t), feature_biases.size(), file) == feature_biases.size() &&
+              fwrite(output_weights.data(), sizeof(int16_t), output_weights.size(), file) == output_weights.size() &&
+              fwrite(&output_bias, sizeof(int32_t), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+void NnueNetwork::randomize(uint64_t seed) {
+    auto next = [&seed]() {
+        seed += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    };
+    for (int16_t& w : feature_weights) w = int16_t(int(next() % 17) - 8);
+    for (int16_t& b : feature_biases) b = int16_t(next() % 64);
+    for (int16_t& w : output_weights) w = int16_t(int(next() % 65) - 32);
+    output_bias = 0;
+}
+
+void NnueNetwork::refresh_perspective(const Board& board, int perspective, int king_square,
+                                      NnueAccumulator& accumulator) const {
+    const int16_t* columns[64];
+    int count = 0;
+    for (int square = 0; square < 64 && king_square != -1; square++) {
+        int piece = board.squares[square];
+        if (piece == 0) continue;
+        columns[count++] = &feature_weights[size_t(feature_index(perspective, king_square, piece, square)) * nnue_hidden_size];
+    }
+    accumulator.king_squares[perspective] = king_square;
+    nnue_kernels().apply(accumulator.values[perspective], feature_biases.data(),
+                         columns, count, nullptr, 0);
+}
+
+void NnueNetwork::refresh(const Board& board, NnueAccumulator& accumulator) const {
+    for (int perspective = 0; perspective < 2; perspective++) {
+        refresh_perspective(board, perspective, find_king(board, perspective), accumulator);
+    }
+}
+
+void NnueNetwork::update(const Board& parent, const Move& move, const NnueAccumulator& parent_accumulator,
+                         const Board& child, NnueAccumulator& child_accumulator) const {
+    // The pieces the move takes off and puts on squares: at most two of each
+    struct Change {
+        int piece;
+        int square;
+    };
+    Change removed[2], placed[2];
+    int removed_count = 0, placed_count = 0;
+    int piece = parent.squares[move.from];
+    int promotion = move.promotion();
+    removed[removed_count++] = {piece, move.from};
+    placed[placed_count++] = {promotion == 0 ? piece : piece > 0 ? promotion : -promotion, move.to};
+    if (move.is_castling()) {
+        int rook_from = move.to > move.from ? move.from + 3 : move.from - 4;
+        int rook_to = move.to > move.from ? move.from + 1 : move.from - 1;
+        removed[removed_count++] = {parent.squares[rook_from], rook_from};
+        placed[placed_count++] = {parent.squares[rook_from], rook_to};
+    } else if (move.is_en_passant()) {
+        int captured = piece > 0 ? move.to - 8 : move.to + 8;
+        removed[removed_count++] = {parent.squares[captured], captured};
+    } else if (parent.squares[move.to] != 0) {
+        removed[removed_count++] = {parent.squares[move.to], move.to};
+    }
+
+    for (int perspective = 0; perspective < 2; perspective++) {
+        int king_square = parent_accumulator.king_squares[perspective];
+
+        // Every feature depends on our king's square, so a king move (including
+        // castling) means rebuilding this perspective from scratch
+        if (piece == (perspective == 0 ? 6 : -6)) {
+            refresh_perspective(child, perspective, move.to, child_accumulator);
+            continue;
+        }
+        if (king_square == -1) {
+            refresh_perspective(child, perspective, -1, child_accumulator);
+            continue;
+        }
+
+        const int16_t* adds[2];
+        const int16_t* subs[2];
+        for (int i = 0; i < placed_count; i++) {
+            adds[i] = &feature_weights[size_t(feature_index(perspective, king_square, placed[i].piece, placed[i].square)) * nnue_hidden_size];
+        }
+        for (int i = 0; i < removed_count; i++) {
+            subs[i] = &feature_weights[size_t(feature_index(perspective, king_square, removed[i].piece, removed[i].square)) * nnue_hidden_size];
+        }
+        child_accumulator.king_squares[perspective] = king_square;
+        nnue_kernels().apply(child_accumulator.values[perspective], parent_accumulator.values[perspective],
+                             adds, placed_count, subs, removed_count);
+    }
+}
+
+int NnueNetwork::evaluate(const NnueAccumulator& accumulator, bool white_to_move) const {
+    int us = white_to_move ? 0 : 1;
+    int64_t sum = nnue_kernels().dot(accumulator.values[us], accumulator.values[1 - us],
+                                     output_weights.data());
+    int64_t score = (sum + output_bias) * nnue_output_scale / (nnue_clip * nnue_output_quant);
+    return int(max<int64_t>(-nnue_max_score, min<int64_t>(nnue_max_score, score)));
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "chess.h"
+
+// Efficiently updatable neural network (NNUE) evaluation.
+//
+// Input layer: HalfKA features, one per (king square, piece, square) as seen
+// from each side, so 64 * 12 * 64 inputs per perspective. The first layer
+// sums the weight columns of the active features into an accumulator of
+// nnue_hidden_size int16 values per perspective. Moves change only a few
+// features, so a child's accumulator is its parent's plus and minus a few
+// columns, read off the move itself; only a king move forces a full
+// refresh of that perspective.
+//
+// Output layer: clipped ReLU of both accumulators (side to move first),
+// dotted with int16 weights.
+//
+// Weight file layout (little-endian): the 8-byte magic "A4KNNUE1", uint32
+// input size, uint32 hidden size, then int16 feature weights
+// [input][hidden], int16 feature biases [hidden], int16 output weights
+// [2 * hidden] and one int32 output bias.
+
+const int nnue_input_size = 64 * 12 * 64;
+const int nnue_hidden_size = 256;
+
+struct alignas(64) NnueAccumulator {
+    int16_t values[2][nnue_hidden_size]; // [0] white's perspective, [1] black's
+    int king_squares[2];                 // The kings the values were built for, -1 if missing
+};
+
+class NnueNetwork {
+public:
+    NnueNetwork();
+
+    bool load(const string& path); // False if the file is missing or malformed
+    bool save(const string& path) const;
+    void randomize(uint64_t seed); // Small random weights, for tests and benchmarks
+
+    // Build an accumulator from scratch
+    void refresh(const Board& board, NnueAccumulator& accumulator) const;
+
+    // Derive a child's accumulator from its parent's after one move. The
+    // changed features come from the move's squares and flags, and the king
+    // squares from the parent's accumulator; child is read only to refresh
+    // the side whose king moved.
+    void update(const Board& parent, const Move& move, const NnueAccumulator& parent_accumulator,
+                const Board& child, NnueAccumulator& child_accumulator) const;
+
+    // Score in centipawns from the side to move's point of view
+    int evaluate(const NnueAccumulator& accumulator, bool white_to_move) const;
+
+private:
+    void refresh_perspective(const Board& board, int perspective, int king_square,
+                             NnueAccumulator& accumulator) const;
+
+    vector<int16_t> feature_weights; // [nnue_input_size][nnue_hidden_size]
+    vector<int16_t> feature_biases;  // [nnue_hidden_size]
+    vector<int16_t> output_weights;  // [2 * nnue_hidden_size]
+    int32_t output_bias;
+};
+
+// Name of the SIMD kernels selected for this CPU: "avx2", "sse4.1" or "scalar"
+const char* nnue_simd_name();
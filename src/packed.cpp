@@ -0,0 +1,223 @@
+#include "packed.h"
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char packed_magic[8] = {'A', '4', 'K', 'P', 'A', 'C', 'K', '1'};
+const size_t packed_header_size = 32;
+const size_t packed_buffer_records = 4096; // 128 KB per write
+
+bool pack_position(const Board& board, PackedPosition& packed) {
+    memset(&packed, 0, sizeof(packed));
+    int count = 0;
+    for (int square = 0; square < 64; square++) {
+        int piece = board.squares[square];
+        if (piece == 0) continue;
+        if (count == 32) return false;
+
+        int nibble = piece > 0 ? piece - 1 : 5 - piece;
+        packed.occupancy |= 1ULL << square;
+        packed.pieces[count / 2] |= nibble << (4 * (count % 2));
+        count++;
+    }
+
+    packed.flags = (board.white_to_move ? 0 : 1) |
+                   (board.white_can_castle_kingside ? 2 : 0) |
+                   (board.white_can_castle_queenside ? 4 : 0) |
+                   (board.black_can_castle_kingside ? 8 : 0) |
+                   (board.black_can_castle_queenside ? 16 : 0);
+    packed.halfmove_clock = uint8_t(min(max(board.halfmove_clock, 0), 255));
+    int ep_file = board.en_passant_square == -1 ? 0 : board.en_passant_square % 8 + 1;
+    packed.fullmove_and_ep = uint16_t(min(max(board.fullmove_number, 1), 4095) | ep_file << 12);
+    return true;
+}
+
+bool unpack_position(const PackedPosition& packed, Board& board) {
+    // Records come straight from mapped files, so check them before use: the
+    // piece codes index tables and the occupancy bounds the nibbles read
+    if (__builtin_popcountll(packed.occupancy) > 32 || (packed.fullmove_and_ep >> 12) > 8) return false;
+    memset(board.squares, 0, sizeof(board.squares));
+    int count = 0, white_kings = 0, black_kings = 0;
+    for (uint64_t remaining = packed.occupancy; remaining; remaining &= remaining - 1) {
+        int nibble = (packed.pieces[count / 2] >> (4 * (count % 2))) & 15;
+        if (nibble >= 12) return false;
+        int piece = nibble < 6 ? nibble + 1 : 5 - nibble;
+        board.squares[__builtin_ctzll(remaining)] = piece;
+        white_kings += piece == 6;
+        black_kings += piece == -6;
+        count++;
+    }
+    if (white_kings != 1 || black_kings != 1) return false;
+
+    board.white_to_move = !(packed.flags & 1);
+    board.white_can_castle_kingside = packed.flags & 2;
+    board.white_can_castle_queenside = packed.flags & 4;
+    board.black_can_castle_kingside = packed.flags & 8;
+    board.black_can_castle_queenside = packed.flags & 16;
+    board.halfmove_clock = packed.halfmove_clock;
+    board.fullmove_number = packed.fullmove_and_ep & 4095;
+
+    // The target square is behind the pawn that just moved two squares
+    int ep_file = packed.fullmove_and_ep >> 12;
+    board.en_passant_square = ep_file == 0 ? -1 : (board.white_to_move ? 40 : 16) + ep_file - 1;
+
+    refresh_board(board);
+    return true;
+}
+
+int packed_result(const PackedPosition& packed) {
+    return (packed.flags >> 5) & 3;
+}
+
+void set_packed_result(PackedPosition& packed, int result) {
+    packed.flags = (packed.flags & ~0x60) | (result & 3) << 5;
+}
+
+int parse_game_result(string_view text) {
+    if (text.find("1/2-1/2") != string_view::npos) return packed_result_draw;
+    if (text.find("1-0") != string_view::npos) return packed_result_white_win;
+    if (text.find("0-1") != string_view::npos) return packed_result_black_win;
+
+    size_t open = text.find('[');
+    if (open == string_view::npos) return packed_result_unknown;
+    string_view score = text.substr(open + 1, text.find(']', open) - open - 1);
+    if (score == "1.0" || score == "1") return packed_result_white_win;
+    if (score == "0.5") return packed_result_draw;
+    if (score == "0.0" || score == "0") return packed_result_black_win;
+    return packed_result_unknown;
+}
+
+const char* game_result_string(int result) {
+    switch (result) {
+        case packed_result_white_win: return "1-0";
+        case packed_result_black_win: return "0-1";
+        case packed_result_draw: return "1/2-1/2";
+    }
+    return "*";
+}
+
+uint16_t pack_move(const Move& move) {
+    if (move.from == move.to) return 0;
+    return uint16_t(move.from | move.to << 6 | move.promotion() << 12);
+}
+
+Move unpack_move(uint16_t packed, const Board& board) {
+    if (packed == 0) return Move();
+    for (const Move& move : generate_all_legal_moves(board)) {
+        if (pack_move(move) == packed) return move;
+    }
+    return Move();
+}
+
+PackedWriter::PackedWriter(const string& path) : count(0), ok(true) {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+
+    char header[packed_header_size] = {};
+    memcpy(header, packed_magic, sizeof(packed_magic));
+    ok = ::write(fd, header, sizeof(header)) == ssize_t(sizeof(header));
+    buffer.reserve(packed_buffer_records);
+}
+
+PackedWriter::~PackedWriter() {
+    if (fd < 0) return;
+    flush();
+    close(fd);
+}
+
+bool PackedWriter::is_open() const {
+    return fd >= 0 && ok;
+}
+
+bool PackedWriter::write(const PackedPosition& packed) {
+    buffer.push_back(packed);
+    count++;
+    if (buffer.size() == packed_buffer_records) return flush();
+    return is_open();
+}
+
+bool PackedWriter::flush() {
+    if (fd < 0) return false;
+    const char* bytes = reinterpret_cast<const char*>(buffer.data());
+    size_t remaining = buffer.size() * sizeof(PackedPosition);
+    while (remaining > 0 && ok) {
+        ssize_t written = ::write(fd, bytes, remaining);
+        if (written <= 0) {
+            ok = false;
+            break;
+        }
+        bytes += written;
+        remaining -= written;
+    }
+    buffer.clear();
+    return ok;
+}
+
+PackedReader::PackedReader(const string& path)
+    : rejected(0), data(nullptr), length(0), records(nullptr), count(0), pos(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= packed_header_size) {
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            data = static_cast<const char*>(mapped);
+            length = st.st_size;
+        }
+    }
+    close(fd);
+
+    if (data && memcmp(data, packed_magic, sizeof(packed_magic)) != 0) {
+        munmap(const_cast<char*>(data), length);
+        data = nullptr;
+        return;
+    }
+    if (data) {
+        madvise(const_cast<char*>(data), length, MADV_SEQUENTIAL);
+        records = reinterpret_cast<const PackedPosition*>(data + packed_header_size);
+        count = (length - packed_header_size) / sizeof(PackedPosition);
+    }
+}
+
+PackedReader::~PackedReader() {
+    if (data) munmap(const_cast<char*>(data), length);
+}
+
+bool PackedReader::is_open() const {
+    return data != nullptr;
+}
+
+size_t PackedReader::size() const {
+    return count;
+}
+
+const PackedPosition& PackedReader::operator[](size_t index) const {
+    return records[index];
+}
+
+bool PackedReader::next(Board& board, const PackedPosition** packed) {
+    for (; pos < count; pos++) {
+        if (!unpack_position(records[pos], board)) {
+            rejected++;
+            continue;
+        }
+        if (packed) *packed = &records[pos];
+        pos++;
+        return true;
+    }
+    return false;
+}
+
+bool is_packed_file(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    char magic[sizeof(packed_magic)];
+    bool packed = read(fd, magic, sizeof(magic)) == ssize_t(sizeof(magic)) &&
+                  memcmp(magic, packed_magic, sizeof(magic)) == 0;
+    close(fd);
+    return packed;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "chess.h"
+
+// Compact binary positions for datasets: 32 bytes instead of 60-90 bytes of
+// FEN text, and no parsing to read them back.
+//
+// Record layout (little-endian):
+//   occupancy        uint64  bit per occupied square, a1 = bit 0
+//   pieces           16 bytes one nibble per occupied square in bit order,
+//                             low nibble first: 0-5 white pawn..king,
+//                             6-11 black pawn..king
+//   flags            uint8   bit 0 black to move, bits 1-4 castling rights
+//                             KQkq, bits 5-6 result (packed_result_*)
+//   halfmove_clock   uint8   saturates at 255
+//   fullmove_and_ep  uint16  fullmove number in bits 0-11 (saturates at
+//                             4095), en passant file + 1 in bits 12-15
+//   score            int16   optional, centipawns for the side to move
+//   best_move        uint16  optional, pack_move format, 0 if none
+//
+// Files hold a 32-byte header (the magic "A4KPACK1", zero padded) followed
+// by the records, so records stay 32-byte aligned in a mapping.
+
+struct PackedPosition {
+    uint64_t occupancy;
+    uint8_t pieces[16];
+    uint8_t flags;
+    uint8_t halfmove_clock;
+    uint16_t fullmove_and_ep;
+    int16_t score;
+    uint16_t best_move;
+};
+
+static_assert(sizeof(PackedPosition) == 32, "packed positions must be 32 bytes");
+
+// Game result from white's point of view
+const int packed_result_unknown = 0;
+const int packed_result_black_win = 1;
+const int packed_result_draw = 2;
+const int packed_result_white_win = 3;
+
+// False if the board has more than 32 pieces; score, result and best move
+// start out empty
+bool pack_position(const Board& board, PackedPosition& packed);
+
+// False, leaving board unspecified, if the record is malformed: more than 32
+// pieces, a piece code above 11, an en passant file above 8, or not exactly
+// one king per side
+bool unpack_position(const PackedPosition& packed, Board& board);
+
+int packed_result(const PackedPosition& packed);
+void set_packed_result(PackedPosition& packed, int result);
+
+// Result written in dataset text: "1-0", "0-1", "1/2-1/2" (as in c9
+// operations) or a bracketed white score [1.0], [0.5], [0.0];
+// packed_result_unknown if there is none
+int parse_game_result(string_view text);
+const char* game_result_string(int result); // "1-0", "0-1", "1/2-1/2" or "*"
+
+// from | to << 6 | promotion piece << 12; 0 means no move
+uint16_t pack_move(const Move& move);
+Move unpack_move(uint16_t packed, const Board& board); // The legal move on board it encodes, with its flags; null if none
+
+// Buffered writer. Records reach the file when the buffer fills, on flush()
+// and on destruction.
+class PackedWriter {
+public:
+    explicit PackedWriter(const string& path);
+    ~PackedWriter();
+    PackedWriter(const PackedWriter&) = delete;
+    PackedWriter& operator=(const PackedWriter&) = delete;
+
+    bool is_open() const;
+    bool write(const PackedPosition& packed);
+    bool flush();
+
+    uint64_t count; // Records written so far
+
+private:
+    int fd;
+    bool ok;
+    vector<PackedPosition> buffer;
+};
+
+// Reads a packed file through a read-only memory mapping
+class PackedReader {
+public:
+    explicit PackedReader(const string& path);
+    ~PackedReader();
+    PackedReader(const PackedReader&) = delete;
+    PackedReader& operator=(const PackedReader&) = delete;
+
+    bool is_open() const; // False if missing or not a packed file
+    size_t size() const;  // Number of records
+    const PackedPosition& operator[](size_t index) const;
+
+    // Decode the next record into board, skipping malformed ones; false at
+    // end of file
+    bool next(Board& board, const PackedPosition** packed = nullptr);
+
+    uint64_t rejected; // Malformed records skipped by next() so far
+
+private:
+    const char* data;
+    size_t length;
+    const PackedPosition* records;
+    size_t count;
+    size_t pos;
+};
+
+// True if the file starts with the packed-position magic
+bool is_packed_file(const string& path);
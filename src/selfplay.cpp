@@ -0,0 +1,231 @@
+#include "commands.h"
+#include "chess.h"
+#include "engine.h"
+#include "nnue.h"
+#include "packed.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+
+// agent4k selfplay --output PATH [--games N] [--positions N] [--threads N]
+//                  [--nodes N] [--depth N] [--random-plies N] [--seed N]
+//                  [--evalfile PATH]
+//
+// Plays games against itself on every thread, each with its own engine
+// (engine.h), and writes the positions as packed records (packed.h) with
+// the search score, best move and final game result. Games open with random
+// legal moves and are adjudicated once the search agrees on a decisive or
+// a dead-drawn score for long enough. Generation stops after --games games
+// or --positions positions, whichever comes first.
+
+struct SelfplayOptions {
+    uint64_t games = 100;
+    uint64_t positions = 0; // 0 for no limit
+    int threads = max(1u, thread::hardware_concurrency());
+    SearchLimits limits = {0, 20000, 0};
+    int random_plies = 8;
+    uint64_t seed = 1;
+    string output;
+    string evalfile;
+};
+
+// Adjudication: a side wins once every score for resign_plies plies in a
+// row is at least resign_score in its favour; the game is drawn once every
+// score for draw_plies plies in a row is within draw_score, from ply
+// draw_min_ply on. Games reaching max_game_plies are drawn.
+const int resign_score = 1000;
+const int resign_plies = 4;
+const int draw_score = 10;
+const int draw_plies = 8;
+const int draw_min_ply = 80;
+const int max_game_plies = 400;
+
+// Shared between the generating threads
+struct SelfplayState {
+    mutex lock; // Guards writer, the counters below and the progress line
+    PackedWriter* writer;
+    uint64_t games_started = 0;
+    uint64_t games_finished = 0;
+    uint64_t positions_written = 0;
+    uint64_t results[4] = {0, 0, 0, 0}; // By packed result
+    chrono::steady_clock::time_point start;
+    chrono::steady_clock::time_point last_report;
+    bool failed = false;
+};
+
+// Random legal moves from the starting position; false if the game ended
+static bool play_opening(Board& board, vector<uint64_t>& history, int plies, mt19937_64& rng) {
+    board = create_starting_position();
+    history.assign(1, board.hash);
+    for (int ply = 0; ply < plies; ply++) {
+        vector<Move> moves = generate_all_legal_moves(board);
+        if (moves.empty()) return false;
+        make_move_simple(board, moves[rng() % moves.size()]);
+        history.push_back(board.hash);
+    }
+    return !generate_all_legal_moves(board).empty();
+}
+
+// Play one game, appending its positions; returns the packed result
+static int play_game(const SelfplayOptions& options, Engine& engine, mt19937_64& rng,
+                     vector<PackedPosition>& positions) {
+    Board board;
+    vector<uint64_t> history;
+    while (!play_opening(board, history, options.random_plies, rng)) {}
+    engine.new_game();
+
+    int resign_winner = 0, resign_streak = 0, draw_streak = 0; // Winner: 1 white, -1 black
+    for (int ply = 0; ply < max_game_plies; ply++) {
+        if (board.halfmove_clock >= 100 || is_threefold_repetition(board, history) || is_insufficient_material(board)) {
+            return packed_result_draw;
+        }
+
+        SearchResult result = engine.search(board, options.limits, history);
+        if (result.best_move.from == result.best_move.to) {
+            // No legal moves: checkmate or stalemate
+            if (!is_in_check(board, board.white_to_move)) return packed_result_draw;
+            return board.white_to_move ? packed_result_black_win : packed_result_white_win;
+        }
+
+        // Positions in check are left out; their static evaluation says little
+        PackedPosition packed;
+        if (!is_in_check(board, board.white_to_move) && pack_position(board, packed)) {
+            packed.score = int16_t(result.score);
+            packed.best_move = pack_move(result.best_move);
+            positions.push_back(packed);
+        }
+
+        int white_score = board.white_to_move ? result.score : -result.score;
+        int winner = white_score >= resign_score ? 1 : white_score <= -resign_score ? -1 : 0;
+        resign_streak = winner == 0 ? 0 : winner == resign_winner ? resign_streak + 1 : 1;
+        resign_winner = winner;
+        if (resign_streak >= resign_plies) {
+            return winner > 0 ? packed_result_white_win : packed_result_black_win;
+        }
+        draw_streak = abs(white_score) <= draw_score ? draw_streak + 1 : 0;
+        if (ply + options.random_plies >= draw_min_ply && draw_streak >= draw_plies) {
+            return packed_result_draw;
+        }
+
+        make_move_simple(board, result.best_move);
+        history.push_back(board.hash);
+    }
+    return packed_result_draw;
+}
+
+static void print_progress(SelfplayState& state, int threads) {
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - state.start).count();
+    double rate = state.positions_written / max(seconds, 1e-9);
+    cout << state.games_finished << " games, " << state.positions_written << " positions in "
+         << fixed << setprecision(1) << seconds << " s: " << setprecision(0) << rate << " pos/s, "
+         << rate / threads << " pos/s per thread (+" << state.results[packed_result_white_win]
+         << " =" << state.results[packed_result_draw] << " -" << state.results[packed_result_black_win]
+         << ")" << endl;
+}
+
+static void selfplay_thread(const SelfplayOptions& options, const NnueNetwork* network, int index,
+                            SelfplayState& state) {
+    EngineOptions engine_options;
+    engine_options.network = network;
+    Engine engine(engine_options);
+    mt19937_64 rng(options.seed * 0x9e3779b97f4a7c15ULL + index);
+    vector<PackedPosition> positions;
+
+    while (true) {
+        {
+            lock_guard<mutex> guard(state.lock);
+            bool enough = state.games_started >= options.games ||
+                          (options.positions && state.positions_written >= options.positions);
+            if (enough || state.failed) return;
+            state.games_started++;
+        }
+
+        positions.clear();
+        int result = play_game(options, engine, rng, positions);
+        for (PackedPosition& packed : positions) set_packed_result(packed, result);
+
+        lock_guard<mutex> guard(state.lock);
+        for (const PackedPosition& packed : positions) {
+            if (!state.writer->write(packed)) state.failed = true;
+        }
+        state.positions_written += positions.size();
+        state.games_finished++;
+        state.results[result]++;
+
+        auto now = chrono::steady_clock::now();
+        if (now - state.last_report >= chrono::seconds(10)) {
+            state.last_report = now;
+            print_progress(state, options.threads);
+        }
+    }
+}
+
+int selfplay_command(int argc, char* argv[]) {
+    SelfplayOptions options;
+    for (int i = 0; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--games" && has_value) {
+            options.games = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--positions" && has_value) {
+            options.positions = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--threads" && has_value) {
+            options.threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--nodes" && has_value) {
+            options.limits.nodes = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--depth" && has_value) {
+            options.limits.depth = max(0, atoi(argv[++i]));
+        } else if (arg == "--random-plies" && has_value) {
+            options.random_plies = max(0, atoi(argv[++i]));
+        } else if (arg == "--seed" && has_value) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--output" && has_value) {
+            options.output = argv[++i];
+        } else if (arg == "--evalfile" && has_value) {
+            options.evalfile = argv[++i];
+        } else {
+            options.output.clear();
+            break;
+        }
+    }
+    if (options.output.empty() || (options.limits.depth == 0 && options.limits.nodes == 0)) {
+        cerr << "Usage: agent4k selfplay --output PATH [--games N] [--positions N] [--threads N]" << endl
+             << "                        [--nodes N] [--depth N] [--random-plies N] [--seed N]" << endl
+             << "                        [--evalfile PATH]" << endl;
+        return 1;
+    }
+
+    NnueNetwork network;
+    if (!options.evalfile.empty() && !network.load(options.evalfile)) {
+        cerr << "Cannot load " << options.evalfile << endl;
+        return 1;
+    }
+    PackedWriter writer(options.output);
+    if (!writer.is_open()) {
+        cerr << "Cannot write " << options.output << endl;
+        return 1;
+    }
+
+    SelfplayState state;
+    state.writer = &writer;
+    state.start = state.last_report = chrono::steady_clock::now();
+
+    vector<thread> threads;
+    const NnueNetwork* evaluator = options.evalfile.empty() ? nullptr : &network;
+    for (int i = 0; i < options.threads; i++) {
+        threads.emplace_back(selfplay_thread, cref(options), evaluator, i, ref(state));
+    }
+    for (thread& t : threads) t.join();
+
+    if (state.failed || !writer.flush()) {
+        cerr << "Cannot write " << options.output << endl;
+        return 1;
+    }
+    print_progress(state, options.threads);
+    return 0;
+}
@@ -0,0 +1,883 @@
+#include "syzygy.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The index encoding and decompression follow Ronald de Man's probing code
+// for the Syzygy format. Pieces use the format's codes: 1-6 white pawn to
+// king, 9-14 black pawn to king.
+
+const int max_tablebase_pieces = 7;
+const uint8_t wdl_magic[4] = {0x71, 0xe8, 0x23, 0x5d};
+const uint8_t dtz_magic[4] = {0xd7, 0x66, 0x0c, 0xa5};
+
+// Probe states
+const int probe_fail = 0;
+const int probe_ok = 1;
+const int probe_change_side = -1;   // A DTZ table stores the other side to move
+const int probe_zeroing_best = 2;   // The best move is a capture or pawn move
+
+// Flags of a table's pairs data
+const int flag_side_to_move = 1;
+const int flag_mapped = 2;
+const int flag_win_plies = 4;
+const int flag_loss_plies = 8;
+const int flag_wide = 16;
+const int flag_single_value = 128;
+
+// Square mappings that fold the board by its symmetries, and the binomial
+// coefficients that number placements of like pieces
+struct SyzygyEncoding {
+    int map_pawns[64];
+    int map_b1h1h7[64];
+    int map_a1d1d4[64];
+    int map_kk[10][64];
+    uint64_t binomial[6][64];
+    int lead_pawn_index[6][64];
+    int lead_pawns_size[6][4];
+
+    SyzygyEncoding();
+};
+
+static int off_diagonal(int square) {
+    return square / 8 - square % 8;
+}
+
+SyzygyEncoding::SyzygyEncoding() {
+    memset(this, 0, sizeof(*this));
+
+    int code = 0;
+    for (int square = 0; square < 64; square++) {
+        if (off_diagonal(square) < 0) map_b1h1h7[square] = code++;
+    }
+
+    // The a1-d1-d4 triangle, diagonal squares last
+    vector<int> diagonal;
+    code = 0;
+    for (int square = 0; square <= 27; square++) {
+        if (off_diagonal(square) < 0 && square % 8 <= 3) {
+            map_a1d1d4[square] = code++;
+        } else if (off_diagonal(square) == 0 && square % 8 <= 3) {
+            diagonal.push_back(square);
+        }
+    }
+    for (int square : diagonal) map_a1d1d4[square] = code++;
+
+    // The 462 placements of two kings with the first in the triangle; with
+    // the first on the diagonal the second is not above it. Placements with
+    // both on the diagonal come last.
+    vector<pair<int, int>> both_on_diagonal;
+    code = 0;
+    for (int index = 0; index < 10; index++) {
+        for (int first = 0; first <= 27; first++) {
+            if (map_a1d1d4[first] != index || (index == 0 && first != 1)) continue; // b1 maps to 0
+            for (int second = 0; second < 64; second++) {
+                bool touching = abs(first % 8 - second % 8) <= 1 && abs(first / 8 - second / 8) <= 1;
+                if (touching) continue;
+                if (off_diagonal(first) == 0 && off_diagonal(second) > 0) continue;
+                if (off_diagonal(first) == 0 && off_diagonal(second) == 0) {
+                    both_on_diagonal.emplace_back(index, second);
+                } else {
+                    map_kk[index][second] = code++;
+                }
+            }
+        }
+    }
+    for (const auto& kings : both_on_diagonal) map_kk[kings.first][kings.second] = code++;
+
+    binomial[0][0] = 1;
+    for (int n = 1; n < 64; n++) {
+        for (int k = 0; k < 6 && k <= n; k++) {
+            binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) + (k < n ? binomial[k][n - 1] : 0);
+        }
+    }
+
+    // Pawns on a2-h7 number 47 down to 0 from the edge files inwards and
+    // from rank 2 upwards; the leading pawn has the highest number
+    int available = 47;
+    for (int lead_pawns = 1; lead_pawns <= 5; lead_pawns++) {
+        for (int file = 0; file < 4; file++) {
+            int index = 0;
+            for (int rank = 1; rank <= 6; rank++) {
+                int square = rank * 8 + file;
+                if (lead_pawns == 1) {
+                    map_pawns[square] = available--;
+                    map_pawns[square ^ 7] = available--;
+                }
+                lead_pawn_index[lead_pawns][square] = index;
+                index += int(binomial[lead_pawns - 1][map_pawns[square]]);
+            }
+            lead_pawns_size[lead_pawns][file] = index;
+        }
+    }
+}
+
+static const SyzygyEncoding& encoding() {
+    static const SyzygyEncoding tables;
+    return tables;
+}
+
+static uint16_t read_le16(const uint8_t* bytes) {
+    return uint16_t(bytes[0] | bytes[1] << 8);
+}
+
+static uint32_t read_le32(const uint8_t* bytes) {
+    return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+}
+
+static uint32_t read_be32(const uint8_t* bytes) {
+    return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 | uint32_t(bytes[2]) << 8 | uint32_t(bytes[3]);
+}
+
+// Decoding data of one table section: a side to move, and for pawn tables
+// a file of the leading pawn
+struct PairsData {
+    uint8_t flags;
+    size_t block_size;
+    size_t span;                  // Positions per sparse index entry
+    uint32_t block_count;
+    int max_symbol_length;
+    int min_symbol_length;
+    const uint8_t* lowest_symbol; // Little-endian uint16 per symbol length
+    const uint8_t* tree;          // Two 12-bit child symbols per symbol
+    const uint8_t* block_lengths; // Little-endian uint16 per block: positions - 1
+    uint32_t block_lengths_size;
+    const uint8_t* sparse_index;  // Per span: uint32 block, uint16 offset
+    size_t sparse_index_size;
+    const uint8_t* data;          // Huffman-coded blocks
+    vector<uint64_t> base64;      // Lowest code of each length, left-aligned
+    vector<uint8_t> symbol_values; // Values a symbol expands to, minus one
+    uint8_t pieces[max_tablebase_pieces];
+    uint64_t group_index[max_tablebase_pieces + 1];
+    int group_length[max_tablebase_pieces + 1];
+    uint16_t map_index[4];        // DTZ value maps for wins, losses, cursed wins, blessed losses
+
+    int left(int symbol) const {
+        const uint8_t* node = tree + 3 * symbol;
+        return (node[1] & 0xf) << 8 | node[0];
+    }
+    int right(int symbol) const {
+        const uint8_t* node = tree + 3 * symbol;
+        return node[2] << 4 | node[1] >> 4;
+    }
+};
+
+struct SyzygyTable {
+    bool dtz;
+    uint64_t key;  // Material with the first side of the name as white
+    uint64_t key2; // The colours swapped
+    int piece_count;
+    bool has_pawns;
+    bool has_unique_pieces;
+    uint8_t pawn_count[2]; // Leading colour, other colour
+    PairsData items[2][4]; // By side to move (WDL only) and leading pawn file
+    const uint8_t* map;    // DTZ value maps
+    void* mapping;
+    size_t mapping_size;
+
+    PairsData* get(int side, int file) {
+        return &items[dtz ? 0 : side % 2][has_pawns ? file : 0];
+    }
+    const PairsData* get(int side, int file) const {
+        return &items[dtz ? 0 : side % 2][has_pawns ? file : 0];
+    }
+};
+
+// 4 bits per piece type and colour
+static uint64_t material_key(const int counts[2][7]) {
+    uint64_t key = 0;
+    for (int color = 0; color < 2; color++) {
+        for (int type = 1; type <= 6; type++) {
+            key |= uint64_t(counts[color][type]) << (4 * (6 * color + type - 1));
+        }
+    }
+    return key;
+}
+
+static uint64_t board_material_key(const Board& board, int& pieces) {
+    int counts[2][7] = {};
+    pieces = 0;
+    for (int square = 0; square < 64; square++) {
+        int piece = board.squares[square];
+        if (piece == 0) continue;
+        counts[piece > 0 ? 0 : 1][abs(piece)]++;
+        pieces++;
+    }
+    return material_key(counts);
+}
+
+static int tablebase_piece(int piece) {
+    return piece > 0 ? piece : 8 - piece;
+}
+
+static bool has_castling_rights(const Board& board) {
+    return board.white_can_castle_kingside || board.white_can_castle_queenside ||
+           board.black_can_castle_kingside || board.black_can_castle_queenside;
+}
+
+static bool is_zeroing_capture(const Board& board, const Move& move) {
+    return board.squares[move.to] != 0 || move.is_en_passant();
+}
+
+static void set_groups(const SyzygyTable& table, PairsData& d, const int order[2], int file) {
+    const SyzygyEncoding& e = encoding();
+    int n = 0;
+    int first_length = table.has_pawns ? 0 : table.has_unique_pieces ? 3 : 2;
+    d.group_length[n] = 1;
+
+    // Like pieces form a group; the leading group holds the first pieces
+    for (int i = 1; i < table.piece_count; i++) {
+        if (--first_length > 0 || d.pieces[i] == d.pieces[i - 1]) {
+            d.group_length[n]++;
+        } else {
+            d.group_length[++n] = 1;
+        }
+    }
+    d.group_length[++n] = 0;
+
+    // The groups are numbered in the table's order: order[0] is the
+    // leading group, order[1] the remaining pawns when both sides have some
+    bool both_pawns = table.has_pawns && table.pawn_count[1];
+    int next = both_pawns ? 2 : 1;
+    int free_squares = 64 - d.group_length[0] - (both_pawns ? d.group_length[1] : 0);
+    uint64_t index = 1;
+    for (int k = 0; next < n || k == order[0] || k == order[1]; k++) {
+        if (k == order[0]) {
+            d.group_index[0] = index;
+            index *= table.has_pawns ? e.lead_pawns_size[d.group_length[0]][file]
+                   : table.has_unique_pieces ? 31332 : 462;
+        } else if (k == order[1]) {
+            d.group_index[1] = index;
+            index *= e.binomial[d.group_length[1]][48 - d.group_length[0]];
+        } else {
+            d.group_index[next] = index;
+            index *= e.binomial[d.group_length[next]][free_squares];
+            free_squares -= d.group_length[next++];
+        }
+    }
+    d.group_index[n] = index;
+}
+
+static uint8_t set_symbol_values(PairsData& d, int symbol, vector<bool>& visited) {
+    visited[symbol] = true;
+    int right = d.right(symbol);
+    if (right == 0xfff) return 0; // A leaf
+
+    int left = d.left(symbol);
+    if (!visited[left]) d.symbol_values[left] = set_symbol_values(d, left, visited);
+    if (!visited[right]) d.symbol_values[right] = set_symbol_values(d, right, visited);
+    return uint8_t(d.symbol_values[left] + d.symbol_values[right] + 1);
+}
+
+static const uint8_t* set_sizes(PairsData& d, const uint8_t* data) {
+    d.flags = *data++;
+    if (d.flags & flag_single_value) {
+        d.block_count = 0;
+        d.span = 0;
+        d.block_lengths_size = 0;
+        d.sparse_index_size = 0;
+        d.min_symbol_length = *data++; // The value of every position
+        return data;
+    }
+
+    int groups = int(find(d.group_length, d.group_length + max_tablebase_pieces, 0) - d.group_length);
+    uint64_t positions = d.group_index[groups];
+
+    d.block_size = size_t(1) << *data++;
+    d.span = size_t(1) << *data++;
+    d.sparse_index_size = size_t((positions + d.span - 1) / d.span);
+    int padding = *data++;
+    d.block_count = read_le32(data);
+    data += 4;
+    d.block_lengths_size = d.block_count + padding; // Keeps sparse index lookups in range
+    d.max_symbol_length = *data++;
+    d.min_symbol_length = *data++;
+    d.lowest_symbol = data;
+
+    // Canonical Huffman codes: longer codes have lower values
+    d.base64.assign(d.max_symbol_length - d.min_symbol_length + 1, 0);
+    for (int i = int(d.base64.size()) - 2; i >= 0; i--) {
+        d.base64[i] = (d.base64[i + 1] + read_le16(d.lowest_symbol + 2 * i) -
+                       read_le16(d.lowest_symbol + 2 * (i + 1))) / 2;
+    }
+    for (size_t i = 0; i < d.base64.size(); i++) {
+        d.base64[i] <<= 64 - i - d.min_symbol_length;
+    }
+    data += 2 * d.base64.size();
+
+    // Symbols expand recursively into pairs of symbols
+    d.symbol_values.assign(read_le16(data), 0);
+    data += 2;
+    d.tree = data;
+    vector<bool> visited(d.symbol_values.size());
+    for (size_t symbol = 0; symbol < d.symbol_values.size(); symbol++) {
+        if (!visited[symbol]) d.symbol_values[symbol] = set_symbol_values(d, int(symbol), visited);
+    }
+    return data + 3 * d.symbol_values.size() + (d.symbol_values.size() & 1);
+}
+
+static const uint8_t* set_dtz_map(SyzygyTable& table, const uint8_t* data, int max_file) {
+    table.map = data;
+    for (int file = 0; file <= max_file; file++) {
+        PairsData& d = *table.get(0, file);
+        if (!(d.flags & flag_mapped)) continue;
+        if (d.flags & flag_wide) {
+            data += uintptr_t(data) & 1;
+            for (int i = 0; i < 4; i++) {
+                d.map_index[i] = uint16_t((data - table.map) / 2 + 1);
+                data += 2 * read_le16(data) + 2;
+            }
+        } else {
+            for (int i = 0; i < 4; i++) {
+                d.map_index[i] = uint16_t(data - table.map + 1);
+                data += *data + 1;
+            }
+        }
+    }
+    return data + (uintptr_t(data) & 1);
+}
+
+// Lay out the sections of a mapped file after its magic; false if the
+// header does not match the material of the name
+static bool set_table(SyzygyTable& table, const uint8_t* data) {
+    const int split = 1, has_pawns = 2;
+    if (bool(*data & has_pawns) != table.has_pawns) return false;
+    if (!table.dtz && bool(*data & split) != (table.key != table.key2)) return false;
+    data++;
+
+    int sides = !table.dtz && table.key != table.key2 ? 2 : 1;
+    int max_file = table.has_pawns ? 3 : 0;
+    bool both_pawns = table.has_pawns && table.pawn_count[1];
+
+    for (int file = 0; file <= max_file; file++) {
+        int order[2][2] = {{*data & 0xf, both_pawns ? *(data + 1) & 0xf : 0xf},
+                           {*data >> 4, both_pawns ? *(data + 1) >> 4 : 0xf}};
+        data += 1 + both_pawns;
+        for (int k = 0; k < table.piece_count; k++, data++) {
+            for (int side = 0; side < sides; side++) {
+                table.get(side, file)->pieces[k] = uint8_t(side ? *data >> 4 : *data & 0xf);
+            }
+        }
+        for (int side = 0; side < sides; side++) {
+            set_groups(table, *table.get(side, file), order[side], file);
+        }
+    }
+    data += uintptr_t(data) & 1;
+
+    for (int file = 0; file <= max_file; file++) {
+        for (int side = 0; side < sides; side++) data = set_sizes(*table.get(side, file), data);
+    }
+    if (table.dtz) data = set_dtz_map(table, data, max_file);
+    for (int file = 0; file <= max_file; file++) {
+        for (int side = 0; side < sides; side++) {
+            PairsData& d = *table.get(side, file);
+            d.sparse_index = data;
+            data += 6 * d.sparse_index_size;
+        }
+    }
+    for (int file = 0; file <= max_file; file++) {
+        for (int side = 0; side < sides; side++) {
+            PairsData& d = *table.get(side, file);
+            d.block_lengths = data;
+            data += 2 * size_t(d.block_lengths_size);
+        }
+    }
+    for (int file = 0; file <= max_file; file++) {
+        for (int side = 0; side < sides; side++) {
+            PairsData& d = *table.get(side, file);
+            data = reinterpret_cast<const uint8_t*>((uintptr_t(data) + 63) & ~uintptr_t(63));
+            d.data = data;
+            data += size_t(d.block_count) * d.block_size;
+        }
+    }
+    const uint8_t* end = static_cast<const uint8_t*>(table.mapping) + table.mapping_size;
+    return data <= end;
+}
+
+// The value stored for position index in the section
+static int decompress(const PairsData& d, uint64_t index) {
+    if (d.flags & flag_single_value) return d.min_symbol_length;
+
+    // The sparse index gives the block and offset of every span-th
+    // position, counted from the middle of the span
+    size_t k = size_t(index / d.span);
+    uint32_t block = read_le32(d.sparse_index + 6 * k);
+    int offset = read_le16(d.sparse_index + 6 * k + 4);
+    offset += int(index % d.span) - int(d.span / 2);
+
+    auto block_length = [&d](uint32_t n) { return int(read_le16(d.block_lengths + 2 * size_t(n))); };
+    while (offset < 0) offset += block_length(--block) + 1;
+    while (offset > block_length(block)) offset -= block_length(block++) + 1;
+
+    // Walk the block's Huffman codes until the symbol covering the offset
+    const uint8_t* pointer = d.data + size_t(block) * d.block_size;
+    uint64_t buffer = uint64_t(read_be32(pointer)) << 32 | read_be32(pointer + 4);
+    pointer += 8;
+    int buffer_bits = 64;
+    int symbol;
+    while (true) {
+        int length = 0;
+        while (buffer < d.base64[length]) length++;
+        symbol = int((buffer - d.base64[length]) >> (64 - length - d.min_symbol_length));
+        symbol += read_le16(d.lowest_symbol + 2 * length);
+        if (offset < d.symbol_values[symbol] + 1) break;
+
+        offset -= d.symbol_values[symbol] + 1;
+        length += d.min_symbol_length;
+        buffer <<= length;
+        buffer_bits -= length;
+        if (buffer_bits <= 32) {
+            buffer_bits += 32;
+            buffer |= uint64_t(read_be32(pointer)) << (64 - buffer_bits);
+            pointer += 4;
+        }
+    }
+
+    // Expand the symbol's pairs down to the value at the offset
+    while (d.symbol_values[symbol]) {
+        int left = d.left(symbol);
+        if (offset < d.symbol_values[left] + 1) {
+            symbol = left;
+        } else {
+            offset -= d.symbol_values[left] + 1;
+            symbol = d.right(symbol);
+        }
+    }
+    return d.left(symbol);
+}
+
+// Convert a stored DTZ value to plies from the position
+static int map_dtz_score(const SyzygyTable& table, int file, int value, int wdl) {
+    const int wdl_map[] = {1, 3, 0, 2, 0};
+    const PairsData& d = *table.get(0, file);
+    if (d.flags & flag_mapped) {
+        int index = d.map_index[wdl_map[wdl + 2]] + value;
+        value = d.flags & flag_wide ? read_le16(table.map + 2 * index) : table.map[index];
+    }
+    bool in_moves = (wdl == wdl_win && !(d.flags & flag_win_plies)) ||
+                    (wdl == wdl_loss && !(d.flags & flag_loss_plies)) ||
+                    wdl == wdl_cursed_win || wdl == wdl_blessed_loss;
+    if (in_moves) value *= 2;
+    return value + 1;
+}
+
+SyzygyTablebases::SyzygyTablebases() : largest(0) {}
+
+SyzygyTablebases::~SyzygyTablebases() {
+    clear();
+}
+
+void SyzygyTablebases::clear() {
+    for (const unique_ptr<SyzygyTable>& table : tables) munmap(table->mapping, table->mapping_size);
+    tables.clear();
+    wdl_tables.clear();
+    dtz_tables.clear();
+    largest = 0;
+}
+
+size_t SyzygyTablebases::size() const {
+    return count_if(tables.begin(), tables.end(), [](const unique_ptr<SyzygyTable>& table) { return !table->dtz; });
+}
+
+int SyzygyTablebases::max_pieces() const {
+    return largest;
+}
+
+// A table named like KRPvKR.rtbw: each side's pieces from the king down
+static unique_ptr<SyzygyTable> open_table(const string& directory, const string& name) {
+    size_t dot = name.rfind('.');
+    if (dot == string::npos) return nullptr;
+    string extension = name.substr(dot);
+    if (extension != ".rtbw" && extension != ".rtbz") return nullptr;
+
+    unique_ptr<SyzygyTable> table(new SyzygyTable());
+    table->dtz = extension == ".rtbz";
+    int counts[2][7] = {};
+    int side = 0, pieces = 0;
+    for (char c : name.substr(0, dot)) {
+        const char* letters = "PNBRQK";
+        const char* letter = strchr(letters, c);
+        if (c == 'v' && side == 0) {
+            side = 1;
+        } else if (letter) {
+            counts[side][letter - letters + 1]++;
+            pieces++;
+        } else {
+            return nullptr;
+        }
+    }
+    if (side != 1 || counts[0][6] != 1 || counts[1][6] != 1 || pieces > max_tablebase_pieces) return nullptr;
+
+    int swapped[2][7];
+    for (int type = 0; type < 7; type++) {
+        swapped[0][type] = counts[1][type];
+        swapped[1][type] = counts[0][type];
+    }
+    table->key = material_key(counts);
+    table->key2 = material_key(swapped);
+    table->piece_count = pieces;
+    table->has_pawns = counts[0][1] + counts[1][1] > 0;
+    table->has_unique_pieces = false;
+    for (int color = 0; color < 2; color++) {
+        for (int type = 1; type < 6; type++) {
+            if (counts[color][type] == 1) table->has_unique_pieces = true;
+        }
+    }
+    // The leading colour is the one with fewer pawns, white on a tie
+    bool white_leads = counts[1][1] == 0 || (counts[0][1] && counts[1][1] >= counts[0][1]);
+    table->pawn_count[0] = uint8_t(counts[white_leads ? 0 : 1][1]);
+    table->pawn_count[1] = uint8_t(counts[white_leads ? 1 : 0][1]);
+
+    string path = directory + "/" + name;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && st.st_size % 64 == 16;
+    void* mapped = valid ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED) return nullptr;
+    table->mapping = mapped;
+    table->mapping_size = st.st_size;
+
+    // Probes land anywhere in the file; read-ahead would waste I/O
+    madvise(mapped, st.st_size, MADV_RANDOM);
+    const uint8_t* data = static_cast<const uint8_t*>(mapped);
+    if (memcmp(data, table->dtz ? dtz_magic : wdl_magic, 4) != 0 || !set_table(*table, data + 4)) {
+        munmap(mapped, st.st_size);
+        return nullptr;
+    }
+    return table;
+}
+
+int SyzygyTablebases::load(const string& path) {
+    clear();
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find(':', start);
+        if (end == string::npos) end = path.size();
+        string directory = path.substr(start, end - start);
+        start = end + 1;
+
+        DIR* dir = directory.empty() ? nullptr : opendir(directory.c_str());
+        if (!dir) continue;
+        vector<string> names;
+        while (dirent* entry = readdir(dir)) names.push_back(entry->d_name);
+        closedir(dir);
+        sort(names.begin(), names.end());
+
+        for (const string& name : names) {
+            unique_ptr<SyzygyTable> table = open_table(directory, name);
+            if (!table) continue;
+            unordered_map<uint64_t, const SyzygyTable*>& index = table->dtz ? dtz_tables : wdl_tables;
+            if (index.count(table->key)) {
+                munmap(table->mapping, table->mapping_size); // Found in an earlier directory
+                continue;
+            }
+            index[table->key] = table.get();
+            index[table->key2] = table.get();
+            if (!table->dtz) largest = max(largest, table->piece_count);
+            tables.push_back(move(table));
+        }
+    }
+    return int(size());
+}
+
+const SyzygyTable* SyzygyTablebases::find(uint64_t key, bool dtz) const {
+    const unordered_map<uint64_t, const SyzygyTable*>& index = dtz ? dtz_tables : wdl_tables;
+    auto found = index.find(key);
+    return found == index.end() ? nullptr : found->second;
+}
+
+// Index the position in its table and read the stored value: a wdl_*
+// result, or for DTZ tables the plies for a position whose result is wdl
+int SyzygyTablebases::probe_table(const Board& board, bool dtz, int wdl, int& state) const {
+    const SyzygyEncoding& e = encoding();
+    int piece_count;
+    uint64_t key = board_material_key(board, piece_count);
+    if (piece_count == 2) return wdl_draw; // Bare kings
+
+    const SyzygyTable* table = find(key, dtz);
+    if (!table) {
+        state = probe_fail;
+        return 0;
+    }
+
+    // Tables hold the first side of their name as white. Positions of the
+    // other colouring, and with symmetric material the positions with black
+    // to move, are looked up with colours and ranks flipped.
+    bool symmetric_black_to_move = table->key == table->key2 && !board.white_to_move;
+    bool black_stronger = key != table->key;
+    bool flip = symmetric_black_to_move || black_stronger;
+    int flip_color = flip ? 8 : 0;
+    int flip_squares = flip ? 56 : 0;
+    int side = int(flip) ^ (board.white_to_move ? 0 : 1);
+
+    int squares[max_tablebase_pieces];
+    int pieces[max_tablebase_pieces];
+    int size = 0, lead_pawns = 0, file = 0;
+    auto pawn_order = [&e](int a, int b) { return e.map_pawns[a] < e.map_pawns[b]; };
+
+    // Pawn tables are split by the file of the leading pawn, the pawn of
+    // the leading colour nearest the edge and then the lowest rank
+    int lead_piece = 0;
+    if (table->has_pawns) {
+        lead_piece = table->get(0, 0)->pieces[0] ^ flip_color;
+        int lead_board_piece = lead_piece & 8 ? -1 : 1;
+        for (int square = 0; square < 64; square++) {
+            if (board.squares[square] == lead_board_piece) squares[size++] = square ^ flip_squares;
+        }
+        lead_pawns = size;
+        swap(squares[0], *max_element(squares, squares + lead_pawns, pawn_order));
+        file = min(squares[0] % 8, 7 - squares[0] % 8);
+    }
+
+    // DTZ tables store one side to move
+    if (table->dtz) {
+        const PairsData& d = *table->get(side, file);
+        bool stored = (d.flags & flag_side_to_move) == side || (table->key == table->key2 && !table->has_pawns);
+        if (!stored) {
+            state = probe_change_side;
+            return 0;
+        }
+    }
+
+    for (int square = 0; square < 64; square++) {
+        int piece = board.squares[square];
+        if (piece == 0 || (table->has_pawns && piece == (lead_piece & 8 ? -1 : 1))) continue;
+        squares[size] = square ^ flip_squares;
+        pieces[size++] = tablebase_piece(piece) ^ flip_color;
+    }
+
+    const PairsData& d = *table->get(side, file);
+
+    // Order the pieces as the table lists them
+    for (int i = lead_pawns; i < size - 1; i++) {
+        for (int j = i + 1; j < size; j++) {
+            if (d.pieces[i] == pieces[j]) {
+                swap(pieces[i], pieces[j]);
+                swap(squares[i], squares[j]);
+                break;
+            }
+        }
+    }
+
+    // Mirror the leading piece onto files a-d
+    if (squares[0] % 8 > 3) {
+        for (int i = 0; i < size; i++) squares[i] ^= 7;
+    }
+
+    uint64_t index;
+    if (table->has_pawns) {
+        index = e.lead_pawn_index[lead_pawns][squares[0]];
+        stable_sort(squares + 1, squares + lead_pawns, pawn_order);
+        for (int i = 1; i < lead_pawns; i++) index += e.binomial[i][e.map_pawns[squares[i]]];
+    } else {
+        // Then onto ranks 1-4, then below the a1-h8 diagonal
+        if (squares[0] / 8 > 3) {
+            for (int i = 0; i < size; i++) squares[i] ^= 56;
+        }
+        for (int i = 0; i < d.group_length[0]; i++) {
+            if (off_diagonal(squares[i]) == 0) continue;
+            if (off_diagonal(squares[i]) > 0) {
+                for (int j = i; j < size; j++) squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+            }
+            break;
+        }
+
+        if (table->has_unique_pieces) {
+            // Three unique pieces placed together
+            int adjust1 = squares[1] > squares[0];
+            int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+            if (off_diagonal(squares[0])) {
+                index = (e.map_a1d1d4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+            } else if (off_diagonal(squares[1])) {
+                index = (6 * 63 + (squares[0] / 8) * 28 + e.map_b1h1h7[squares[1]]) * 62 + squares[2] - adjust2;
+            } else if (off_diagonal(squares[2])) {
+                index = 6 * 63 * 62 + 4 * 28 * 62 + (squares[0] / 8) * 7 * 28 +
+                        (squares[1] / 8 - adjust1) * 28 + e.map_b1h1h7[squares[2]];
+            } else {
+                index = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + (squares[0] / 8) * 7 * 6 +
+                        (squares[1] / 8 - adjust1) * 6 + (squares[2] / 8 - adjust2);
+            }
+        } else {
+            index = e.map_kk[e.map_a1d1d4[squares[0]]][squares[1]];
+        }
+    }
+
+    // The remaining groups, each numbered by the squares left free
+    index *= d.group_index[0];
+    int* group = squares + d.group_length[0];
+    bool remaining_pawns = table->has_pawns && table->pawn_count[1];
+    for (int next = 1; d.group_length[next]; next++) {
+        stable_sort(group, group + d.group_length[next]);
+        uint64_t n = 0;
+        for (int i = 0; i < d.group_length[next]; i++) {
+            int adjust = int(count_if(squares, group, [&](int square) { return group[i] > square; }));
+            n += e.binomial[i + 1][group[i] - adjust - 8 * remaining_pawns];
+        }
+        remaining_pawns = false;
+        index += n * d.group_index[next];
+        group += d.group_length[next];
+    }
+
+    int value = decompress(d, index);
+    return dtz ? map_dtz_score(*table, file, value, wdl) : value - 2;
+}
+
+// WDL with captures searched first, as the tables may store any value
+// where a capture is best or en passant is possible. With zeroing_moves
+// pawn moves count as well, as needed before reading DTZ.
+int SyzygyTablebases::search_captures(const Board& board, bool zeroing_moves, int& state) const {
+    vector<Move> moves = generate_all_legal_moves(board);
+    int best = wdl_loss;
+    size_t searched = 0;
+    for (const Move& move : moves) {
+        bool pawn_move = abs(board.squares[move.from]) == 1;
+        if (!is_zeroing_capture(board, move) && !(zeroing_moves && pawn_move)) continue;
+        searched++;
+
+        Board child = board;
+        make_move_simple(child, move);
+        int value = -search_captures(child, false, state);
+        if (state == probe_fail) return wdl_draw;
+        if (value > best) {
+            best = value;
+            if (value >= wdl_win) {
+                state = probe_zeroing_best;
+                return value;
+            }
+        }
+    }
+
+    // With every legal move searched the table is not needed
+    bool all_searched = searched && searched == moves.size();
+    int value;
+    if (all_searched) {
+        value = best;
+    } else {
+        value = probe_table(board, false, wdl_draw, state);
+        if (state == probe_fail) return wdl_draw;
+    }
+
+    if (best >= value) {
+        state = best > wdl_draw || all_searched ? probe_zeroing_best : probe_ok;
+        return best;
+    }
+    state = probe_ok;
+    return value;
+}
+
+// The DTZ of a zeroing move's position before the move is made
+static int dtz_before_zeroing(int wdl) {
+    return wdl == wdl_win ? 1 : wdl == wdl_cursed_win ? 101 : wdl == wdl_blessed_loss ? -101
+         : wdl == wdl_loss ? -1 : 0;
+}
+
+static int sign(int value) {
+    return (value > 0) - (value < 0);
+}
+
+int SyzygyTablebases::probe_dtz_moves(const Board& board, int& state) const {
+    state = probe_ok;
+    int wdl = search_captures(board, true, state);
+    if (state == probe_fail || wdl == wdl_draw) return 0; // DTZ tables store no draws
+    if (state == probe_zeroing_best) return dtz_before_zeroing(wdl);
+
+    int dtz = probe_table(board, true, wdl, state);
+    if (state == probe_fail) return 0;
+    if (state != probe_change_side) {
+        return (dtz + 100 * (wdl == wdl_blessed_loss || wdl == wdl_cursed_win)) * sign(wdl);
+    }
+
+    // The table holds the other side to move: take the best move's DTZ
+    int best = 0xffff;
+    for (const Move& move : generate_all_legal_moves(board)) {
+        bool zeroing = is_zeroing_capture(board, move) || abs(board.squares[move.from]) == 1;
+        Board child = board;
+        make_move_simple(child, move);
+        dtz = zeroing ? -dtz_before_zeroing(search_captures(child, false, state)) : -probe_dtz_moves(child, state);
+        if (state == probe_fail) return 0;
+
+        if (dtz == 1 && is_in_check(child, child.white_to_move) && generate_all_legal_moves(child).empty()) {
+            best = 1; // Mate
+        }
+        if (!zeroing) dtz += sign(dtz);
+        if (dtz < best && sign(dtz) == sign(wdl)) best = dtz;
+    }
+    return best == 0xffff ? -1 : best;
+}
+
+static bool probeable(const Board& board, int largest) {
+    if (largest == 0 || has_castling_rights(board)) return false;
+    int pieces = 0;
+    for (int square = 0; square < 64; square++) pieces += board.squares[square] != 0;
+    return pieces <= largest;
+}
+
+bool SyzygyTablebases::probe_wdl(const Board& board, int& wdl) const {
+    if (!probeable(board, largest)) return false;
+    int state = probe_ok;
+    wdl = search_captures(board, false, state);
+    return state != probe_fail;
+}
+
+bool SyzygyTablebases::probe_dtz(const Board& board, int& dtz) const {
+    if (!probeable(board, largest)) return false;
+    int state = probe_ok;
+    dtz = probe_dtz_moves(board, state);
+    return state != probe_fail;
+}
+
+bool SyzygyTablebases::filter_root_moves(const Board& board, vector<Move>& moves, int& score) const {
+    if (moves.empty() || !probeable(board, largest)) return false;
+
+    // DTZ of each move counted from the root position
+    vector<int> distances;
+    for (const Move& move : moves) {
+        Board child = board;
+        make_move_simple(child, move);
+        int state = probe_ok;
+        int dtz;
+        if (child.halfmove_clock == 0) {
+            dtz = dtz_before_zeroing(-search_captures(child, false, state));
+        } else {
+            dtz = -probe_dtz_moves(child, state);
+            dtz += sign(dtz);
+        }
+        if (state == probe_fail) return false;
+        if (dtz == 2 && is_in_check(child, child.white_to_move) && generate_all_legal_moves(child).empty()) {
+            dtz = 1; // Mate
+        }
+        distances.push_back(dtz);
+    }
+
+    // Wins rank by closeness to zeroing, losses by distance from it
+    auto rank = [](int dtz) { return dtz > 0 ? 100000 - dtz : dtz < 0 ? -100000 - dtz : 0; };
+    int best = rank(distances[0]);
+    for (int dtz : distances) best = max(best, rank(dtz));
+
+    vector<Move> kept;
+    int best_dtz = 0;
+    for (size_t i = 0; i < moves.size(); i++) {
+        if (rank(distances[i]) != best) continue;
+        kept.push_back(moves[i]);
+        best_dtz = distances[i];
+    }
+    moves.swap(kept);
+
+    // A result the fifty-move rule does not overturn
+    int clock = board.halfmove_clock;
+    if (best_dtz > 0 && best_dtz + clock <= 99) {
+        score = tablebase_win_score;
+    } else if (best_dtz < 0 && -best_dtz + clock <= 99) {
+        score = -tablebase_win_score;
+    } else {
+        score = 0;
+    }
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "chess.h"
+#include <memory>
+#include <unordered_map>
+
+// Syzygy endgame tablebases: win/draw/loss (.rtbw) and distance-to-zeroing
+// (.rtbz) tables, named by their material such as KRPvKR.rtbw. Files are
+// memory-mapped when loaded, so only the blocks that probes decompress are
+// read from disk, and the mappings are shared by all search threads.
+//
+// The tables assume no castling rights; positions with castling rights are
+// never probed. Cursed wins and blessed losses are wins and losses that
+// the fifty-move rule turns into draws.
+
+const int wdl_loss = -2;
+const int wdl_blessed_loss = -1;
+const int wdl_draw = 0;
+const int wdl_cursed_win = 1;
+const int wdl_win = 2;
+
+struct SyzygyTable;
+
+class SyzygyTablebases {
+public:
+    SyzygyTablebases();
+    ~SyzygyTablebases();
+    SyzygyTablebases(const SyzygyTablebases&) = delete;
+    SyzygyTablebases& operator=(const SyzygyTablebases&) = delete;
+
+    // Map the tables found in the directories of path, separated by ':',
+    // replacing those loaded before; returns the number of WDL tables.
+    // Files that are malformed or not named after their material are
+    // skipped.
+    int load(const string& path);
+    void clear();
+    size_t size() const;    // WDL tables loaded
+    int max_pieces() const; // Most pieces of any WDL table; 0 if none
+
+    // Result for the side to move, one of wdl_*; false if the position has
+    // castling rights, more pieces than max_pieces or a missing table.
+    // Captures, including en passant, are searched rather than read.
+    bool probe_wdl(const Board& board, int& wdl) const;
+
+    // Plies to the next capture or pawn move on the optimal path, positive
+    // when the side to move wins and above 100 for a cursed win; 0 for a
+    // draw. False as for probe_wdl.
+    bool probe_dtz(const Board& board, int& dtz) const;
+
+    // Keep only the root moves that preserve the best result: the winning
+    // move closest to a capture or pawn move, otherwise the drawing moves,
+    // otherwise the losing moves that resist longest. score is the result
+    // for the side to move, +-tablebase_win_score or 0 when the fifty-move
+    // rule decides. False, leaving moves as they were, if any move could
+    // not be probed.
+    bool filter_root_moves(const Board& board, vector<Move>& moves, int& score) const;
+
+private:
+    const SyzygyTable* find(uint64_t key, bool dtz) const;
+    int probe_table(const Board& board, bool dtz, int wdl, int& state) const;
+    int search_captures(const Board& board, bool zeroing_moves, int& state) const;
+    int probe_dtz_moves(const Board& board, int& state) const;
+
+    vector<unique_ptr<SyzygyTable>> tables;
+    unordered_map<uint64_t, const SyzygyTable*> wdl_tables; // By material key, both colourings
+    unordered_map<uint64_t, const SyzygyTable*> dtz_tables;
+    int largest;
+};
@@ -0,0 +1,476 @@
+#include "chess.h"
+#include "eval_params.h"
+#include "packed.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+// Texel tuning of the classical evaluation against game results.
+//
+// Usage: tune [--threads N] [--epochs N] [--rate R] [--output PATH] DATASET...
+//
+// Datasets are packed position files (packed.h) or EPD/FEN text labelled
+// with the game result, either as an operation (c9 "1-0"; "1/2-1/2";
+// "0-1") or as a bracketed score from white's point of view ([1.0], [0.5],
+// [0.0]); positions without a result are skipped. Positions are
+// resolved to a quiet leaf with a captures-only quiescence search, then
+// stored as sparse term counts (see trace_evaluation), so an epoch is a
+// pass over a compact array rather than a re-evaluation of every board.
+//
+// The evaluation is linear in its parameters, so the tuner fits a scaling
+// constant K once and then minimises the mean squared error between the
+// results and sigmoid(K * eval / 400) with Adam, computing the gradient on
+// all threads. The tuned values are written as a new eval_params.h.
+
+// Parameter layout: (middlegame, endgame) pairs in eval_params.h order
+const int piece_offset = 0;
+const int pst_offset = piece_offset + 7;
+const int doubled_offset = pst_offset + 7 * 64;
+const int isolated_offset = doubled_offset + 1;
+const int backward_offset = isolated_offset + 1;
+const int passed_offset = backward_offset + 1;
+const int shield_offset = passed_offset + 8;
+const int param_count = shield_offset + 2;
+
+struct Params {
+    double mg[param_count];
+    double eg[param_count];
+};
+
+// One term of a position: the parameter pair and its white-minus-black count
+struct TuneFeature {
+    uint16_t index;
+    int16_t count;
+};
+
+struct TuneEntry {
+    uint64_t first_feature; // Into the shard's feature array
+    float result;           // 1 white win, 0.5 draw, 0 black win
+    uint8_t phase;
+    uint8_t feature_count;
+};
+
+// The positions one thread loaded; it computes their share of every epoch
+struct Shard {
+    vector<TuneEntry> entries;
+    vector<TuneFeature> features;
+    size_t rejected = 0; // Malformed records and lines skipped
+};
+
+Params initial_params() {
+    Params params;
+    memset(&params, 0, sizeof(params));
+    for (int type = 0; type < 7; type++) {
+        params.mg[piece_offset + type] = mg_piece_values[type];
+        params.eg[piece_offset + type] = eg_piece_values[type];
+        for (int index = 0; index < 64; index++) {
+            params.mg[pst_offset + 64 * type + index] = mg_pst[type][index];
+            params.eg[pst_offset + 64 * type + index] = eg_pst[type][index];
+        }
+    }
+    params.mg[doubled_offset] = doubled_pawn_penalty[0];
+    params.eg[doubled_offset] = doubled_pawn_penalty[1];
+    params.mg[isolated_offset] = isolated_pawn_penalty[0];
+    params.eg[isolated_offset] = isolated_pawn_penalty[1];
+    params.mg[backward_offset] = backward_pawn_penalty[0];
+    params.eg[backward_offset] = backward_pawn_penalty[1];
+    for (int rank = 0; rank < 8; rank++) {
+        params.mg[passed_offset + rank] = passed_pawn_bonus[0][rank];
+        params.eg[passed_offset + rank] = passed_pawn_bonus[1][rank];
+    }
+    params.mg[shield_offset] = pawn_shield_bonus[0];
+    params.mg[shield_offset + 1] = pawn_shield_bonus[1];
+    return params;
+}
+
+// Parameters the evaluation reads in the endgame; the shield is middlegame only
+bool has_endgame_term(int index) {
+    return index < shield_offset;
+}
+
+// Sparse features of a position; penalties count negatively
+void append_features(const EvalTrace& trace, vector<TuneFeature>& features) {
+    auto add = [&](int index, int count) {
+        if (count != 0) features.push_back(TuneFeature{uint16_t(index), int16_t(count)});
+    };
+    for (int type = 1; type <= 6; type++) {
+        add(piece_offset + type, trace.pieces[type]);
+        for (int index = 0; index < 64; index++) {
+            add(pst_offset + 64 * type + index, trace.pst[type][index]);
+        }
+    }
+    add(doubled_offset, -trace.doubled_pawns);
+    add(isolated_offset, -trace.isolated_pawns);
+    add(backward_offset, -trace.backward_pawns);
+    for (int rank = 0; rank < 8; rank++) add(passed_offset + rank, trace.passed_pawns[rank]);
+    add(shield_offset, trace.shield_pawns[0]);
+    add(shield_offset + 1, trace.shield_pawns[1]);
+}
+
+// A labelled position to load: an EPD line or a packed record
+struct DatasetItem {
+    string_view line;
+    const PackedPosition* packed; // Null for EPD lines
+};
+
+bool is_capture(const Board& board, const Move& move) {
+    return move.promotion() != 0 || board.squares[move.to] != 0 || move.is_en_passant();
+}
+
+// Captures-only alpha-beta from the side to move's point of view. leaf
+// receives the position at the end of the principal variation.
+int quiescence(const Board& board, int alpha, int beta, Board& leaf) {
+    int stand_pat = evaluate_position(board);
+    leaf = board;
+    if (stand_pat >= beta) return stand_pat;
+    alpha = max(alpha, stand_pat);
+
+    // Most valuable victim first, then least valuable attacker
+    vector<pair<int, Move>> captures;
+    for (const Move& move : generate_all_legal_moves(board)) {
+        if (!is_capture(board, move)) continue;
+        int victim = board.squares[move.to] != 0 ? abs(board.squares[move.to]) : 1;
+        captures.emplace_back(-(victim * 8 + move.promotion()) * 8 + abs(board.squares[move.from]), move);
+    }
+    stable_sort(captures.begin(), captures.end(),
+                [](const pair<int, Move>& a, const pair<int, Move>& b) { return a.first < b.first; });
+
+    Board child_leaf;
+    for (const auto& [order, move] : captures) {
+        Board child = board;
+        make_move_simple(child, move);
+        int score = -quiescence(child, -beta, -alpha, child_leaf);
+        if (score > alpha) {
+            alpha = score;
+            leaf = child_leaf;
+            if (score >= beta) break;
+        }
+    }
+    return alpha;
+}
+
+// Parse, resolve and trace items [begin, end) into a shard
+void load_shard(const vector<DatasetItem>& items, size_t begin, size_t end, Shard& shard) {
+    Board board;
+    for (size_t i = begin; i < end; i++) {
+        int result;
+        if (items[i].packed) {
+            if (!unpack_position(*items[i].packed, board)) {
+                shard.rejected++;
+                continue;
+            }
+            result = packed_result(*items[i].packed);
+        } else {
+            string_view operations;
+            if (!parse_epd(items[i].line, board, &operations)) {
+                shard.rejected++;
+                continue;
+            }
+            result = parse_game_result(operations);
+        }
+        if (result == packed_result_unknown) continue;
+
+        Board leaf;
+        quiescence(board, -100000, 100000, leaf);
+        EvalTrace trace;
+        trace_evaluation(leaf, trace);
+
+        TuneEntry entry;
+        entry.first_feature = shard.features.size();
+        entry.result = result == packed_result_white_win ? 1.0f : result == packed_result_draw ? 0.5f : 0.0f;
+        entry.phase = uint8_t(trace.phase);
+        append_features(trace, shard.features);
+        entry.feature_count = uint8_t(shard.features.size() - entry.first_feature);
+        shard.entries.push_back(entry);
+    }
+}
+
+// White-relative evaluation of an entry under the given parameters
+inline double entry_eval(const Shard& shard, const TuneEntry& entry, const Params& params) {
+    double mg = 0, eg = 0;
+    const TuneFeature* feature = &shard.features[entry.first_feature];
+    for (int i = 0; i < entry.feature_count; i++) {
+        mg += feature[i].count * params.mg[feature[i].index];
+        eg += feature[i].count * params.eg[feature[i].index];
+    }
+    return (mg * entry.phase + eg * (max_phase - entry.phase)) / max_phase;
+}
+
+inline double sigmoid(double k, double eval) {
+    return 1.0 / (1.0 + exp(-k * eval * log(10.0) / 400.0));
+}
+
+// Run body(shard, thread) on every shard, one thread each
+template <typename Body>
+void for_each_shard(vector<Shard>& shards, Body body) {
+    vector<thread> threads;
+    for (size_t i = 0; i < shards.size(); i++) {
+        threads.emplace_back([&, i]() { body(shards[i], i); });
+    }
+    for (thread& t : threads) t.join();
+}
+
+double mean_error(vector<Shard>& shards, const Params& params, double k, size_t total) {
+    vector<double> sums(shards.size(), 0.0);
+    for_each_shard(shards, [&](Shard& shard, size_t i) {
+        double sum = 0;
+        for (const TuneEntry& entry : shard.entries) {
+            double error = entry.result - sigmoid(k, entry_eval(shard, entry, params));
+            sum += error * error;
+        }
+        sums[i] = sum;
+    });
+    double sum = 0;
+    for (double s : sums) sum += s;
+    return sum / total;
+}
+
+// Scaling constant that best maps the current evaluation to results
+double fit_k(vector<Shard>& shards, const Params& params, size_t total) {
+    double low = 0.01, high = 3.0;
+    const double golden = (sqrt(5.0) - 1) / 2;
+    double a = high - golden * (high - low), b = low + golden * (high - low);
+    double error_a = mean_error(shards, params, a, total);
+    double error_b = mean_error(shards, params, b, total);
+    for (int i = 0; i < 40; i++) {
+        if (error_a < error_b) {
+            high = b;
+            b = a;
+            error_b = error_a;
+            a = high - golden * (high - low);
+            error_a = mean_error(shards, params, a, total);
+        } else {
+            low = a;
+            a = b;
+            error_a = error_b;
+            b = low + golden * (high - low);
+            error_b = mean_error(shards, params, b, total);
+        }
+    }
+    return (low + high) / 2;
+}
+
+// Gradient of the mean squared error; returns the error as a by-product
+double compute_gradient(vector<Shard>& shards, const Params& params, double k, size_t total, Params& gradient) {
+    vector<Params> partial(shards.size());
+    vector<double> sums(shards.size(), 0.0);
+    for_each_shard(shards, [&](Shard& shard, size_t i) {
+        Params& local = partial[i];
+        memset(&local, 0, sizeof(local));
+        double sum = 0;
+        for (const TuneEntry& entry : shard.entries) {
+            double predicted = sigmoid(k, entry_eval(shard, entry, params));
+            double error = entry.result - predicted;
+            sum += error * error;
+
+            // d(error^2)/d(eval), split between the middlegame and endgame halves
+            double slope = -2.0 * error * predicted * (1 - predicted) * k * log(10.0) / 400.0;
+            double mg_slope = slope * entry.phase / max_phase;
+            double eg_slope = slope - mg_slope;
+            const TuneFeature* feature = &shard.features[entry.first_feature];
+            for (int f = 0; f < entry.feature_count; f++) {
+                local.mg[feature[f].index] += mg_slope * feature[f].count;
+                local.eg[feature[f].index] += eg_slope * feature[f].count;
+            }
+        }
+        sums[i] = sum;
+    });
+
+    memset(&gradient, 0, sizeof(gradient));
+    double sum = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        for (int p = 0; p < param_count; p++) {
+            gradient.mg[p] += partial[i].mg[p] / total;
+            gradient.eg[p] += partial[i].eg[p] / total;
+        }
+        sum += sums[i];
+    }
+    return sum / total;
+}
+
+// eval_params.h formatting
+string format_list(const double* values, int count) {
+    ostringstream out;
+    out << "{";
+    for (int i = 0; i < count; i++) out << (i ? ", " : "") << lround(values[i]);
+    out << "}";
+    return out.str();
+}
+
+string format_pair(const char* name, const Params& params, int index) {
+    ostringstream out;
+    out << "const int " << name << "[2] = {" << lround(params.mg[index]) << ", " << lround(params.eg[index]) << "};\n";
+    return out.str();
+}
+
+void write_pst(ostream& out, const char* name, const double* values) {
+    const char* piece_names[7] = {"", "Pawn", "Knight", "Bishop", "Rook", "Queen", "King"};
+    out << "const int " << name << "[7][64] = {\n";
+    out << "    {},\n";
+    for (int type = 1; type <= 6; type++) {
+        out << "    { // " << piece_names[type] << "\n";
+        for (int row = 0; row < 8; row++) {
+            out << "       ";
+            for (int file = 0; file < 8; file++) {
+                out << setw(4) << lround(values[64 * type + 8 * row + file]) << ",";
+            }
+            out << "\n";
+        }
+        out << "    },\n";
+    }
+    out << "};\n";
+}
+
+bool write_params(const string& path, const Params& params) {
+    ofstream out(path);
+    if (!out) return false;
+    out << "#pragma once\n"
+           "\n"
+           "// Evaluation parameters as (middlegame, endgame) pairs in centipawns.\n"
+           "// Generated by the tune tool (see tune.cpp), starting from the PeSTO\n"
+           "// tables. Piece-square tables are laid out as seen from white, a8 first.\n"
+           "\n";
+    out << "const int mg_piece_values[7] = " << format_list(params.mg + piece_offset, 7) << ";\n";
+    out << "const int eg_piece_values[7] = " << format_list(params.eg + piece_offset, 7) << ";\n";
+    out << "\n";
+    write_pst(out, "mg_pst", params.mg + pst_offset);
+    out << "\n";
+    write_pst(out, "eg_pst", params.eg + pst_offset);
+    out << "\n";
+    out << "// Pawn-structure terms (middlegame, endgame)\n";
+    out << format_pair("doubled_pawn_penalty", params, doubled_offset);
+    out << format_pair("isolated_pawn_penalty", params, isolated_offset);
+    out << format_pair("backward_pawn_penalty", params, backward_offset);
+    out << "const int passed_pawn_bonus[2][8] = {   // By rank from the pawn's own side\n";
+    out << "    " << format_list(params.mg + passed_offset, 8) << ",\n";
+    out << "    " << format_list(params.eg + passed_offset, 8) << ",\n";
+    out << "};\n";
+    out << "const int pawn_shield_bonus[2] = " << format_list(params.mg + shield_offset, 2)
+        << "; // Middlegame only: one and two ranks ahead of the king\n";
+    return bool(out);
+}
+
+int main(int argc, char* argv[]) {
+    int threads = max(1u, thread::hardware_concurrency());
+    int epochs = 500;
+    double rate = 1.0;
+    string output = "eval_params.h";
+    vector<string> datasets;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--epochs" && i + 1 < argc) {
+            epochs = max(0, atoi(argv[++i]));
+        } else if (arg == "--rate" && i + 1 < argc) {
+            rate = atof(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            datasets.clear();
+            break;
+        } else {
+            datasets.push_back(arg);
+        }
+    }
+    if (datasets.empty()) {
+        cerr << "Usage: tune [--threads N] [--epochs N] [--rate R] [--output PATH] DATASET..." << endl;
+        return 1;
+    }
+
+    // Load: collect the lines and records of every file, then resolve them on all threads
+    auto start = chrono::steady_clock::now();
+    vector<unique_ptr<EpdReader>> epd_readers;
+    vector<unique_ptr<PackedReader>> packed_readers;
+    vector<DatasetItem> items;
+    for (const string& path : datasets) {
+        if (is_packed_file(path)) {
+            packed_readers.push_back(make_unique<PackedReader>(path));
+            const PackedReader& reader = *packed_readers.back();
+            for (size_t i = 0; i < reader.size(); i++) items.push_back(DatasetItem{string_view(), &reader[i]});
+            continue;
+        }
+        epd_readers.push_back(make_unique<EpdReader>(path));
+        if (!epd_readers.back()->is_open()) {
+            cerr << "Cannot open " << path << endl;
+            return 1;
+        }
+        string_view line;
+        while (epd_readers.back()->next_line(line)) items.push_back(DatasetItem{line, nullptr});
+    }
+
+    vector<Shard> shards(threads);
+    for_each_shard(shards, [&](Shard& shard, size_t i) {
+        load_shard(items, items.size() * i / threads, items.size() * (i + 1) / threads, shard);
+    });
+    epd_readers.clear();
+    packed_readers.clear();
+
+    size_t total = 0, feature_total = 0, rejected = 0;
+    for (const Shard& shard : shards) {
+        total += shard.entries.size();
+        feature_total += shard.features.size();
+        rejected += shard.rejected;
+    }
+    double load_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Loaded " << total << " of " << items.size() << " positions in " << fixed << setprecision(1)
+         << load_seconds << " s (" << (total * sizeof(TuneEntry) + feature_total * sizeof(TuneFeature)) / (1024 * 1024)
+         << " MB)" << endl;
+    if (rejected) cout << "Skipped " << rejected << " malformed positions" << endl;
+    if (total == 0) {
+        cerr << "No labelled positions" << endl;
+        return 1;
+    }
+
+    Params params = initial_params();
+    double k = fit_k(shards, params, total);
+    cout << "K = " << setprecision(4) << k << ", error " << setprecision(6) << mean_error(shards, params, k, total) << endl;
+
+    // Adam
+    const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8;
+    Params momentum, velocity, gradient;
+    memset(&momentum, 0, sizeof(momentum));
+    memset(&velocity, 0, sizeof(velocity));
+    auto tune_start = chrono::steady_clock::now();
+    for (int epoch = 1; epoch <= epochs; epoch++) {
+        double error = compute_gradient(shards, params, k, total, gradient);
+
+        double correction1 = 1 - pow(beta1, epoch), correction2 = 1 - pow(beta2, epoch);
+        for (int p = 0; p < param_count; p++) {
+            if (!has_endgame_term(p)) gradient.eg[p] = 0;
+
+            momentum.mg[p] = beta1 * momentum.mg[p] + (1 - beta1) * gradient.mg[p];
+            momentum.eg[p] = beta1 * momentum.eg[p] + (1 - beta1) * gradient.eg[p];
+            velocity.mg[p] = beta2 * velocity.mg[p] + (1 - beta2) * gradient.mg[p] * gradient.mg[p];
+            velocity.eg[p] = beta2 * velocity.eg[p] + (1 - beta2) * gradient.eg[p] * gradient.eg[p];
+            params.mg[p] -= rate * (momentum.mg[p] / correction1) / (sqrt(velocity.mg[p] / correction2) + epsilon);
+            params.eg[p] -= rate * (momentum.eg[p] / correction1) / (sqrt(velocity.eg[p] / correction2) + epsilon);
+        }
+
+        if (epoch % 50 == 0 || epoch == epochs) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - tune_start).count();
+            cout << "Epoch " << epoch << ": error " << setprecision(6) << error << ", "
+                 << setprecision(2) << seconds / epoch << " s/epoch" << endl;
+            if (!write_params(output, params)) {
+                cerr << "Cannot write " << output << endl;
+                return 1;
+            }
+        }
+    }
+
+    if (!write_params(output, params)) {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+    }
+    cout << "Wrote " << output << endl;
+    return 0;
+}